@@ -0,0 +1,359 @@
+#include "analytics.h"
+
+#include <time.h>
+
+static double getSeconds(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Root of i, halves the path on the way (the smallest index of a set is its root)
+static int findRoot(int* parents, int i){
+	while (parents[i] != i){
+		parents[i] = parents[parents[i]];
+		i = parents[i];
+	}
+	return i;
+}
+
+static void unite(int* parents, int a, int b){
+	a = findRoot(parents, a);
+	b = findRoot(parents, b);
+	if (a < b){
+		parents[b] = a;
+	}else if (b < a){
+		parents[a] = b;
+	}
+}
+
+/*----------------------------------*/
+
+static void freeTiles(Analytics* analytics){
+	int t;
+	for (t = 0; t < analytics->tilesX * analytics->tilesY; t++){
+		free(analytics->tiles[t].mask);
+		free(analytics->tiles[t].labels);
+		free(analytics->tiles[t].sizes);
+	}
+	free(analytics->tiles);
+	free(analytics->componentStart);
+	analytics->tiles = NULL;
+	analytics->componentStart = NULL;
+	analytics->tilesX = analytics->tilesY = 0;
+}
+
+// Tiles for a trailMap of width * height pixels, nothing is labeled yet
+static void setupTiles(Analytics* analytics, int width, int height, int speciesCount){
+	freeTiles(analytics);
+	analytics->width = width;
+	analytics->height = height;
+	analytics->speciesCount = speciesCount;
+	analytics->tilesX = (width + ANALYTICS_TILE - 1) / ANALYTICS_TILE;
+	analytics->tilesY = (height + ANALYTICS_TILE - 1) / ANALYTICS_TILE;
+	int tileCount = analytics->tilesX * analytics->tilesY, t;
+	analytics->tiles = calloc(tileCount, sizeof(AnalyticsTile));
+	analytics->componentStart = malloc(tileCount * sizeof(int));
+	for (t = 0; t < tileCount; t++){
+		AnalyticsTile* tile = &analytics->tiles[t];
+		tile->x0 = t % analytics->tilesX * ANALYTICS_TILE;
+		tile->y0 = t / analytics->tilesX * ANALYTICS_TILE;
+		tile->width = width - tile->x0 < ANALYTICS_TILE ? width - tile->x0 : ANALYTICS_TILE;
+		tile->height = height - tile->y0 < ANALYTICS_TILE ? height - tile->y0 : ANALYTICS_TILE;
+		tile->mask = calloc((size_t)tile->width * tile->height, 1);
+		tile->labels = calloc((size_t)tile->width * tile->height, sizeof(uint16_t));
+		tile->sizes = malloc((size_t)tile->width * tile->height * sizeof(int));
+	}
+}
+
+// Two pass labeling of the 8-connected network pixels of a tile
+static void labelTile(AnalyticsTile* tile){
+	// Provisional labels start at 1, at most one per pixel
+	int parents[ANALYTICS_TILE * ANALYTICS_TILE + 1];
+	int count = 0, x, y, k;
+	for (y = 0; y < tile->height; y++){
+		for (x = 0; x < tile->width; x++){
+			int i = y * tile->width + x;
+			if (!tile->mask[i]){
+				tile->labels[i] = 0;
+				continue;
+			}
+			// Left, upper left, up and upper right are labeled already
+			int neighbors[4] = {
+				x > 0 ? tile->labels[i - 1] : 0,
+				x > 0 && y > 0 ? tile->labels[i - tile->width - 1] : 0,
+				y > 0 ? tile->labels[i - tile->width] : 0,
+				x + 1 < tile->width && y > 0 ? tile->labels[i - tile->width + 1] : 0
+			};
+			int label = 0;
+			for (k = 0; k < 4; k++){
+				if (neighbors[k] == 0) continue;
+				if (label == 0){
+					label = neighbors[k];
+				}else{
+					unite(parents, label, neighbors[k]);
+				}
+			}
+			if (label == 0){
+				label = ++count;
+				parents[label] = label;
+			}
+			tile->labels[i] = (uint16_t)label;
+		}
+	}
+
+	// Number the roots 1 ... componentCount and count their pixels
+	int components[ANALYTICS_TILE * ANALYTICS_TILE + 1];
+	tile->componentCount = 0;
+	for (k = 1; k <= count; k++){
+		if (findRoot(parents, k) == k){
+			components[k] = ++tile->componentCount;
+			tile->sizes[tile->componentCount - 1] = 0;
+		}
+	}
+	for (k = 0; k < tile->width * tile->height; k++){
+		if (tile->labels[k] == 0) continue;
+		int component = components[findRoot(parents, tile->labels[k])];
+		tile->labels[k] = (uint16_t)component;
+		tile->sizes[component - 1]++;
+	}
+	tile->labeled = 1;
+}
+
+// Reduce a tile of the current trailMap and label it again if its network pixels changed
+static void analyzeTile(Analytics* analytics, AnalyticsTile* tile){
+	const PhysarumTrailLayout* layout = &analytics->layout;
+	size_t pixels = (size_t)layout->width * layout->height;
+	const float* layers[MAX_SPECIES];
+	int species, x, y, changed = !tile->labeled;
+	// Layer species / channels, channel species % channels
+	for (species = 0; species < analytics->speciesCount; species++){
+		layers[species] = analytics->trailMap + (size_t)(species / layout->channels) * pixels * layout->channels + species % layout->channels;
+	}
+
+	tile->covered = 0;
+	memset(tile->histogram, 0, sizeof(tile->histogram));
+	memset(tile->sums, 0, sizeof(tile->sums));
+	memset(tile->speciesCovered, 0, sizeof(tile->speciesCovered));
+	memset(tile->territory, 0, sizeof(tile->territory));
+	for (y = 0; y < tile->height; y++){
+		size_t p = (size_t)(tile->y0 + y) * layout->width + tile->x0;
+		uint8_t* mask = tile->mask + y * tile->width;
+		for (x = 0; x < tile->width; x++, p++){
+			float total = 0.0f, strongest = 0.0f;
+			int dominant = 0;
+			for (species = 0; species < analytics->speciesCount; species++){
+				float value = layers[species][p * layout->channels];
+				tile->sums[species] += value;
+				tile->speciesCovered[species] += value >= analytics->level;
+				total += value;
+				if (value > strongest){
+					strongest = value;
+					dominant = species;
+				}
+			}
+			tile->histogram[total >= 1.0f ? ANALYTICS_BINS - 1 : (total > 0.0f ? (int)(total * ANALYTICS_BINS) : 0)]++;
+
+			uint8_t covered = strongest >= analytics->level;
+			tile->covered += covered;
+			tile->territory[dominant] += covered;
+			changed |= mask[x] != covered;
+			mask[x] = covered;
+		}
+	}
+	if (changed){
+		labelTile(tile);
+	}
+	tile->relabeled = changed;
+}
+
+static void analyzeTiles(int begin, int end, int thread, void* userData){
+	Analytics* analytics = (Analytics*)userData;
+	int t;
+	for (t = begin; t < end; t++){
+		analyzeTile(analytics, &analytics->tiles[t]);
+	}
+}
+
+// Component of pixel (x, y) in parents, -1 if it is not in the network
+static int getComponent(const Analytics* analytics, int x, int y){
+	int t = y / ANALYTICS_TILE * analytics->tilesX + x / ANALYTICS_TILE;
+	const AnalyticsTile* tile = &analytics->tiles[t];
+	int label = tile->labels[(y - tile->y0) * tile->width + x - tile->x0];
+	return label ? analytics->componentStart[t] + label - 1 : -1;
+}
+
+static void uniteNeighbor(Analytics* analytics, int component, int x, int y){
+	if (x < 0 || x >= analytics->width || y < 0 || y >= analytics->height) return;
+	int neighbor = getComponent(analytics, x, y);
+	if (neighbor >= 0){
+		unite(analytics->parents, component, neighbor);
+	}
+}
+
+// Join the components of the tiles along the tile borders, returns the number of components and the size of the largest
+static long joinTiles(Analytics* analytics, long* largest){
+	int tileCount = analytics->tilesX * analytics->tilesY, t, c, i;
+	int total = 0;
+	for (t = 0; t < tileCount; t++){
+		analytics->componentStart[t] = total;
+		total += analytics->tiles[t].componentCount;
+	}
+	if (total > analytics->componentCapacity){
+		analytics->componentCapacity = total;
+		analytics->parents = realloc(analytics->parents, total * sizeof(int));
+		analytics->componentSizes = realloc(analytics->componentSizes, total * sizeof(int));
+	}
+	for (t = 0; t < tileCount; t++){
+		for (c = 0; c < analytics->tiles[t].componentCount; c++){
+			analytics->parents[analytics->componentStart[t] + c] = analytics->componentStart[t] + c;
+			analytics->componentSizes[analytics->componentStart[t] + c] = analytics->tiles[t].sizes[c];
+		}
+	}
+
+	// Right column and bottom row of every tile against the pixels of the next tiles (with the diagonals)
+	for (t = 0; t < tileCount; t++){
+		const AnalyticsTile* tile = &analytics->tiles[t];
+		int x = tile->x0 + tile->width - 1, y;
+		if (x + 1 < analytics->width){
+			for (y = tile->y0; y < tile->y0 + tile->height; y++){
+				int component = getComponent(analytics, x, y);
+				if (component < 0) continue;
+				for (i = -1; i <= 1; i++){
+					uniteNeighbor(analytics, component, x + 1, y + i);
+				}
+			}
+		}
+		y = tile->y0 + tile->height - 1;
+		if (y + 1 < analytics->height){
+			for (x = tile->x0; x < tile->x0 + tile->width; x++){
+				int component = getComponent(analytics, x, y);
+				if (component < 0) continue;
+				for (i = -1; i <= 1; i++){
+					uniteNeighbor(analytics, component, x + i, y + 1);
+				}
+			}
+		}
+	}
+
+	// Roots are the smallest component of their set, the sizes are added up in order
+	long components = 0;
+	*largest = 0;
+	for (c = 0; c < total; c++){
+		int root = findRoot(analytics->parents, c);
+		if (root == c){
+			components++;
+		}else{
+			analytics->componentSizes[root] += analytics->componentSizes[c];
+		}
+	}
+	for (c = 0; c < total; c++){
+		if (analytics->parents[c] == c && analytics->componentSizes[c] > *largest){
+			*largest = analytics->componentSizes[c];
+		}
+	}
+	return components;
+}
+
+/*----------------------------------*/
+
+void initAnalytics(Analytics* analytics, FILE* output, int format, int interval, float level, int threads){
+	memset(analytics, 0, sizeof(Analytics));
+	analytics->output = output;
+	analytics->format = format;
+	analytics->interval = interval > 0 ? interval : 1;
+	analytics->level = level;
+	analytics->nextStep = analytics->interval;
+	// Not pinned: the workers of the simulation are idle while the trailMap is analyzed
+	if (threads > 1 && initThreadPool(&analytics->poolStorage, threads, NULL) == 0){
+		analytics->pool = &analytics->poolStorage;
+	}
+}
+
+void destroyAnalytics(Analytics* analytics){
+	freeTiles(analytics);
+	free(analytics->parents);
+	free(analytics->componentSizes);
+	if (analytics->pool){
+		destroyThreadPool(analytics->pool);
+	}
+}
+
+void analyzeTrailMap(Analytics* analytics, const float* trailMap, const PhysarumTrailLayout* layout, int speciesCount, long step){
+	double start = getSeconds();
+	// CSV rows get a new header when the number of species changed
+	int header = analytics->samples == 0 || speciesCount != analytics->speciesCount;
+	if (analytics->tiles == NULL || layout->width != analytics->width || layout->height != analytics->height || speciesCount != analytics->speciesCount){
+		setupTiles(analytics, layout->width, layout->height, speciesCount);
+	}
+	analytics->trailMap = trailMap;
+	analytics->layout = *layout;
+
+	int tileCount = analytics->tilesX * analytics->tilesY, t, s, b;
+	if (analytics->pool){
+		parallelFor(analytics->pool, tileCount, 1, analyzeTiles, analytics);
+	}else{
+		analyzeTiles(0, tileCount, 0, analytics);
+	}
+
+	// Add up the tiles in order, the results do not depend on the workers
+	long covered = 0, histogram[ANALYTICS_BINS] = {0}, speciesCovered[MAX_SPECIES] = {0}, territory[MAX_SPECIES] = {0};
+	double sums[MAX_SPECIES] = {0};
+	analytics->relabeled = 0;
+	for (t = 0; t < tileCount; t++){
+		AnalyticsTile* tile = &analytics->tiles[t];
+		covered += tile->covered;
+		for (b = 0; b < ANALYTICS_BINS; b++){
+			histogram[b] += tile->histogram[b];
+		}
+		for (s = 0; s < speciesCount; s++){
+			sums[s] += tile->sums[s];
+			speciesCovered[s] += tile->speciesCovered[s];
+			territory[s] += tile->territory[s];
+		}
+		analytics->relabeled += tile->relabeled;
+	}
+	long largest;
+	long components = joinTiles(analytics, &largest);
+	double elapsed = getSeconds() - start;
+
+	// Parts of all pixels, the largest component as part of the network
+	double pixels = (double)layout->width * layout->height;
+	FILE* out = analytics->output;
+	if (analytics->format == ANALYTICS_JSON){
+		fprintf(out, "{\"step\": %ld, \"coverage\": %.6f, \"components\": %ld, \"largestComponent\": %.6f, \"relabeledTiles\": %d, \"milliseconds\": %.3f, \"species\": [",
+			step, covered / pixels, components, covered ? (double)largest / covered : 0., analytics->relabeled, elapsed * 1000.);
+		for (s = 0; s < speciesCount; s++){
+			fprintf(out, "%s{\"coverage\": %.6f, \"mean\": %.6f, \"territory\": %.6f}", s ? ", " : "", speciesCovered[s] / pixels, sums[s] / pixels, territory[s] / pixels);
+		}
+		fprintf(out, "], \"density\": [");
+		for (b = 0; b < ANALYTICS_BINS; b++){
+			fprintf(out, "%s%.6f", b ? ", " : "", histogram[b] / pixels);
+		}
+		fprintf(out, "]}\n");
+	}else{
+		if (header){
+			fprintf(out, "step,coverage,components,largest_component,relabeled_tiles,milliseconds");
+			for (s = 0; s < speciesCount; s++){
+				fprintf(out, ",coverage_%d,mean_%d,territory_%d", s + 1, s + 1, s + 1);
+			}
+			for (b = 0; b < ANALYTICS_BINS; b++){
+				fprintf(out, ",density_%d", b);
+			}
+			fprintf(out, "\n");
+		}
+		fprintf(out, "%ld,%.6f,%ld,%.6f,%d,%.3f", step, covered / pixels, components, covered ? (double)largest / covered : 0., analytics->relabeled, elapsed * 1000.);
+		for (s = 0; s < speciesCount; s++){
+			fprintf(out, ",%.6f,%.6f,%.6f", speciesCovered[s] / pixels, sums[s] / pixels, territory[s] / pixels);
+		}
+		for (b = 0; b < ANALYTICS_BINS; b++){
+			fprintf(out, ",%.6f", histogram[b] / pixels);
+		}
+		fprintf(out, "\n");
+	}
+	// Rows are read live (tail -f, a pipe)
+	fflush(out);
+
+	analytics->samples++;
+	analytics->nextStep = step - step % analytics->interval + analytics->interval;
+}
@@ -0,0 +1,78 @@
+#ifndef ANALYTICS_H
+#define ANALYTICS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "settings.h"
+#include "threadpool.h"
+#include "physarum.h"
+
+#define ANALYTICS_TILE 64	// pixels per side of the tiles that are labeled on their own
+#define ANALYTICS_BINS 16	// histogram of the trail density (all species) over [0, 1], the last bin holds everything above
+#define ANALYTICS_INTERVAL 10	// default steps from one analysis to the next
+#define ANALYTICS_LEVEL 0.05f	// default trail above which a pixel belongs to the network
+
+// Output formats
+#define ANALYTICS_CSV 0	// header and one row per analysis
+#define ANALYTICS_JSON 1	// one object per line
+
+/*
+Network metrics of the trailMap, computed every interval steps while the simulation runs: coverage, density histogram,
+connected components of the network (8-connected pixels above level) and territory (pixels a species dominates).
+The trailMap is split into tiles that are reduced and labeled in parallel. A tile is only labeled again if its
+network pixels changed, the components of all tiles are then joined along the tile borders with a union find,
+so a network that has settled costs little more than the reductions.
+https://en.wikipedia.org/wiki/Connected-component_labeling	(two pass)
+*/
+
+// Per tile state, kept from one analysis to the next
+typedef struct AnalyticsTile{
+	int x0, y0, width, height;
+	uint8_t* mask;	// network pixels of the last analysis
+	uint16_t* labels;	// component of every pixel in the tile, 0: not in the network
+	int* sizes;	// pixels of local component 1 ... componentCount at [0 ... componentCount - 1]
+	int componentCount;
+	int labeled;	// labels are up to date with mask
+	int relabeled;	// labeled in the last analysis
+	// Reductions of the last analysis
+	long covered;	// pixels in the network
+	long histogram[ANALYTICS_BINS];
+	double sums[MAX_SPECIES];
+	long speciesCovered[MAX_SPECIES], territory[MAX_SPECIES];
+}AnalyticsTile;
+
+typedef struct Analytics{
+	FILE* output;
+	int format;	// ANALYTICS_CSV or ANALYTICS_JSON
+	int interval;
+	float level;
+	long nextStep;	// step of the next analysis
+	ThreadPool* pool;	// reduces and labels the tiles, NULL: on the calling thread
+	ThreadPool poolStorage;
+	// Tiles of the trailMap size and species the analytics were set up for
+	int width, height, speciesCount;
+	int tilesX, tilesY;
+	AnalyticsTile* tiles;
+	int* componentStart;	// first component of every tile in parents
+	int* parents;	// union find over the components of all tiles
+	int* componentSizes;	// pixels of every root
+	int componentCapacity;
+	// Current analysis
+	const float* trailMap;
+	PhysarumTrailLayout layout;
+	int relabeled;	// tiles labeled again
+	long samples;
+}Analytics;
+
+// Write the metrics every interval steps to output in format, tiles are analyzed by threads workers
+void initAnalytics(Analytics* analytics, FILE* output, int format, int interval, float level, int threads);
+
+void destroyAnalytics(Analytics* analytics);
+
+// Analyze trailMap (layout of physarumMapTrailMap, speciesCount species) of step and write a row
+void analyzeTrailMap(Analytics* analytics, const float* trailMap, const PhysarumTrailLayout* layout, int speciesCount, long step);
+
+#endif
@@ -0,0 +1,74 @@
+#include "arena.h"
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+void initArena(Arena* arena){
+	arena->base = NULL;
+	arena->size = 0;
+	arena->used = 0;
+	arena->pageKind = ARENA_NORMAL_PAGES;
+}
+
+int reserveArena(Arena* arena, size_t size){
+	if (size <= arena->size) return 0;
+	
+	destroyArena(arena);
+	size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+	
+	// Explicit huge pages first, they only exist if the admin reserved some
+	void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (base != MAP_FAILED){
+		arena->pageKind = ARENA_HUGE_PAGES;
+	}else{
+		// Transparent huge pages need 2MB aligned memory, map one huge page more and cut it to the boundary
+		base = mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED){
+			printf("Failed to map an arena of %zu MB\n", size >> 20);
+			return -1;
+		}
+		char* aligned = (char*)(((size_t)base + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+		if (aligned > (char*)base) munmap(base, aligned - (char*)base);
+		munmap(aligned + size, (char*)base + HUGE_PAGE_SIZE - aligned);
+		base = aligned;
+		
+		arena->pageKind = madvise(base, size, MADV_HUGEPAGE) == 0 ? ARENA_TRANSPARENT_HUGE_PAGES : ARENA_NORMAL_PAGES;
+	}
+	
+	arena->base = base;
+	arena->size = size;
+	arena->used = 0;
+	return 1;
+}
+
+void clearArena(Arena* arena){
+	arena->used = 0;
+}
+
+void* arenaAlloc(Arena* arena, size_t size){
+	size_t offset = (arena->used + 63) & ~(size_t)63;
+	if (arena->base == NULL || offset + size > arena->size) return NULL;
+	arena->used = offset + size;
+	return arena->base + offset;
+}
+
+void destroyArena(Arena* arena){
+	if (arena->base){
+		munmap(arena->base, arena->size);
+	}
+	initArena(arena);
+}
+
+const char* getArenaPageKindName(const Arena* arena){
+	switch (arena->pageKind){
+		case ARENA_HUGE_PAGES: return "2MB huge pages";
+		case ARENA_TRANSPARENT_HUGE_PAGES: return "transparent huge pages";
+		default: return "4KB pages";
+	}
+}
+
+long getPageFaults(void){
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_minflt + usage.ru_majflt;
+}
@@ -0,0 +1,42 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Page kind of an arena
+#define ARENA_NORMAL_PAGES 0
+#define ARENA_TRANSPARENT_HUGE_PAGES 1	// madvise, the kernel may or may not back it with huge pages
+#define ARENA_HUGE_PAGES 2	// MAP_HUGETLB, needs reserved pages (vm.nr_hugepages)
+
+// One big mapping that buffers are carved from, reused across resets instead of allocating again
+typedef struct Arena{
+	char* base;
+	size_t size, used;
+	int pageKind;	// ARENA_*
+}Arena;
+
+// Empty arena, nothing is mapped until reserveArena
+void initArena(Arena* arena);
+
+// Make sure size bytes fit, remaps (and forgets all buffers) only if the arena is too small
+// Returns 1 if the arena was remapped, -1 on failure
+int reserveArena(Arena* arena, size_t size);
+
+// Forget all buffers, the memory stays mapped (and its pages stay faulted in)
+void clearArena(Arena* arena);
+
+// size bytes aligned to 64, NULL if the arena is full
+void* arenaAlloc(Arena* arena, size_t size);
+
+void destroyArena(Arena* arena);
+
+const char* getArenaPageKindName(const Arena* arena);
+
+// Minor + major page faults of the process so far
+long getPageFaults(void);
+
+#endif
@@ -0,0 +1,112 @@
+#include "autotune.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define AUTOTUNE_LINE 512
+
+int getTuningPath(char* path, size_t size){
+	const char* override = getenv("PHYSARUM_AUTOTUNE");
+	const char* cache = getenv("XDG_CACHE_HOME");
+	const char* home = getenv("HOME");
+	int length;
+	if (override && override[0]){
+		length = snprintf(path, size, "%s", override);
+	}else if (cache && cache[0]){
+		length = snprintf(path, size, "%s/%s", cache, AUTOTUNE_FILE);
+	}else if (home && home[0]){
+		length = snprintf(path, size, "%s/.cache/%s", home, AUTOTUNE_FILE);
+	}else{
+		return -1;
+	}
+	return length > 0 && (size_t)length < size ? 0 : -1;
+}
+
+// Key of a cache line into key (up to the tab), returns the values after it
+static const char* splitLine(const char* line, char* key, size_t size){
+	const char* tab = strchr(line, '\t');
+	if (tab == NULL || (size_t)(tab - line) >= size) return NULL;
+	memcpy(key, line, tab - line);
+	key[tab - line] = '\0';
+	return tab + 1;
+}
+
+int loadTuning(const char* key, int values[AUTOTUNE_VALUES]){
+	char path[512], line[AUTOTUNE_LINE], lineKey[AUTOTUNE_KEY];
+	if (getTuningPath(path, sizeof(path)) != 0) return -1;
+	FILE* file = fopen(path, "r");
+	if (file == NULL) return -1;
+	int found = -1;
+	while (found != 0 && fgets(line, sizeof(line), file)){
+		const char* rest = splitLine(line, lineKey, sizeof(lineKey));
+		if (rest == NULL || strcmp(lineKey, key) != 0) continue;
+		int read[AUTOTUNE_VALUES], i, offset = 0, consumed;
+		for (i = 0; i < AUTOTUNE_VALUES; i++){
+			if (sscanf(rest + offset, "%d%n", &read[i], &consumed) != 1 || read[i] <= 0) break;
+			offset += consumed;
+		}
+		if (i == AUTOTUNE_VALUES){
+			memcpy(values, read, sizeof(read));
+			found = 0;
+		}
+	}
+	fclose(file);
+	return found;
+}
+
+// mkdir -p of the directory of path
+static void createDirectories(const char* path){
+	char directory[512];
+	snprintf(directory, sizeof(directory), "%s", path);
+	char* slash;
+	for (slash = strchr(directory + 1, '/'); slash; slash = strchr(slash + 1, '/')){
+		*slash = '\0';
+		if (mkdir(directory, 0755) != 0 && errno != EEXIST) return;
+		*slash = '/';
+	}
+}
+
+int saveTuning(const char* key, const int values[AUTOTUNE_VALUES]){
+	char path[512], temporary[540], line[AUTOTUNE_LINE], lineKey[AUTOTUNE_KEY];
+	if (getTuningPath(path, sizeof(path)) != 0) return -1;
+	createDirectories(path);
+	// Written next to the cache and renamed over it, a concurrent reader sees the old or the new file
+	snprintf(temporary, sizeof(temporary), "%s.%d", path, (int)getpid());
+	FILE* output = fopen(temporary, "w");
+	if (output == NULL) return -1;
+	FILE* input = fopen(path, "r");
+	if (input){
+		while (fgets(line, sizeof(line), input)){
+			if (splitLine(line, lineKey, sizeof(lineKey)) && strcmp(lineKey, key) != 0){
+				fputs(line, output);
+			}
+		}
+		fclose(input);
+	}
+	fprintf(output, "%s\t", key);
+	int i;
+	for (i = 0; i < AUTOTUNE_VALUES; i++){
+		fprintf(output, i + 1 < AUTOTUNE_VALUES ? "%d " : "%d\n", values[i]);
+	}
+	int failed = ferror(output);
+	if (fclose(output) != 0 || failed || rename(temporary, path) != 0){
+		remove(temporary);
+		return -1;
+	}
+	return 0;
+}
+
+int tuneParameter(int parameter, const int* candidates, int count, int fallback, TuneFunction measure, void* userData, double* seconds){
+	int best = fallback, i;
+	double bestTime = -1;
+	for (i = 0; i < count; i++){
+		double time = measure(parameter, candidates[i], userData);
+		if (time >= 0 && (bestTime < 0 || time < bestTime)){
+			best = candidates[i];
+			bestTime = time;
+		}
+	}
+	if (seconds) *seconds = bestTime;
+	return best;
+}
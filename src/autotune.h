@@ -0,0 +1,37 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AUTOTUNE_VALUES 2	// tuned sizes per key (gpu: agent workgroup, diffuse tile; cpu: agent chunk, diffuse bands per chunk)
+#define AUTOTUNE_WARMUP 1	// steps of a candidate before the timed ones (compilation, first touch)
+#define AUTOTUNE_STEPS 3	// timed steps per candidate, the fastest one counts
+#define AUTOTUNE_KEY 256	// bytes of a key
+#define AUTOTUNE_FILE "physarum/autotune.txt"	// in $XDG_CACHE_HOME or ~/.cache, $PHYSARUM_AUTOTUNE overrides the path
+
+/*
+Picks the fastest of a few candidate sizes by running the simulation with each of them, one size at a time
+(the others stay at the best value so far), and caches the winners per machine.
+The cache holds one line per key: the key (host, engine, device, grid, agents, species, kernel switches), a tab
+and the AUTOTUNE_VALUES sizes. Lines of other keys are kept when a key is written.
+*/
+
+// Seconds of a step with size candidate of parameter, < 0 if the candidate does not work
+typedef double (*TuneFunction)(int parameter, int candidate, void* userData);
+
+// Path of the cache file into path, returns 0 if there is one (a home or cache directory)
+int getTuningPath(char* path, size_t size);
+
+// Sizes cached for key into values, returns 0 if the key is in the cache
+int loadTuning(const char* key, int values[AUTOTUNE_VALUES]);
+
+// Write the sizes of key into the cache (creates the directory), returns 0 on success
+int saveTuning(const char* key, const int values[AUTOTUNE_VALUES]);
+
+// Candidate of candidates[0 ... count - 1] with the fastest step, *seconds: its time (NULL if not needed)
+// Returns fallback if no candidate works
+int tuneParameter(int parameter, const int* candidates, int count, int fallback, TuneFunction measure, void* userData, double* seconds);
+
+#endif
@@ -0,0 +1,99 @@
+#include "capture.h"
+
+/*
+http://www.songho.ca/opengl/gl_pbo.html	(asynchronous read-back with PBOs)
+https://www.khronos.org/opengl/wiki/Sync_Object
+*/
+
+// Size of one frame in bytes
+static size_t frameSize(Capture* capture){
+	return (size_t)capture->width * capture->height * capture->layers * capture->components * sizeof(float);
+}
+
+void initCapture(Capture* capture, int width, int height, int layers, GLenum format, FrameCallback callback, void* userData){
+	capture->width = width;
+	capture->height = height;
+	capture->layers = layers;
+	capture->format = format;
+	capture->components = (format == GL_RED) ? 1 : (format == GL_RG) ? 2 : (format == GL_RGB) ? 3 : 4;
+	capture->callback = callback;
+	capture->userData = userData;
+	capture->head = 0;
+	capture->pending = 0;
+	capture->frameCount = 0;
+	
+	glGenBuffers(CAPTURE_RING_SIZE, capture->pbo);
+	
+	int i;
+	for (i = 0; i < CAPTURE_RING_SIZE; i++){
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbo[i]);
+		// GL_STREAM_READ: written by the gpu once, read by the cpu once
+		glBufferData(GL_PIXEL_PACK_BUFFER, frameSize(capture), NULL, GL_STREAM_READ);
+		capture->fence[i] = NULL;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Map the oldest frame in flight, hand it to the callback and free its slot
+static void consumeOldest(Capture* capture){
+	int slot = (capture->head - capture->pending + CAPTURE_RING_SIZE) % CAPTURE_RING_SIZE;
+	
+	// Only blocks if the gpu is more than CAPTURE_RING_SIZE - 1 frames behind
+	glClientWaitSync(capture->fence[slot], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+	glDeleteSync(capture->fence[slot]);
+	capture->fence[slot] = NULL;
+	
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbo[slot]);
+	const float* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameSize(capture), GL_MAP_READ_BIT);
+	if (pixels){
+		capture->callback(pixels, capture->width, capture->height, capture->layers * capture->components, capture->frame[slot], capture->userData);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	
+	capture->pending--;
+}
+
+void captureFrame(Capture* capture, unsigned int texture){
+	// Hand over every frame that is already done without waiting
+	while (capture->pending > 0){
+		int oldest = (capture->head - capture->pending + CAPTURE_RING_SIZE) % CAPTURE_RING_SIZE;
+		if (glClientWaitSync(capture->fence[oldest], 0, 0) == GL_TIMEOUT_EXPIRED) break;
+		consumeOldest(capture);
+	}
+	// Ring is full: the oldest frame has to be consumed before its pbo can be reused
+	if (capture->pending == CAPTURE_RING_SIZE){
+		consumeOldest(capture);
+	}
+	
+	int slot = capture->head;
+	
+	// With a pack buffer bound, glGetTexImage writes into the buffer (offset 0) and returns immediately
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbo[slot]);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, capture->format, GL_FLOAT, (void*)0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	
+	capture->fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	capture->frame[slot] = capture->frameCount++;
+	capture->head = (capture->head + 1) % CAPTURE_RING_SIZE;
+	capture->pending++;
+}
+
+void flushCapture(Capture* capture){
+	while (capture->pending > 0){
+		consumeOldest(capture);
+	}
+}
+
+void destroyCapture(Capture* capture){
+	flushCapture(capture);
+	glDeleteBuffers(CAPTURE_RING_SIZE, capture->pbo);
+}
+
+void writeFrame(const float* pixels, int width, int height, int channels, long frame, void* userData){
+	FILE* fptr = (FILE*)userData;
+	fwrite(pixels, sizeof(float), (size_t)width * height * channels, fptr);
+}
@@ -0,0 +1,43 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <GL/glew.h>
+
+// Number of frames in flight: frame N is read back while N + 1 and N + 2 are computed
+#define CAPTURE_RING_SIZE 3
+
+// Called with the float pixels of every captured frame, pixels are only valid during the call
+// channels values per pixel: a single layer is stored interleaved (one value per species),
+// several layers are stored one after the other with 4 interleaved values each
+typedef void (*FrameCallback)(const float* pixels, int width, int height, int channels, long frame, void* userData);
+
+typedef struct Capture{
+	unsigned int pbo[CAPTURE_RING_SIZE];	// pixel pack buffers
+	GLsync fence[CAPTURE_RING_SIZE];	// signaled when the copy into the pbo is done
+	long frame[CAPTURE_RING_SIZE];
+	int head, pending;	// next slot to fill, number of slots waiting to be consumed
+	int width, height, layers;
+	GLenum format;	// GL_RED, GL_RG, GL_RGB or GL_RGBA
+	int components;	// values per pixel and layer
+	long frameCount;
+	FrameCallback callback;
+	void* userData;
+}Capture;
+
+// Capture layers of a GL_TEXTURE_2D_ARRAY, format selects the channels that are read back
+void initCapture(Capture* capture, int width, int height, int layers, GLenum format, FrameCallback callback, void* userData);
+
+// Queue an asynchronous readback of texture (GL_TEXTURE_2D_ARRAY), hands finished frames to the callback
+void captureFrame(Capture* capture, unsigned int texture);
+
+// Wait for all frames in flight and hand them to the callback
+void flushCapture(Capture* capture);
+
+void destroyCapture(Capture* capture);
+
+// FrameCallback that appends raw float32 frames to a FILE* (userData)
+void writeFrame(const float* pixels, int width, int height, int channels, long frame, void* userData);
+
+#endif
@@ -0,0 +1,365 @@
+#include "control.h"
+
+#include <stddef.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+https://man7.org/linux/man-pages/man7/unix.7.html
+*/
+
+// A setting that can be read and written: a float at offset in Species or Simulation, clamped to [min, max] (the ranges of the tui)
+typedef struct ControlField{
+	const char* name;
+	size_t offset;
+	float min, max;
+}ControlField;
+
+static const ControlField simulationFields[] = {
+	{"agents", offsetof(Simulation, agents), 5000, 1000000},
+	{"species", offsetof(Simulation, species), 1, MAX_SPECIES},
+	{"fps", offsetof(Simulation, fps), 0, 500},
+	{"fpsoff", offsetof(Simulation, fpsoff), 0, 1},
+	{"avoid", offsetof(Simulation, avoid), 0, 1},
+	{"blurRadius", offsetof(Simulation, blurRadius), 0, 10},	// MAX_RADIUS of the diffuse shader
+	{"trailWeight", offsetof(Simulation, trailWeight), 0, 1},
+	{"diffuseWeight", offsetof(Simulation, diffuseWeight), 0, 1},
+	{"decayRate", offsetof(Simulation, decayRate), 0, 1}
+};
+
+static const ControlField speciesFields[] = {
+	{"spawnMode", offsetof(Species, spawnMode), CENTER, ICIRCLE},	// stored as float like every setting of the tui
+	{"sensorSize", offsetof(Species, sensorSize), 0, 5},
+	{"sensorOffsetDistance", offsetof(Species, sensorOffsetDistance), 0, 100},
+	{"sensorAngle", offsetof(Species, sensorAngle), -200, 200},
+	{"turnSpeed", offsetof(Species, turnSpeed), -1, 1},
+	{"moveSpeed", offsetof(Species, moveSpeed), -2, 2},
+	{"r", offsetof(Species, r), 0, 1},
+	{"g", offsetof(Species, g), 0, 1},
+	{"b", offsetof(Species, b), 0, 1},
+	{"percent", offsetof(Species, percent), 0, 100}
+};
+
+#define SIMULATION_FIELDS (int)(sizeof(simulationFields) / sizeof(ControlField))
+#define SPECIES_FIELDS (int)(sizeof(speciesFields) / sizeof(ControlField))
+
+int initControl(ControlServer* control, const char* path, Species species[MAX_SPECIES], Simulation* simulation){
+	memset(control, 0, sizeof(ControlServer));
+	control->fd = -1;
+	int i;
+	for (i = 0; i < CONTROL_CLIENTS; i++){
+		control->clients[i].fd = -1;
+	}
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path) || strlen(path) >= sizeof(control->path)){
+		printf("Control socket path is too long: %s\n", path);
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+	snprintf(control->path, sizeof(control->path), "%s", path);
+	control->species = species;
+	control->simulation = simulation;
+
+	control->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (control->fd < 0){
+		return -1;
+	}
+	// The socket file of a run that did not clean up
+	unlink(path);
+	if (bind(control->fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(control->fd, CONTROL_CLIENTS) != 0){
+		printf("Failed to listen on %s: %s\n", path, strerror(errno));
+		close(control->fd);
+		control->fd = -1;
+		return -1;
+	}
+	fcntl(control->fd, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+static void closeClient(ControlClient* client){
+	close(client->fd);
+	free(client->output);
+	memset(client, 0, sizeof(ControlClient));
+	client->fd = -1;
+}
+
+void destroyControl(ControlServer* control){
+	int i;
+	for (i = 0; i < CONTROL_CLIENTS; i++){
+		if (control->clients[i].fd >= 0) closeClient(&control->clients[i]);
+	}
+	if (control->fd >= 0){
+		close(control->fd);
+		unlink(control->path);
+	}
+	control->fd = -1;
+}
+
+// Send what the socket takes without waiting, returns -1 if the client is gone
+static int flushClient(ControlClient* client){
+	while (client->outputLength > 0){
+		ssize_t sent = send(client->fd, client->output, client->outputLength, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent < 0){
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		memmove(client->output, client->output + sent, client->outputLength - sent);
+		client->outputLength -= (int)sent;
+	}
+	return 0;
+}
+
+// Queue a line for the client, returns -1 if it does not fit
+static int queueLine(ControlClient* client, const char* line){
+	int length = (int)strlen(line);
+	if (client->output == NULL){
+		client->output = malloc(CONTROL_OUTPUT);
+	}
+	if (client->outputLength + length > CONTROL_OUTPUT) return -1;
+	memcpy(client->output + client->outputLength, line, length);
+	client->outputLength += length;
+	return 0;
+}
+
+// Setting NAME of the species and simulation, NULL if there is none
+static float* findSetting(ControlServer* control, const char* name, const ControlField** field){
+	int i, s, length;
+	if (strncmp(name, "simulation.", 11) == 0){
+		for (i = 0; i < SIMULATION_FIELDS; i++){
+			if (strcmp(name + 11, simulationFields[i].name) == 0){
+				*field = &simulationFields[i];
+				return (float*)((char*)control->simulation + simulationFields[i].offset);
+			}
+		}
+	}else if (sscanf(name, "species.%d.%n", &s, &length) == 1 && length > 0 && s >= 0 && s < MAX_SPECIES){
+		for (i = 0; i < SPECIES_FIELDS; i++){
+			if (strcmp(name + length, speciesFields[i].name) == 0){
+				*field = &speciesFields[i];
+				return (float*)((char*)&control->species[s] + speciesFields[i].offset);
+			}
+		}
+	}
+	return NULL;
+}
+
+// Settings of the species in use as NAME=VALUE pairs
+static void listSettings(ControlServer* control, char* reply, size_t size){
+	size_t used = snprintf(reply, size, "ok");
+	const ControlField* field;
+	char name[64];
+	int i, s;
+	for (i = 0; i < SIMULATION_FIELDS && used < size; i++){
+		snprintf(name, sizeof(name), "simulation.%s", simulationFields[i].name);
+		used += snprintf(reply + used, size - used, " %s=%g", name, *findSetting(control, name, &field));
+	}
+	for (s = 0; s < (int)control->simulation->species && used < size; s++){
+		for (i = 0; i < SPECIES_FIELDS && used < size; i++){
+			snprintf(name, sizeof(name), "species.%d.%s", s, speciesFields[i].name);
+			used += snprintf(reply + used, size - used, " %s=%g", name, *findSetting(control, name, &field));
+		}
+	}
+	if (used < size) snprintf(reply + used, size - used, "\n");
+}
+
+static long writeSnapshot(Physarum* physarum, const char* path){
+	size_t size = physarumSnapshotSize(physarum);
+	void* buffer = malloc(size);
+	size_t written = physarumSnapshot(physarum, buffer, size);
+	FILE* file = fopen(path, "wb");
+	long result = -1;
+	if (file && written > 0 && fwrite(buffer, 1, written, file) == written){
+		result = (long)written;
+	}
+	if (file && fclose(file) != 0) result = -1;
+	free(buffer);
+	return result;
+}
+
+// Restore the snapshot in the file at path, returns its size, -1 if it could not be restored, -2 like physarumRestore
+static long readSnapshot(Physarum* physarum, const char* path){
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return -1;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	void* buffer = size > 0 ? malloc(size) : NULL;
+	long result = -1;
+	if (buffer && fread(buffer, 1, size, file) == (size_t)size){
+		int status = physarumRestore(physarum, buffer, size);
+		result = status == 0 ? size : status;
+	}
+	free(buffer);
+	fclose(file);
+	return result;
+}
+
+// Run one command line and queue its reply, returns -1 if the reply does not fit (the client is closed)
+static int runCommand(ControlServer* control, ControlClient* client, Physarum* physarum, char* line){
+	char reply[8192];
+	char* command = strtok(line, " \t\r");
+	char* argument = strtok(NULL, " \t\r");
+	char* value = strtok(NULL, " \t\r");
+	const ControlField* field = NULL;
+	float* setting;
+
+	if (command == NULL){
+		return 0;
+	}else if (strcmp(command, "get") == 0 && argument){
+		setting = findSetting(control, argument, &field);
+		if (setting) snprintf(reply, sizeof(reply), "ok %g\n", *setting);
+		else snprintf(reply, sizeof(reply), "error unknown setting %s\n", argument);
+	}else if (strcmp(command, "set") == 0 && argument && value){
+		char* end;
+		float number = strtof(value, &end);
+		setting = findSetting(control, argument, &field);
+		if (setting == NULL){
+			snprintf(reply, sizeof(reply), "error unknown setting %s\n", argument);
+		}else if (*end != '\0' || number != number){
+			snprintf(reply, sizeof(reply), "error %s is not a number\n", value);
+		}else{
+			*setting = fminf(field->max, fmaxf(field->min, number));
+			// Agents and species are counts, spawn modes an index
+			if (field->offset == offsetof(Simulation, agents) || field->offset == offsetof(Simulation, species) || field == &speciesFields[0]){
+				*setting = floorf(*setting);
+			}
+			physarumSetSettings(physarum, control->species, control->simulation);
+			control->flags |= CONTROL_CHANGED;
+			snprintf(reply, sizeof(reply), "ok %g\n", *setting);
+		}
+	}else if (strcmp(command, "list") == 0){
+		listSettings(control, reply, sizeof(reply));
+	}else if (strcmp(command, "reset") == 0){
+		physarumSetSettings(physarum, control->species, control->simulation);
+		if (physarumReset(physarum) == 0){
+			snprintf(reply, sizeof(reply), "ok\n");
+		}else{
+			// Nothing left to step on
+			snprintf(reply, sizeof(reply), "error failed to reset\n");
+			control->flags |= CONTROL_QUIT;
+		}
+	}else if (strcmp(command, "snapshot") == 0 && argument){
+		long bytes = writeSnapshot(physarum, argument);
+		if (bytes >= 0) snprintf(reply, sizeof(reply), "ok %ld\n", bytes);
+		else snprintf(reply, sizeof(reply), "error failed to write %s\n", argument);
+	}else if (strcmp(command, "restore") == 0 && argument){
+		long bytes = readSnapshot(physarum, argument);
+		if (bytes >= 0){
+			// The snapshot brings its own settings
+			physarumGetSettings(physarum, control->species, control->simulation);
+			control->flags |= CONTROL_CHANGED;
+			snprintf(reply, sizeof(reply), "ok %ld\n", bytes);
+		}else{
+			snprintf(reply, sizeof(reply), "error failed to restore %s\n", argument);
+			if (bytes == -2){
+				control->flags |= CONTROL_QUIT;
+			}
+		}
+	}else if (strcmp(command, "info") == 0){
+		PhysarumInfo info;
+		physarumGetInfo(physarum, &info);
+		snprintf(reply, sizeof(reply), "ok step=%u agents=%d species=%d agentSize=%d layers=%d governed=%d stepsPerFrame=%d blurStep=%d active=%.3f\n",
+			info.step, info.agentCount, info.speciesCount, info.agentSize, info.trailLayers, info.governed, info.stepsPerFrame, info.blurStep, info.activeFraction);
+	}else if (strcmp(command, "subscribe") == 0){
+		client->subscribed = argument ? atoi(argument) : 1;
+		if (client->subscribed < 1) client->subscribed = 1;
+		client->frames = 0;
+		snprintf(reply, sizeof(reply), "ok\n");
+	}else if (strcmp(command, "unsubscribe") == 0){
+		client->subscribed = 0;
+		snprintf(reply, sizeof(reply), "ok\n");
+	}else if (strcmp(command, "quit") == 0){
+		control->flags |= CONTROL_QUIT;
+		snprintf(reply, sizeof(reply), "ok\n");
+	}else{
+		snprintf(reply, sizeof(reply), "error unknown command %s\n", command);
+	}
+	return queueLine(client, reply);
+}
+
+// Read what arrived and run up to CONTROL_COMMANDS complete lines, returns -1 if the client is gone
+static int serveClient(ControlServer* control, ControlClient* client, Physarum* physarum){
+	int commands = 0;
+	while (commands < CONTROL_COMMANDS){
+		// Complete lines in the buffer first, then read more
+		char* newline = memchr(client->input, '\n', client->inputLength);
+		if (newline){
+			*newline = '\0';
+			if (client->skipping){
+				client->skipping = 0;
+			}else if (runCommand(control, client, physarum, client->input) != 0){
+				return -1;
+			}
+			int consumed = (int)(newline - client->input) + 1;
+			memmove(client->input, client->input + consumed, client->inputLength - consumed);
+			client->inputLength -= consumed;
+			commands++;
+			continue;
+		}
+		if (client->inputLength == CONTROL_LINE){
+			// A line that does not fit is dropped
+			client->inputLength = 0;
+			if (!client->skipping && queueLine(client, "error line too long\n") != 0) return -1;
+			client->skipping = 1;
+		}
+		ssize_t received = recv(client->fd, client->input + client->inputLength, CONTROL_LINE - client->inputLength, MSG_DONTWAIT);
+		if (received == 0) return -1;
+		if (received < 0){
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return -1;
+		}
+		client->inputLength += (int)received;
+	}
+	return flushClient(client);
+}
+
+int pollControl(ControlServer* control, Physarum* physarum){
+	control->flags = 0;
+	if (control->fd < 0) return 0;
+
+	int fd, i;
+	while ((fd = accept(control->fd, NULL, NULL)) >= 0){
+		for (i = 0; i < CONTROL_CLIENTS && control->clients[i].fd >= 0; i++);
+		if (i == CONTROL_CLIENTS){
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		control->clients[i].fd = fd;
+	}
+	for (i = 0; i < CONTROL_CLIENTS; i++){
+		if (control->clients[i].fd >= 0 && serveClient(control, &control->clients[i], physarum) != 0){
+			closeClient(&control->clients[i]);
+		}
+	}
+	return control->flags;
+}
+
+void publishTelemetry(ControlServer* control, Physarum* physarum, int steps, double seconds){
+	PhysarumInfo info;
+	int i, read = 0;
+	char line[256];
+	for (i = 0; i < CONTROL_CLIENTS; i++){
+		ControlClient* client = &control->clients[i];
+		if (client->fd < 0 || client->subscribed == 0 || client->frames++ % client->subscribed != 0) continue;
+		if (!read){
+			physarumGetInfo(physarum, &info);
+			snprintf(line, sizeof(line), "step step=%u steps=%d ms=%.3f agents=%d stepsPerFrame=%d blurStep=%d active=%.3f",
+				info.step, steps, steps > 0 ? seconds * 1000. / steps : 0., info.agentCount, info.stepsPerFrame, info.blurStep, info.activeFraction);
+			read = 1;
+		}
+		char full[300];
+		snprintf(full, sizeof(full), "%s dropped=%ld\n", line, client->dropped);
+		// A slow reader misses lines instead of stalling the simulation
+		if (queueLine(client, full) != 0){
+			client->dropped++;
+		}
+		if (flushClient(client) != 0){
+			closeClient(client);
+		}
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "settings.h"
+#include "physarum.h"
+
+#define CONTROL_CLIENTS 16	// connections at the same time, more are refused
+#define CONTROL_LINE 256	// bytes of a command line
+#define CONTROL_COMMANDS 32	// commands of one client per poll, the rest waits for the next frame
+#define CONTROL_OUTPUT 65536	// bytes of replies a client may leave unread, telemetry is dropped before replies
+
+// Flags of pollControl
+#define CONTROL_CHANGED 1	// a setting was changed, a tui shows the new values
+#define CONTROL_QUIT 2	// a client asked the simulation to stop
+
+/*
+Control and telemetry of a running simulation over a Unix domain socket, one command per line, one reply line per command:
+
+	get NAME                  -> ok VALUE
+	set NAME VALUE            -> ok VALUE (clamped to the range of the setting)
+	list                      -> ok NAME=VALUE ... (every setting of the species in use)
+	reset                     -> ok (spawn again, applies agents, species and spawn modes on the cpu)
+	snapshot PATH             -> ok BYTES (physarumSnapshot into PATH, written by the simulation process)
+	restore PATH              -> ok BYTES
+	info                      -> ok step=... agents=... species=... ...
+	subscribe [N]             -> ok, then "step ..." lines after every N-th frame until unsubscribe
+	unsubscribe               -> ok
+	quit                      -> ok, the simulation stops after the frame
+	errors                    -> error MESSAGE
+
+NAME is simulation.FIELD (agents, species, avoid, blurRadius, trailWeight, diffuseWeight, decayRate, fps, fpsoff)
+or species.S.FIELD (spawnMode, sensorSize, sensorOffsetDistance, sensorAngle, turnSpeed, moveSpeed, r, g, b, percent).
+The owner of the settings polls the socket between frames, so commands take effect at the next step boundary, at most one frame
+after they arrived. Everything is non-blocking: a client that does not read its replies loses its telemetry first, then the connection.
+A telemetry line holds the step, the steps of the frame, ms per step, agents and the governor's state as KEY=VALUE pairs.
+*/
+
+typedef struct ControlClient{
+	int fd;	// -1: free
+	char input[CONTROL_LINE];
+	int inputLength;
+	int skipping;	// rest of a line that did not fit, dropped up to the newline
+	char* output;	// unsent bytes
+	int outputLength;
+	int subscribed;	// telemetry every subscribed-th frame, 0: none
+	long frames;	// frames since subscribe
+	long dropped;	// telemetry lines that did not fit
+}ControlClient;
+
+typedef struct ControlServer{
+	int fd;
+	char path[108];	// of the socket, removed by destroyControl
+	Species* species;	// settings of the owner, changed in place and handed to the simulation
+	Simulation* simulation;
+	ControlClient clients[CONTROL_CLIENTS];
+	int flags;	// CONTROL_* of the current poll
+}ControlServer;
+
+// Listen on the Unix domain socket path (an old socket file is replaced), species and simulation are the settings
+// the owner hands to physarumSetSettings, returns 0 on success
+int initControl(ControlServer* control, const char* path, Species species[MAX_SPECIES], Simulation* simulation);
+
+void destroyControl(ControlServer* control);
+
+// Accept clients and run the commands that arrived, between two frames, returns CONTROL_* flags
+int pollControl(ControlServer* control, Physarum* physarum);
+
+// Send the timing of a frame of steps steps that took seconds to the subscribers
+void publishTelemetry(ControlServer* control, Physarum* physarum, int steps, double seconds);
+
+#endif
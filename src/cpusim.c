@@ -0,0 +1,1219 @@
+#include "cpusim.h"
+#include "numa.h"
+
+// >! Same constants and functions as "computeShader.glsl" / "spawnShader.glsl"
+#define PI 3.141592
+
+unsigned int cpuHash(unsigned int state){
+	state ^= 2747636419u;
+	state *= 2654435769u;
+	state ^= state >> 16;
+	state *= 2654435769u;
+	state ^= state >> 16;
+	state *= 2654435769u;
+	return state;
+}
+
+static float scaleToRange01(unsigned int num){
+	return (float)num / 4294967295.0f;
+}
+
+// !<
+
+static int clampInt(int value, int min, int max){
+	return value < min ? min : (value > max ? max : value);
+}
+
+// the tui edits every setting as float, so the spawn mode is stored as float as well
+static int getSpawnMode(const Species* species){
+	float mode;
+	memcpy(&mode, &species->spawnMode, sizeof(float));
+	return (int)mode;
+}
+
+// Directions of TRIG_TABLE_SIZE angles around the circle, filled by the first initCpuSim
+static float directionTable[TRIG_TABLE_SIZE][2];
+static int directionTableReady = 0;
+
+static void initDirectionTable(void){
+	if (directionTableReady) return;
+	int i;
+	for (i = 0; i < TRIG_TABLE_SIZE; i++){
+		directionTable[i][0] = cosf(i * (2 * PI / TRIG_TABLE_SIZE));
+		directionTable[i][1] = sinf(i * (2 * PI / TRIG_TABLE_SIZE));
+	}
+	directionTableReady = 1;
+}
+
+// Bytes of the trailMaps and agent buffers of a sim
+size_t getCpuSimSize(int x0, int y0, int x1, int y1, int halo, int species, int agentCapacity, int compact){
+	size_t map = (size_t)(x1 - x0 + 2 * halo) * species * (y1 - y0 + 2 * halo) * sizeof(float);
+	// + 64 per buffer for the alignment in the arena
+	return 2 * (map + 64) + (size_t)agentCapacity * ((compact ? sizeof(CompactAgent) : sizeof(Agent)) + 1) + 2 * 64;
+}
+
+int initCpuSim(CpuSim* sim, int width, int height, int x0, int y0, int x1, int y1, int halo, Arena* arena, int agentCapacity, int compact, const Species* speciesSettings, const Simulation* simulationSettings){
+	sim->width = width;
+	sim->height = height;
+	sim->x0 = x0;
+	sim->y0 = y0;
+	sim->x1 = x1;
+	sim->y1 = y1;
+	sim->halo = halo;
+	sim->species = (int)simulationSettings->species;
+	sim->stride = (x1 - x0 + 2 * halo) * sim->species;
+	
+	// Everything comes from the arena, it is cleared by cpuClearSim
+	size_t size = (size_t)sim->stride * (y1 - y0 + 2 * halo);
+	sim->trailMap = arenaAlloc(arena, size * sizeof(float));
+	sim->diffusedMap = arenaAlloc(arena, size * sizeof(float));
+	sim->compact = compact;
+	sim->agentSize = compact ? sizeof(CompactAgent) : sizeof(Agent);
+	sim->agents = arenaAlloc(arena, agentCapacity * sim->agentSize);
+	sim->leaving = arenaAlloc(arena, agentCapacity);
+	
+	sim->agentCount = 0;
+	sim->agentCapacity = agentCapacity;
+	sim->time = 0;
+	sim->speciesSettings = speciesSettings;
+	sim->simulationSettings = simulationSettings;
+	sim->pool = NULL;
+	sim->bins = NULL;
+	sim->binWorkers = 0;
+	sim->bands = 0;
+	sim->fastTrig = 0;
+	sim->wrap = 0;
+	sim->reach = -1;
+	sim->columnOffsets = NULL;
+	sim->rowOffsets = NULL;
+	sim->columnSums = NULL;
+	sim->columnSumsSize = 0;
+	sim->columnSumsWorkers = 0;
+	sim->activeThreshold = 65536;
+	sim->blurStep = 1;
+	sim->multiRate = 0;
+	sim->diffusePeriod = 1;
+	memset(&sim->level, 0, sizeof(CpuLevel));
+	sim->level.maxScale = 1;
+	sim->agentChunk = CPU_AGENT_CHUNK;
+	sim->diffuseBands = 1;
+	sim->pipeline = NULL;
+	initDirectionTable();
+	if (sim->trailMap == NULL || sim->diffusedMap == NULL || sim->agents == NULL || sim->leaving == NULL){
+		printf("Arena of %zu bytes is too small for a simulation of %d agents\n", arena->size, agentCapacity);
+		return -1;
+	}
+	return 0;
+}
+
+void freeCpuSim(CpuSim* sim){
+	// The trailMaps and agents belong to the arena
+	int i;
+	for (i = 0; i < sim->binWorkers * sim->bands; i++){
+		free(sim->bins[i].agents);
+	}
+	free(sim->bins);
+	sim->bins = NULL;
+	sim->binWorkers = 0;
+	free(sim->columnOffsets);
+	free(sim->rowOffsets);
+	sim->columnOffsets = NULL;
+	sim->rowOffsets = NULL;
+	sim->reach = -1;
+	free(sim->columnSums);
+	sim->columnSums = NULL;
+	sim->columnSumsSize = 0;
+	sim->columnSumsWorkers = 0;
+	// The level maps belong to the arena as well
+	CpuLevel* level = &sim->level;
+	free(level->columns);
+	free(level->rows);
+	free(level->sourceX);
+	free(level->sourceY);
+	free(level->fractionX);
+	free(level->fractionY);
+	memset(level, 0, sizeof(CpuLevel));
+	level->maxScale = 1;
+	if (sim->pipeline){
+		for (i = 0; i < 2 * sim->pipeline->binCount; i++){
+			free(sim->pipeline->bins[i].agents);
+		}
+		free(sim->pipeline->bins);
+		freeTaskGraph(&sim->pipeline->graph);
+		free(sim->pipeline);
+		sim->pipeline = NULL;
+	}
+}
+
+size_t getCpuLevelSize(int width, int height, int species){
+	// The finest level is 1 / 2, + 64 per buffer for the alignment in the arena
+	return 2 * ((size_t)((width + 1) / 2) * ((height + 1) / 2) * species * sizeof(float) + 64);
+}
+
+int initCpuLevel(CpuSim* sim, int scale, Arena* arena){
+	CpuLevel* level = &sim->level;
+	level->maxScale = scale < 1 ? 1 : (scale > MAX_DIFFUSE_SCALE ? MAX_DIFFUSE_SCALE : scale);
+	if (level->maxScale == 1) return 0;
+	size_t size = (size_t)((sim->width + 1) / 2) * ((sim->height + 1) / 2) * sim->species;
+	level->map = arenaAlloc(arena, size * sizeof(float));
+	level->blurred = arenaAlloc(arena, size * sizeof(float));
+	level->sourceX = malloc(2 * sim->width * sizeof(int));
+	level->sourceY = malloc(2 * sim->height * sizeof(int));
+	level->fractionX = malloc(sim->width * sizeof(float));
+	level->fractionY = malloc(sim->height * sizeof(float));
+	// Tables are built by the first diffuse
+	level->scale = 0;
+	if (level->map == NULL || level->blurred == NULL){
+		printf("Arena of %zu bytes is too small for the diffuse level\n", arena->size);
+		return -1;
+	}
+	return 0;
+}
+
+int getCpuSimHalo(const Species* speciesSettings, const Simulation* simulationSettings){
+	int halo = (int)simulationSettings->blurRadius;
+	int s;
+	for (s = 0; s < simulationSettings->species; s++){
+		// + 1: sensor centers are truncated to whole pixels
+		int reach = (int)ceilf(fabsf(speciesSettings[s].sensorOffsetDistance)) + (int)speciesSettings[s].sensorSize + 1;
+		if (reach > halo) halo = reach;
+	}
+	return halo;
+}
+
+float* getTrail(CpuSim* sim, float* map, int x, int y){
+	return map + (size_t)(y - sim->y0 + sim->halo) * sim->stride + (size_t)(x - sim->x0 + sim->halo) * sim->species;
+}
+
+void cpuAddAgent(CpuSim* sim, Agent agent){
+	// The capacity is the number of agents of the whole world, no region can get more
+	if (sim->agentCount == sim->agentCapacity){
+		printf("Agent buffer of %d agents is full\n", sim->agentCapacity);
+		return;
+	}
+	sim->leaving[sim->agentCount] = AGENT_STAYS;
+	cpuSetAgent(sim, sim->agentCount++, agent);
+}
+
+// Agents [0, count) of the world that land inside the region, added to it if add
+static int spawnAgents(CpuSim* sim, int count, const int speciesCounts[MAX_SPECIES], unsigned int seed, int add){
+	int inside = 0;
+	float centerX = (float)(sim->width / 2), centerY = (float)(sim->height / 2);
+	float radius = (float)(sim->height / 2);
+	
+	int i, speciesIdx = 0, speciesEnd = speciesCounts[0];
+	for (i = 0; i < count; i++){
+		while (speciesIdx < sim->species - 1 && i >= speciesEnd){
+			speciesEnd += speciesCounts[++speciesIdx];
+		}
+		int spawnMode = getSpawnMode(&sim->speciesSettings[speciesIdx]);
+		
+		// Three independent random numbers per agent
+		unsigned int random = cpuHash(seed ^ cpuHash((unsigned int)i));
+		float random0 = scaleToRange01(random);
+		random = cpuHash(random);
+		float random1 = scaleToRange01(random);
+		random = cpuHash(random);
+		float random2 = scaleToRange01(random);
+		
+		Agent agent;
+		agent.speciesIdx = speciesIdx;
+		
+		switch (spawnMode){
+			case CENTER:
+				agent.x = centerX;
+				agent.y = centerY;
+				agent.angle = random0 * 2 * PI;
+			break;
+			case RING:{
+				float alpha = random0 * 2 * PI;
+				agent.x = centerX + cosf(alpha) * radius;
+				agent.y = centerY + sinf(alpha) * radius;
+				agent.angle = atan2f(centerY - agent.y, centerX - agent.x);	// Angle pointing to the center
+			}
+			break;
+			case CIRCLE:
+			case ICIRCLE:{
+				float alpha = random0 * 2 * PI;
+				float distance = sqrtf(random1) * radius;
+				agent.x = floorf(centerX + cosf(alpha) * distance);
+				agent.y = floorf(centerY + sinf(alpha) * distance);
+				agent.angle = (spawnMode == ICIRCLE) 
+					? atan2f(centerY - agent.y, centerX - agent.x)	// Angle pointing to the center
+					: random2 * 2 * PI;	// Random angle
+			}
+			break;
+			default:	// RANDOM
+				// A hash near the maximum rounds to 1.0, which would be one pixel outside of the world
+				agent.x = fminf(floorf(random0 * sim->width), (float)(sim->width - 1));
+				agent.y = fminf(floorf(random1 * sim->height), (float)(sim->height - 1));
+				agent.angle = random2 * 2 * PI;
+			break;
+		}
+		
+		// Agents on the border of the world belong to the last region
+		int x = clampInt((int)agent.x, 0, sim->width - 1), y = clampInt((int)agent.y, 0, sim->height - 1);
+		if (x >= sim->x0 && x < sim->x1 && y >= sim->y0 && y < sim->y1){
+			if (add) cpuAddAgent(sim, agent);
+			inside++;
+		}
+	}
+	return inside;
+}
+
+void cpuSpawnAgents(CpuSim* sim, int count, const int speciesCounts[MAX_SPECIES], unsigned int seed){
+	spawnAgents(sim, count, speciesCounts, seed, 1);
+}
+
+int cpuCountSpawnedAgents(CpuSim* sim, int count, const int speciesCounts[MAX_SPECIES], unsigned int seed){
+	return spawnAgents(sim, count, speciesCounts, seed, 0);
+}
+
+// Direction of angle: nearest table entry (fastTrig) or libm
+static void getDirection(const CpuSim* sim, float angle, float* dirX, float* dirY){
+	if (sim->fastTrig){
+		// & wraps negative angles as well (two's complement)
+		int i = (int)floorf(angle * (TRIG_TABLE_SIZE / (2 * PI)) + 0.5f) & (TRIG_TABLE_SIZE - 1);
+		*dirX = directionTable[i][0];
+		*dirY = directionTable[i][1];
+	}else{
+		*dirX = cosf(angle);
+		*dirY = sinf(angle);
+	}
+}
+
+// Settings that only change with the species settings, once per update instead of once per agent
+static void prepareSpecies(CpuSim* sim){
+	int s;
+	for (s = 0; s < sim->species; s++){
+		const Species* config = &sim->speciesSettings[s];
+		float sensorAngleRad = config->sensorAngle * (PI / 180.0f);
+		sim->sensorRotation[s][0] = cosf(sensorAngleRad);
+		sim->sensorRotation[s][1] = sinf(sensorAngleRad);
+		sim->sensorAngleRad[s] = sensorAngleRad;
+		sim->turnRadians[s] = config->turnSpeed * 2 * PI;
+		sim->stepPeriods[s] = 1;
+	}
+	if (sim->multiRate){
+		getStepPeriods(sim->speciesSettings, sim->species, sim->stepPeriods);
+	}
+}
+
+void getStepPeriods(const Species* speciesSettings, int species, int periods[MAX_SPECIES]){
+	float fastest = 0.0f;
+	int s;
+	for (s = 0; s < species; s++){
+		// Species without agents do not slow down the others
+		if (speciesSettings[s].percent > 0.0f){
+			fastest = fmaxf(fastest, fabsf(speciesSettings[s].moveSpeed));
+		}
+	}
+	for (s = 0; s < species; s++){
+		// A period step is never longer than a step of the fastest species (the reach of sensors and halos)
+		float speed = fabsf(speciesSettings[s].moveSpeed);
+		float ratio = speed > 0.0f ? floorf(fastest / speed + 1e-4f) : MAX_STEP_PERIOD;
+		periods[s] = ratio < 1.0f ? 1 : (ratio > MAX_STEP_PERIOD ? MAX_STEP_PERIOD : (int)ratio);
+	}
+}
+
+int isDiffuseStep(unsigned int time, int diffusePeriod){
+	return diffusePeriod <= 1 || (time + 1) % (unsigned int)diffusePeriod == 0;
+}
+
+int getDiffuseLevel(int blurRadius, int diffuseScale, int* levelRadius){
+	// Variance per axis of the full resolution box blur of 2 * radius + 1 pixels
+	float target = blurRadius * (blurRadius + 1) / 3.0f;
+	float resampling = 0.0f;
+	int scale;
+	for (scale = diffuseScale < MAX_DIFFUSE_SCALE ? diffuseScale : MAX_DIFFUSE_SCALE; scale > 1; scale--){
+		// Averaging scale pixels and the bilinear upsampling blur by themselves
+		resampling = (scale * scale - 1) / 12.0f + scale * scale / 6.0f;
+		if (resampling <= target) break;
+	}
+	*levelRadius = blurRadius;
+	if (scale <= 1) return 1;
+	
+	// A box of 2 * r + 1 level pixels adds scale^2 * r * (r + 1) / 3, take the r that comes closest to the target
+	float rest = fmaxf(0.0f, target - resampling) * 3.0f / (scale * scale);
+	int r = (int)floorf(sqrtf(rest + 0.25f) - 0.5f);
+	if (r < 0) r = 0;
+	if (fabsf((r + 1) * (r + 2) - rest) < fabsf(r * (r + 1) - rest)) r++;
+	*levelRadius = r;
+	return scale;
+}
+
+// Coordinate v of an axis of size size in the trailMap of a region [v0, v1) of that axis
+static int mapCoordinate(const CpuSim* sim, int v, int v0, int v1, int size){
+	if (sim->wrap && v0 == 0 && v1 == size){
+		// The region is the whole axis, it wraps onto itself
+		return (v % size + size) % size;
+	}
+	// Periodic neighbors fill the halo / the halo of the neighbors or the edge of the world
+	return sim->wrap ? v : clampInt(v, 0, size - 1);
+}
+
+// Offset tables for samples up to getCpuSimHalo pixels around the region, the settings can change between updates
+// The wrap around / clamping is looked up, the sensor and blur loops have no edge cases
+static void prepareAddressing(CpuSim* sim){
+	int reach = getCpuSimHalo(sim->speciesSettings, sim->simulationSettings);
+	if (reach <= sim->reach) return;
+	
+	int columns = sim->x1 - sim->x0 + 2 * reach, rows = sim->y1 - sim->y0 + 2 * reach;
+	sim->columnOffsets = realloc(sim->columnOffsets, columns * sizeof(int));
+	sim->rowOffsets = realloc(sim->rowOffsets, rows * sizeof(size_t));
+	int i;
+	for (i = 0; i < columns; i++){
+		int x = mapCoordinate(sim, sim->x0 - reach + i, sim->x0, sim->x1, sim->width);
+		sim->columnOffsets[i] = (x - sim->x0 + sim->halo) * sim->species;
+	}
+	for (i = 0; i < rows; i++){
+		int y = mapCoordinate(sim, sim->y0 - reach + i, sim->y0, sim->y1, sim->height);
+		sim->rowOffsets[i] = (size_t)(y - sim->y0 + sim->halo) * sim->stride;
+	}
+	sim->reach = reach;
+}
+
+// Scratch of the separable blur for columns columns on every worker, grows before a diffuse so the bands allocate nothing
+static void prepareColumnSums(CpuSim* sim, int columns){
+	int workers = sim->pool ? sim->pool->threadCount : 1;
+	size_t size = (size_t)columns * sim->species;
+	if (size <= sim->columnSumsSize && workers <= sim->columnSumsWorkers) return;
+	if (size < sim->columnSumsSize) size = sim->columnSumsSize;
+	if (workers < sim->columnSumsWorkers) workers = sim->columnSumsWorkers;
+	free(sim->columnSums);
+	sim->columnSums = malloc(workers * size * sizeof(float));
+	sim->columnSumsSize = size;
+	sim->columnSumsWorkers = workers;
+}
+
+// Pixel (x, y) in world coordinates, at most reach pixels outside of the region
+static inline const float* getSample(const CpuSim* sim, const float* map, int x, int y){
+	return map + sim->rowOffsets[y - sim->y0 + sim->reach] + sim->columnOffsets[x - sim->x0 + sim->reach];
+}
+
+// Sensor in direction (dirX, dirY) from the agent in trailMap
+static float sense(CpuSim* sim, const float* trailMap, const Agent* agent, float dirX, float dirY){
+	const Species* config = &sim->speciesSettings[agent->speciesIdx];
+	
+	int sensorCenterX = (int)(agent->x + dirX * config->sensorOffsetDistance);
+	int sensorCenterY = (int)(agent->y + dirY * config->sensorOffsetDistance);
+	
+	float sum = 0.0f;
+	int sensorSize = (int)config->sensorSize;
+	int avoid = sim->simulationSettings->avoid == 1;
+	
+	int offsetX, offsetY, s;
+	for (offsetX = -sensorSize; offsetX <= sensorSize; offsetX++){
+		for (offsetY = -sensorSize; offsetY <= sensorSize; offsetY++){
+			const float* trail = getSample(sim, trailMap, sensorCenterX + offsetX, sensorCenterY + offsetY);
+			
+			float total = 0.0f;
+			for (s = 0; s < sim->species; s++){
+				total += trail[s];
+			}
+			// Follow the own species (+1) and avoid all others (-1), or follow all trails
+			sum += avoid ? 2.0f * trail[agent->speciesIdx] - total : total;
+		}
+	}
+	return sum;
+}
+
+// The trail of all steps since the last update of the species
+static void depositTrail(CpuSim* sim, float* trailMap, const Agent* agent){
+	float* trail = getTrail(sim, trailMap, (int)agent->x, (int)agent->y) + agent->speciesIdx;
+	*trail = fminf(1.0f, *trail + sim->simulationSettings->trailWeight * sim->stepPeriods[agent->speciesIdx]);
+}
+
+void cpuDeposit(CpuSim* sim, const Agent* agent){
+	depositTrail(sim, sim->trailMap, agent);
+}
+
+/*----------------------------------*/
+
+// >! Same layout as COMPACT_AGENTS in "computeShader.glsl"
+#define FIXED_SCALE 4194304.0f	// 2^22 fixed point steps across the world
+#define FIXED_MAX 4194303u
+
+static CompactAgent encodeAgent(const CpuSim* sim, Agent agent){
+	// Round to the nearest step, truncating would drift towards 0 a little every step
+	unsigned int x = (unsigned int)fminf(agent.x * (FIXED_SCALE / sim->width) + 0.5f, FIXED_MAX);
+	unsigned int y = (unsigned int)fminf(agent.y * (FIXED_SCALE / sim->height) + 0.5f, FIXED_MAX);
+	float turns = agent.angle / (2 * PI);
+	unsigned int angle = (unsigned int)((turns - floorf(turns)) * 65536.0f + 0.5f) & 65535u;
+	return (CompactAgent){
+		.xAngle = (x << 10) | (angle >> 6),
+		.yAngleSpecies = (y << 10) | ((angle & 63u) << 4) | (unsigned int)agent.speciesIdx
+	};
+}
+
+static Agent decodeAgent(const CpuSim* sim, CompactAgent data){
+	return (Agent){
+		.x = (float)(data.xAngle >> 10) * (sim->width / FIXED_SCALE),
+		.y = (float)(data.yAngleSpecies >> 10) * (sim->height / FIXED_SCALE),
+		.angle = (float)(((data.xAngle & 1023u) << 6) | ((data.yAngleSpecies >> 4) & 63u)) * (2 * PI / 65536.0f),
+		.speciesIdx = (int)(data.yAngleSpecies & 15u)
+	};
+}
+
+// !<
+
+Agent cpuGetAgent(const CpuSim* sim, int i){
+	return sim->compact ? decodeAgent(sim, ((const CompactAgent*)sim->agents)[i]) : ((const Agent*)sim->agents)[i];
+}
+
+void cpuSetAgent(CpuSim* sim, int i, Agent agent){
+	if (sim->compact){
+		((CompactAgent*)sim->agents)[i] = encodeAgent(sim, agent);
+	}else{
+		((Agent*)sim->agents)[i] = agent;
+	}
+}
+
+// Sense trailMap, steer and move agent id in step time, returns 1 if it leaves a trail inside the region
+static int moveAgent(CpuSim* sim, const float* trailMap, unsigned int time, int id, Agent* agent){
+	const Species* config = &sim->speciesSettings[agent->speciesIdx];
+	
+	// Multi-rate: a slow species waits and then turns and moves as far as in period steps
+	int period = sim->stepPeriods[agent->speciesIdx];
+	if ((time + agent->speciesIdx) % period != 0){
+		sim->leaving[id] = AGENT_STAYS;
+		return 0;
+	}
+	
+	// Forward is also the direction of the move (the shader moves in the direction before steering)
+	float forwardX, forwardY, leftX, leftY, rightX, rightY;
+	getDirection(sim, agent->angle, &forwardX, &forwardY);
+	if (sim->fastTrig){
+		// Rotate the forward direction by +- the sensor angle instead of two more sincos
+		float c = sim->sensorRotation[agent->speciesIdx][0], s = sim->sensorRotation[agent->speciesIdx][1];
+		leftX = forwardX * c - forwardY * s;
+		leftY = forwardX * s + forwardY * c;
+		rightX = forwardX * c + forwardY * s;
+		rightY = forwardY * c - forwardX * s;
+	}else{
+		getDirection(sim, agent->angle + sim->sensorAngleRad[agent->speciesIdx], &leftX, &leftY);
+		getDirection(sim, agent->angle - sim->sensorAngleRad[agent->speciesIdx], &rightX, &rightY);
+	}
+	float weightForward = sense(sim, trailMap, agent, forwardX, forwardY);
+	float weightLeft = sense(sim, trailMap, agent, leftX, leftY);
+	float weightRight = sense(sim, trailMap, agent, rightX, rightY);
+	
+	unsigned int random = cpuHash((unsigned int)((int)agent->y * sim->width + (int)agent->x) + cpuHash((unsigned int)id + time * 100000u));
+	float randomSteerStrength = scaleToRange01(random);
+	float turnSpeed = sim->turnRadians[agent->speciesIdx] * period;
+	
+	if (weightForward > weightLeft && weightForward > weightRight){
+		// Do nothing
+	}else if (weightForward < weightLeft && weightForward < weightRight){
+		agent->angle += (randomSteerStrength - 0.5f) * 2.0f * turnSpeed;
+	}else if (weightRight > weightLeft){
+		agent->angle -= randomSteerStrength * turnSpeed;
+	}else if (weightLeft > weightRight){
+		agent->angle += randomSteerStrength * turnSpeed;
+	}
+	
+	float moveSpeed = config->moveSpeed * period;
+	float newX = agent->x + forwardX * moveSpeed;
+	float newY = agent->y + forwardY * moveSpeed;
+	int bounced = 0;
+	
+	if (sim->wrap){
+		// Toroidal world: no bounce, every agent leaves a trail
+		newX -= floorf(newX / sim->width) * sim->width;
+		newY -= floorf(newY / sim->height) * sim->height;
+		// A tiny negative position + width rounds to width
+		newX -= newX >= sim->width ? sim->width : 0.0f;
+		newY -= newY >= sim->height ? sim->height : 0.0f;
+	}else if (newX < 0.0f || newX >= sim->width || newY < 0.0f || newY >= sim->height){
+		random = cpuHash(random);
+		newX = fminf(sim->width - 1.0f, fmaxf(0.0f, newX));
+		newY = fminf(sim->height - 1.0f, fmaxf(0.0f, newY));
+		agent->angle = scaleToRange01(random) * 2 * PI;
+		bounced = 1;
+	}
+	
+	agent->x = newX;
+	agent->y = newY;
+	
+	// Continue with the position as it is stored (quantized with compact agents) so the deposit lands where the agent is
+	cpuSetAgent(sim, id, *agent);
+	*agent = cpuGetAgent(sim, id);
+	
+	int x = (int)agent->x, y = (int)agent->y;
+	if (x < sim->x0 || x >= sim->x1 || y < sim->y0 || y >= sim->y1){
+		// The region the agent moves into leaves its trail
+		sim->leaving[id] = bounced ? AGENT_BOUNCED : AGENT_LEAVES;
+		return 0;
+	}
+	sim->leaving[id] = AGENT_STAYS;
+	return !bounced;
+}
+
+// Agents the governor switched off stay where they are and leave no trail
+static int isActive(CpuSim* sim, int id){
+	if ((cpuHash((unsigned int)id / ACTIVE_BLOCK) >> 16) < sim->activeThreshold) return 1;
+	sim->leaving[id] = AGENT_STAYS;
+	return 0;
+}
+
+void cpuUpdateAgents(CpuSim* sim, int first, int last){
+	prepareSpecies(sim);
+	prepareAddressing(sim);
+	int id;
+	for (id = first; id < last; id++){
+		if (!isActive(sim, id)) continue;
+		Agent agent = cpuGetAgent(sim, id);
+		if (moveAgent(sim, sim->trailMap, sim->time, id, &agent)){
+			cpuDeposit(sim, &agent);
+		}
+	}
+}
+
+/*----------------------------------*/
+
+static void addToBin(DepositBin* bin, int id){
+	if (bin->count == bin->capacity){
+		bin->capacity = bin->capacity ? bin->capacity * 2 : 64;
+		bin->agents = realloc(bin->agents, bin->capacity * sizeof(int));
+	}
+	bin->agents[bin->count++] = id;
+}
+
+// Move agents [begin, end) and sort the ones that leave a trail into the bins of the worker
+static void updateTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	DepositBin* bins = sim->bins + thread * sim->bands;
+	int id;
+	for (id = begin; id < end; id++){
+		if (!isActive(sim, id)) continue;
+		Agent agent = cpuGetAgent(sim, id);
+		if (!moveAgent(sim, sim->trailMap, sim->time, id, &agent)) continue;
+		addToBin(&bins[((int)agent.y - sim->y0) / CPU_BAND_ROWS], id);
+	}
+}
+
+// Leave the trails of bands [begin, end), only one worker writes to a band
+static void depositTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	int band, worker, i;
+	for (band = begin; band < end; band++){
+		for (worker = 0; worker < sim->binWorkers; worker++){
+			DepositBin* bin = &sim->bins[worker * sim->bands + band];
+			for (i = 0; i < bin->count; i++){
+				Agent agent = cpuGetAgent(sim, bin->agents[i]);
+				cpuDeposit(sim, &agent);
+			}
+			bin->count = 0;
+		}
+	}
+}
+
+static void diffuseRows(CpuSim* sim, int worker, const float* trailMap, float* diffusedMap, int yStart, int yEnd);
+
+static void diffuseTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	int yEnd = sim->y0 + end * CPU_BAND_ROWS;
+	diffuseRows(sim, thread, sim->trailMap, sim->diffusedMap, sim->y0 + begin * CPU_BAND_ROWS, yEnd < sim->y1 ? yEnd : sim->y1);
+}
+
+void cpuUpdate(CpuSim* sim){
+	if (sim->pool == NULL){
+		cpuUpdateAgents(sim, 0, sim->agentCount);
+		return;
+	}
+	
+	// One set of bins per worker, the pool may have been resized
+	int bands = (sim->y1 - sim->y0 + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS;
+	if (sim->binWorkers != sim->pool->threadCount || sim->bands != bands){
+		int i;
+		for (i = 0; i < sim->binWorkers * sim->bands; i++){
+			free(sim->bins[i].agents);
+		}
+		sim->binWorkers = sim->pool->threadCount;
+		sim->bands = bands;
+		sim->bins = realloc(sim->bins, sim->binWorkers * sim->bands * sizeof(DepositBin));
+		memset(sim->bins, 0, sim->binWorkers * sim->bands * sizeof(DepositBin));
+	}
+	
+	// Phase 1: agents only read the trailMap
+	prepareSpecies(sim);
+	prepareAddressing(sim);
+	parallelFor(sim->pool, sim->agentCount, sim->agentChunk, updateTask, sim);
+	// Phase 2: deposit merge, dense bands (CENTER / ICIRCLE spawns) are balanced by stealing
+	parallelFor(sim->pool, sim->bands, 1, depositTask, sim);
+}
+
+// Level (scale, radius) of the next diffuse and its tables, returns 0 if it runs at full resolution
+static int prepareLevel(CpuSim* sim){
+	CpuLevel* level = &sim->level;
+	// Only a sim of the whole world has all pixels of the level (no domains)
+	if (level->maxScale <= 1 || sim->halo > 0 || sim->x1 - sim->x0 != sim->width || sim->y1 - sim->y0 != sim->height) return 0;
+	int radius, scale = getDiffuseLevel((int)sim->simulationSettings->blurRadius, level->maxScale, &radius);
+	if (scale <= 1) return 0;
+	if (scale == level->scale && radius == level->radius) return 1;
+	
+	level->scale = scale;
+	level->radius = radius;
+	level->width = (sim->width + scale - 1) / scale;
+	level->height = (sim->height + scale - 1) / scale;
+	level->columns = realloc(level->columns, (level->width + 2 * radius) * sizeof(int));
+	level->rows = realloc(level->rows, (level->height + 2 * radius) * sizeof(int));
+	int i, x, y;
+	for (i = 0; i < level->width + 2 * radius; i++){
+		x = i - radius;
+		x = sim->wrap ? (x % level->width + level->width) % level->width : clampInt(x, 0, level->width - 1);
+		level->columns[i] = x * sim->species;
+	}
+	for (i = 0; i < level->height + 2 * radius; i++){
+		y = i - radius;
+		level->rows[i] = sim->wrap ? (y % level->height + level->height) % level->height : clampInt(y, 0, level->height - 1);
+	}
+	
+	// Level pixel i covers the trailMap pixels [i * scale, (i + 1) * scale), its center is at (i + 0.5) * scale
+	for (x = 0; x < sim->width; x++){
+		float position = (x + 0.5f) / scale - 0.5f;
+		int left = (int)floorf(position);
+		level->fractionX[x] = position - left;
+		int right = left + 1;
+		if (sim->wrap){
+			left = (left + level->width) % level->width;
+			right = right % level->width;
+		}else{
+			left = clampInt(left, 0, level->width - 1);
+			right = clampInt(right, 0, level->width - 1);
+		}
+		level->sourceX[2 * x] = left * sim->species;
+		level->sourceX[2 * x + 1] = right * sim->species;
+	}
+	for (y = 0; y < sim->height; y++){
+		float position = (y + 0.5f) / scale - 0.5f;
+		int top = (int)floorf(position);
+		level->fractionY[y] = position - top;
+		int bottom = top + 1;
+		if (sim->wrap){
+			top = (top + level->height) % level->height;
+			bottom = bottom % level->height;
+		}else{
+			top = clampInt(top, 0, level->height - 1);
+			bottom = clampInt(bottom, 0, level->height - 1);
+		}
+		level->sourceY[2 * y] = top;
+		level->sourceY[2 * y + 1] = bottom;
+	}
+	return 1;
+}
+
+// Average the scale x scale blocks of the trailMap (cut off at the edge of the world) into level rows [yStart, yEnd)
+static void downsampleRows(CpuSim* sim, int yStart, int yEnd){
+	CpuLevel* level = &sim->level;
+	int species = sim->species, scale = level->scale;
+	int x, y, i, j, s;
+	for (y = yStart; y < yEnd; y++){
+		int rowEnd = (y + 1) * scale < sim->height ? (y + 1) * scale : sim->height;
+		for (x = 0; x < level->width; x++){
+			int columnEnd = (x + 1) * scale < sim->width ? (x + 1) * scale : sim->width;
+			float* sum = level->map + ((size_t)y * level->width + x) * species;
+			for (s = 0; s < species; s++) sum[s] = 0.0f;
+			for (j = y * scale; j < rowEnd; j++){
+				const float* trail = getTrail(sim, sim->trailMap, x * scale, j);
+				for (i = x * scale; i < columnEnd; i++, trail += species){
+					for (s = 0; s < species; s++) sum[s] += trail[s];
+				}
+			}
+			float norm = 1.0f / ((rowEnd - y * scale) * (columnEnd - x * scale));
+			for (s = 0; s < species; s++) sum[s] *= norm;
+		}
+	}
+}
+
+// Box blur of level rows [yStart, yEnd) into level->blurred, no blend and decay (done at full resolution)
+static void blurLevelRows(CpuSim* sim, int worker, int yStart, int yEnd){
+	CpuLevel* level = &sim->level;
+	int radius = level->radius, species = sim->species;
+	size_t stride = (size_t)level->width * species;
+	// Every blurStep-th tap like diffuseRows
+	int step = radius >= 2 ? sim->blurStep : 1;
+	int taps = 2 * radius / step + 1;
+	float norm = 1.0f / (taps * taps);
+	float* columnSums = sim->columnSums + worker * sim->columnSumsSize;
+	
+	int x, y, offset, s;
+	for (y = yStart; y < yEnd; y++){
+		for (x = 0; x < level->width + 2 * radius; x++){
+			float* sum = columnSums + x * species;
+			for (s = 0; s < species; s++) sum[s] = 0.0f;
+			for (offset = -radius; offset <= radius; offset += step){
+				const float* trail = level->map + level->rows[y + offset + radius] * stride + level->columns[x];
+				for (s = 0; s < species; s++) sum[s] += trail[s];
+			}
+		}
+		float* blurred = level->blurred + y * stride;
+		for (x = 0; x < level->width; x++){
+			for (s = 0; s < species; s++){
+				float sum = 0.0f;
+				for (offset = 0; offset <= 2 * radius; offset += step){
+					sum += columnSums[(x + offset) * species + s];
+				}
+				blurred[x * species + s] = sum * norm;
+			}
+		}
+	}
+}
+
+// Upsample the blurred level bilinearly into rows [yStart, yEnd), blend it with the trailMap and decay into diffusedMap
+static void upsampleRows(CpuSim* sim, int yStart, int yEnd){
+	CpuLevel* level = &sim->level;
+	const Simulation* settings = sim->simulationSettings;
+	int species = sim->species;
+	size_t stride = (size_t)level->width * species;
+	float diffuseWeight = settings->diffuseWeight, decayRate = settings->decayRate;
+	if (sim->diffusePeriod > 1){
+		// Compounded like diffuseRows
+		diffuseWeight = 1.0f - powf(1.0f - diffuseWeight, (float)sim->diffusePeriod);
+		decayRate *= sim->diffusePeriod;
+	}
+	
+	int x, y, s;
+	for (y = yStart; y < yEnd; y++){
+		const float* top = level->blurred + level->sourceY[2 * y] * stride;
+		const float* bottom = level->blurred + level->sourceY[2 * y + 1] * stride;
+		float fy = level->fractionY[y];
+		const float* original = getTrail(sim, sim->trailMap, 0, y);
+		float* diffused = getTrail(sim, sim->diffusedMap, 0, y);
+		for (x = 0; x < sim->width; x++){
+			int left = level->sourceX[2 * x], right = level->sourceX[2 * x + 1];
+			float fx = level->fractionX[x];
+			for (s = 0; s < species; s++){
+				float upper = top[left + s] + (top[right + s] - top[left + s]) * fx;
+				float lower = bottom[left + s] + (bottom[right + s] - bottom[left + s]) * fx;
+				float blurred = upper + (lower - upper) * fy;
+				blurred = original[x * species + s] * (1.0f - diffuseWeight) + blurred * diffuseWeight;
+				diffused[x * species + s] = fmaxf(0.0f, blurred - decayRate);
+			}
+		}
+	}
+}
+
+// Tasks of the three passes of a level diffuse, in bands of CPU_BAND_ROWS rows of the level / the trailMap
+static void downsampleTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	int yEnd = end * CPU_BAND_ROWS;
+	downsampleRows(sim, begin * CPU_BAND_ROWS, yEnd < sim->level.height ? yEnd : sim->level.height);
+}
+
+static void blurLevelTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	int yEnd = end * CPU_BAND_ROWS;
+	blurLevelRows(sim, thread, begin * CPU_BAND_ROWS, yEnd < sim->level.height ? yEnd : sim->level.height);
+}
+
+static void upsampleTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	int yEnd = end * CPU_BAND_ROWS;
+	upsampleRows(sim, begin * CPU_BAND_ROWS, yEnd < sim->height ? yEnd : sim->height);
+}
+
+// Diffuse and decay the whole world through the level of prepareLevel, every pass waits for the previous one
+static void diffuseLevel(CpuSim* sim){
+	CpuLevel* level = &sim->level;
+	if (sim->pool == NULL){
+		downsampleRows(sim, 0, level->height);
+		blurLevelRows(sim, 0, 0, level->height);
+		upsampleRows(sim, 0, sim->height);
+		return;
+	}
+	int levelBands = (level->height + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS;
+	parallelFor(sim->pool, levelBands, sim->diffuseBands, downsampleTask, sim);
+	parallelFor(sim->pool, levelBands, sim->diffuseBands, blurLevelTask, sim);
+	parallelFor(sim->pool, (sim->height + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS, sim->diffuseBands, upsampleTask, sim);
+}
+
+void cpuDiffuseRegion(CpuSim* sim){
+	if (!isDiffuseStep(sim->time, sim->diffusePeriod)) return;
+	if (prepareLevel(sim)){
+		prepareColumnSums(sim, sim->level.width + 2 * sim->level.radius);
+		diffuseLevel(sim);
+		return;
+	}
+	prepareAddressing(sim);
+	prepareColumnSums(sim, sim->x1 - sim->x0 + 2 * (int)sim->simulationSettings->blurRadius);
+	if (sim->pool == NULL){
+		cpuDiffuse(sim, sim->y0, sim->y1);
+		return;
+	}
+	parallelFor(sim->pool, (sim->y1 - sim->y0 + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS, sim->diffuseBands, diffuseTask, sim);
+}
+
+// Diffuse and decay rows [yStart, yEnd) of trailMap into diffusedMap with the scratch of worker
+static void diffuseRows(CpuSim* sim, int worker, const float* trailMap, float* diffusedMap, int yStart, int yEnd){
+	const Simulation* settings = sim->simulationSettings;
+	int radius = (int)settings->blurRadius;
+	int species = sim->species;
+	int width = sim->x1 - sim->x0;
+	float diffuseWeight = settings->diffuseWeight, decayRate = settings->decayRate;
+	if (sim->diffusePeriod > 1){
+		// One blur and decay for diffusePeriod steps: the part of the original that is kept and the decay compound
+		diffuseWeight = 1.0f - powf(1.0f - diffuseWeight, (float)sim->diffusePeriod);
+		decayRate *= sim->diffusePeriod;
+	}
+	// Every blurStep-th tap, the taps stay symmetric around the pixel
+	int step = radius >= 2 ? sim->blurStep : 1;
+	int taps = 2 * radius / step + 1;
+	float norm = 1.0f / (taps * taps);
+	
+	// Vertical sums of the columns [x0 - radius, x1 + radius), the box blur is separable
+	float* columnSums = sim->columnSums + worker * sim->columnSumsSize;
+	
+	int x, y, offset, s;
+	for (y = yStart; y < yEnd; y++){
+		for (x = 0; x < width + 2 * radius; x++){
+			// Samples outside of the world are wrapped or clamped to the edge by the offset tables
+			int sampleX = sim->x0 + x - radius;
+			float* sum = columnSums + x * species;
+			for (s = 0; s < species; s++) sum[s] = 0.0f;
+			
+			for (offset = -radius; offset <= radius; offset += step){
+				const float* trail = getSample(sim, trailMap, sampleX, y + offset);
+				for (s = 0; s < species; s++) sum[s] += trail[s];
+			}
+		}
+		
+		for (x = 0; x < width; x++){
+			const float* original = getSample(sim, trailMap, sim->x0 + x, y);
+			float* diffused = diffusedMap + (original - trailMap);
+			for (s = 0; s < species; s++){
+				float sum = 0.0f;
+				for (offset = 0; offset <= 2 * radius; offset += step){
+					sum += columnSums[(x + offset) * species + s];
+				}
+				float blurred = original[s] * (1.0f - diffuseWeight) + sum * norm * diffuseWeight;
+				diffused[s] = fmaxf(0.0f, blurred - decayRate);
+			}
+		}
+	}
+}
+
+void cpuDiffuse(CpuSim* sim, int yStart, int yEnd){
+	prepareColumnSums(sim, sim->x1 - sim->x0 + 2 * (int)sim->simulationSettings->blurRadius);
+	diffuseRows(sim, 0, sim->trailMap, sim->diffusedMap, yStart, yEnd);
+}
+
+void cpuSwapTrailMaps(CpuSim* sim){
+	if (isDiffuseStep(sim->time, sim->diffusePeriod)){
+		float* temp = sim->trailMap;
+		sim->trailMap = sim->diffusedMap;
+		sim->diffusedMap = temp;
+	}
+	sim->time++;
+}
+
+/*----------------------------------*/
+
+// Band of rows an agent of the whole world is in (spawns on a ring may sit on the far edge)
+static int getAgentBand(const CpuSim* sim, const Agent* agent){
+	return clampInt((int)agent->y, 0, sim->height - 1) / CPU_BAND_ROWS;
+}
+
+// Band delta bands away from band, -1 if that is outside of the world
+static int getNeighborBand(const CpuSim* sim, int band, int delta){
+	int bands = sim->pipeline->bands;
+	band += delta;
+	if (sim->wrap) return (band + bands) % bands;
+	return band >= 0 && band < bands ? band : -1;
+}
+
+// Delta from band from to band to, in [-reach, reach]
+static int getBandDelta(const CpuSim* sim, int from, int to){
+	int delta = to - from;
+	if (delta > sim->pipeline->reach) delta -= sim->pipeline->bands;
+	if (delta < -sim->pipeline->reach) delta += sim->pipeline->bands;
+	return delta;
+}
+
+// Bands around a band that its agents sense or move to, or that its diffuse blurs
+static int getPipelineReach(const CpuSim* sim){
+	int rows = getCpuSimHalo(sim->speciesSettings, sim->simulationSettings);
+	int s;
+	for (s = 0; s < sim->species; s++){
+		// + 1: the row of a position is truncated
+		int move = (int)ceilf(fabsf(sim->speciesSettings[s].moveSpeed)) + 1;
+		if (move > rows) rows = move;
+	}
+	// A partial last band brings the bands on both sides of the wrap seam closer together
+	return (rows + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS + (sim->wrap && sim->height % CPU_BAND_ROWS ? 1 : 0);
+}
+
+// Bins of the agent task of band and worker in step (-1: the agents sorted into bands before the first step), indexed by delta
+static DepositBin* getPipelineBins(const CpuPipeline* pipeline, int step, int band, int worker){
+	return pipeline->bins + (size_t)(step & 1) * pipeline->binCount + (size_t)(band * pipeline->workers + worker) * (2 * pipeline->reach + 1) + pipeline->reach;
+}
+
+static int getStepTasks(const CpuPipeline* pipeline){
+	return pipeline->bands * (pipeline->workers + 2);
+}
+
+static int getAgentTask(const CpuPipeline* pipeline, int step, int band, int worker){
+	return step * getStepTasks(pipeline) + band * pipeline->workers + worker;
+}
+
+static int getDepositTask(const CpuPipeline* pipeline, int step, int band){
+	return step * getStepTasks(pipeline) + pipeline->bands * pipeline->workers + band;
+}
+
+static int getDiffuseTask(const CpuPipeline* pipeline, int step, int band){
+	return step * getStepTasks(pipeline) + pipeline->bands * (pipeline->workers + 1) + band;
+}
+
+static void buildPipelineGraph(CpuSim* sim, int steps){
+	CpuPipeline* pipeline = sim->pipeline;
+	freeTaskGraph(&pipeline->graph);
+	initTaskGraph(&pipeline->graph, steps * getStepTasks(pipeline));
+	int step, band, delta, worker;
+	for (step = 0; step < steps; step++){
+		for (band = 0; band < pipeline->bands; band++){
+			for (delta = -pipeline->reach; delta <= pipeline->reach; delta++){
+				int neighbor = getNeighborBand(sim, band, delta);
+				if (neighbor < 0) continue;
+				// Deposits wait for the agents that read the band or move into it
+				for (worker = 0; worker < pipeline->workers; worker++){
+					addTaskEdge(&pipeline->graph, getAgentTask(pipeline, step, neighbor, worker), getDepositTask(pipeline, step, band));
+				}
+				// The blur reads the rows of the neighbors
+				addTaskEdge(&pipeline->graph, getDepositTask(pipeline, step, neighbor), getDiffuseTask(pipeline, step, band));
+				// The agents of the next step sense the diffused rows of the neighbors
+				if (step > 0){
+					for (worker = 0; worker < pipeline->workers; worker++){
+						addTaskEdge(&pipeline->graph, getDiffuseTask(pipeline, step - 1, neighbor), getAgentTask(pipeline, step, band, worker));
+					}
+				}
+			}
+		}
+	}
+	pipeline->steps = steps;
+}
+
+// Bins and graph for steps steps with the current settings and pool, 0 if the world has too few bands to overlap anything
+static int preparePipeline(CpuSim* sim, int steps){
+	if (sim->pipeline == NULL){
+		sim->pipeline = calloc(1, sizeof(CpuPipeline));
+	}
+	CpuPipeline* pipeline = sim->pipeline;
+	int bands = (sim->height + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS;
+	int reach = getPipelineReach(sim);
+	if (2 * reach + 1 > bands) return 0;
+	
+	if (bands != pipeline->bands || sim->pool->threadCount != pipeline->workers || reach != pipeline->reach){
+		int i;
+		for (i = 0; i < 2 * pipeline->binCount; i++){
+			free(pipeline->bins[i].agents);
+		}
+		pipeline->bands = bands;
+		pipeline->workers = sim->pool->threadCount;
+		pipeline->reach = reach;
+		pipeline->binCount = bands * pipeline->workers * (2 * reach + 1);
+		pipeline->bins = realloc(pipeline->bins, 2 * pipeline->binCount * sizeof(DepositBin));
+		memset(pipeline->bins, 0, 2 * pipeline->binCount * sizeof(DepositBin));
+		pipeline->steps = 0;
+	}
+	if (steps != pipeline->steps){
+		buildPipelineGraph(sim, steps);
+	}
+	return 1;
+}
+
+// The bins of step -1: every agent in the band it is in
+static void sortAgentsTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	int id;
+	for (id = begin; id < end; id++){
+		Agent agent = cpuGetAgent(sim, id);
+		addToBin(getPipelineBins(sim->pipeline, -1, getAgentBand(sim, &agent), thread), id);
+	}
+}
+
+// Move a share of the agents in band at the start of step (the ones the last step moved into it) and sort them by their new band
+static void pipelineAgents(CpuSim* sim, int step, int band, int worker){
+	CpuPipeline* pipeline = sim->pipeline;
+	const float* trailMap = pipeline->maps[step & 1];
+	unsigned int time = pipeline->time + step;
+	DepositBin* outputs = getPipelineBins(pipeline, step, band, worker);
+	int delta, source, i;
+	for (delta = -pipeline->reach; delta <= pipeline->reach; delta++){
+		outputs[delta].count = 0;
+	}
+	
+	int total = 0;
+	for (delta = -pipeline->reach; delta <= pipeline->reach; delta++){
+		int neighbor = getNeighborBand(sim, band, delta);
+		if (neighbor < 0) continue;
+		for (source = 0; source < pipeline->workers; source++){
+			total += getPipelineBins(pipeline, step - 1, neighbor, source)[-delta].count;
+		}
+	}
+	// Equal shares: the agents of a dense band (CENTER spawns) are spread over all workers
+	int first = (int)((long)total * worker / pipeline->workers), last = (int)((long)total * (worker + 1) / pipeline->workers);
+	int index = 0;
+	for (delta = -pipeline->reach; delta <= pipeline->reach && index < last; delta++){
+		int neighbor = getNeighborBand(sim, band, delta);
+		if (neighbor < 0) continue;
+		for (source = 0; source < pipeline->workers && index < last; source++){
+			const DepositBin* input = &getPipelineBins(pipeline, step - 1, neighbor, source)[-delta];
+			int end = last - index < input->count ? last - index : input->count;
+			for (i = first > index ? first - index : 0; i < end; i++){
+				int id = input->agents[i] < 0 ? ~input->agents[i] : input->agents[i];
+				Agent agent = cpuGetAgent(sim, id);
+				int trail = isActive(sim, id) && moveAgent(sim, trailMap, time, id, &agent);
+				addToBin(&outputs[getBandDelta(sim, band, getAgentBand(sim, &agent))], trail ? id : ~id);
+			}
+			index += input->count;
+		}
+	}
+}
+
+// Leave the trails of the agents that step moved into band
+static void pipelineDeposit(CpuSim* sim, int step, int band){
+	CpuPipeline* pipeline = sim->pipeline;
+	float* trailMap = pipeline->maps[step & 1];
+	int delta, source, i;
+	for (delta = -pipeline->reach; delta <= pipeline->reach; delta++){
+		int neighbor = getNeighborBand(sim, band, delta);
+		if (neighbor < 0) continue;
+		for (source = 0; source < pipeline->workers; source++){
+			const DepositBin* bin = &getPipelineBins(pipeline, step, neighbor, source)[-delta];
+			for (i = 0; i < bin->count; i++){
+				if (bin->agents[i] < 0) continue;
+				Agent agent = cpuGetAgent(sim, bin->agents[i]);
+				depositTrail(sim, trailMap, &agent);
+			}
+		}
+	}
+}
+
+static void pipelineTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	CpuPipeline* pipeline = sim->pipeline;
+	int step = begin / getStepTasks(pipeline), task = begin % getStepTasks(pipeline);
+	int agentTasks = pipeline->bands * pipeline->workers;
+	if (task < agentTasks){
+		pipelineAgents(sim, step, task / pipeline->workers, task % pipeline->workers);
+	}else if (task < agentTasks + pipeline->bands){
+		pipelineDeposit(sim, step, task - agentTasks);
+	}else{
+		int band = task - agentTasks - pipeline->bands;
+		int yEnd = (band + 1) * CPU_BAND_ROWS;
+		diffuseRows(sim, thread, pipeline->maps[step & 1], pipeline->maps[(step + 1) & 1], band * CPU_BAND_ROWS, yEnd < sim->height ? yEnd : sim->height);
+	}
+}
+
+void cpuStepPipelined(CpuSim* sim, int steps){
+	// The regions of a domain exchange halos and agents after every step, a single worker has nothing to overlap
+	int wholeWorld = sim->halo == 0 && sim->x1 - sim->x0 == sim->width && sim->y1 - sim->y0 == sim->height;
+	// The task graph diffuses every step at full resolution
+	int pipelined = wholeWorld && sim->pool && sim->pool->threadCount > 1 && sim->diffusePeriod <= 1 && sim->level.maxScale <= 1;
+	while (steps > 0){
+		int batch = steps < CPU_PIPELINE_STEPS ? steps : CPU_PIPELINE_STEPS;
+		if (!pipelined || !preparePipeline(sim, batch)){
+			cpuUpdate(sim);
+			cpuDiffuseRegion(sim);
+			cpuSwapTrailMaps(sim);
+			steps--;
+			continue;
+		}
+		CpuPipeline* pipeline = sim->pipeline;
+		prepareSpecies(sim);
+		prepareAddressing(sim);
+		prepareColumnSums(sim, sim->width + 2 * (int)sim->simulationSettings->blurRadius);
+		pipeline->maps[0] = sim->trailMap;
+		pipeline->maps[1] = sim->diffusedMap;
+		pipeline->time = sim->time;
+		
+		// One pass over the agents, from then on every step hands them on to the band they moved into
+		DepositBin* sorted = pipeline->bins + pipeline->binCount;	// step -1: odd
+		int i;
+		for (i = 0; i < pipeline->binCount; i++){
+			sorted[i].count = 0;
+		}
+		parallelFor(sim->pool, sim->agentCount, sim->agentChunk, sortAgentsTask, sim);
+		runTaskGraph(sim->pool, &pipeline->graph, pipelineTask, sim);
+		
+		sim->trailMap = pipeline->maps[batch & 1];
+		sim->diffusedMap = pipeline->maps[(batch + 1) & 1];
+		sim->time += batch;
+		steps -= batch;
+	}
+}
+
+/*----------------------------------*/
+
+// First and last row (in memory) of band, the first and last band include the halo
+static void getBandRows(CpuSim* sim, int band, int* first, int* last){
+	int bands = (sim->y1 - sim->y0 + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS;
+	*first = band == 0 ? 0 : sim->halo + band * CPU_BAND_ROWS;
+	*last = band == bands - 1 ? sim->y1 - sim->y0 + 2 * sim->halo : sim->halo + (band + 1) * CPU_BAND_ROWS;
+}
+
+static void clearBandsTask(int begin, int end, int thread, void* userData){
+	CpuSim* sim = userData;
+	int first, last, unused;
+	getBandRows(sim, begin, &first, &unused);
+	getBandRows(sim, end - 1, &unused, &last);
+	size_t offset = (size_t)first * sim->stride, size = (size_t)(last - first) * sim->stride * sizeof(float);
+	memset(sim->trailMap + offset, 0, size);
+	memset(sim->diffusedMap + offset, 0, size);
+}
+
+typedef struct{
+	CpuSim* sim;
+	int first;	// agent of index 0 of the loop
+} ClearAgents;
+
+static void clearAgentsTask(int begin, int end, int thread, void* userData){
+	ClearAgents* clear = userData;
+	CpuSim* sim = clear->sim;
+	begin += clear->first;
+	end += clear->first;
+	memset((char*)sim->agents + (size_t)begin * sim->agentSize, 0, (end - begin) * sim->agentSize);
+	memset(sim->leaving + begin, 0, end - begin);
+}
+
+void cpuClearSim(CpuSim* sim, int agents){
+	int bands = (sim->y1 - sim->y0 + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS;
+	agents = clampInt(agents, 0, sim->agentCapacity);
+	ClearAgents clear = {sim, 0};
+	if (sim->pool == NULL){
+		clearBandsTask(0, bands, 0, sim);
+		clearAgentsTask(0, sim->agentCapacity, 0, &clear);
+		return;
+	}
+	// Same shares as the deposit / diffuse and agent update loops (and cpuCountPages)
+	parallelForStatic(sim->pool, bands, 1, clearBandsTask, sim);
+	parallelForStatic(sim->pool, agents, sim->agentChunk, clearAgentsTask, &clear);
+	// Agents that move in later are appended behind them, spread over all workers
+	clear.first = agents;
+	parallelForStatic(sim->pool, sim->agentCapacity - agents, sim->agentChunk, clearAgentsTask, &clear);
+}
+
+void cpuCountPages(CpuSim* sim, long trailPages[2], long agentPages[2]){
+	if (sim->pool == NULL) return;
+	
+	int bands = (sim->y1 - sim->y0 + CPU_BAND_ROWS - 1) / CPU_BAND_ROWS;
+	int band, chunk;
+	for (band = 0; band < bands; band++){
+		int owner = getChunkOwner(sim->pool, bands, band);
+		int node = sim->pool->cpus ? getCpuNode(sim->pool->cpus[owner]) : 0;
+		int first, last;
+		getBandRows(sim, band, &first, &last);
+		size_t size = (size_t)(last - first) * sim->stride * sizeof(float);
+		countPageNodes(sim->trailMap + (size_t)first * sim->stride, size, node, &trailPages[0], &trailPages[1]);
+		countPageNodes(sim->diffusedMap + (size_t)first * sim->stride, size, node, &trailPages[0], &trailPages[1]);
+	}
+	
+	// The shares cpuClearSim first touched for the agents the region started with
+	int chunks = (sim->agentCount + sim->agentChunk - 1) / sim->agentChunk;
+	for (chunk = 0; chunk < chunks; chunk++){
+		int owner = getChunkOwner(sim->pool, chunks, chunk);
+		int node = sim->pool->cpus ? getCpuNode(sim->pool->cpus[owner]) : 0;
+		int count = sim->agentCount - chunk * sim->agentChunk < sim->agentChunk ? sim->agentCount - chunk * sim->agentChunk : sim->agentChunk;
+		countPageNodes((char*)sim->agents + (size_t)chunk * sim->agentChunk * sim->agentSize, count * sim->agentSize, node, &agentPages[0], &agentPages[1]);
+	}
+}
@@ -0,0 +1,192 @@
+#ifndef CPUSIM_H
+#define CPUSIM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "settings.h"
+#include "threadpool.h"
+#include "arena.h"
+
+// Agent left the region of the sim during the last update
+#define AGENT_STAYS 0
+#define AGENT_LEAVES 1	// leaves a trail where it arrives
+#define AGENT_BOUNCED 2	// hit the border of the world, no trail (not with wrap)
+
+#define CPU_AGENT_CHUNK 1024	// agents per chunk of the parallel agent update
+#define CPU_BAND_ROWS 8	// rows per chunk of the parallel deposit and diffuse
+#define TRIG_TABLE_SIZE 4096	// directions per full turn of the fast trig table (power of 2)
+#define CPU_PIPELINE_STEPS 8	// steps per task graph of cpuStepPipelined, a barrier between graphs
+#define ACTIVE_BLOCK 64	// agents that are switched on / off together by the governor (whole subgroups on the gpu)
+#define MAX_STEP_PERIOD 8	// multi-rate stepping: the slowest species still moves every 8th step
+#define MAX_DIFFUSE_SCALE 8	// coarsest level of the diffuse: 1 / 8 resolution
+
+// Agents of one worker that leave a trail in one band of rows
+typedef struct DepositBin{
+	int* agents;
+	int count, capacity;
+}DepositBin;
+
+// Reduced resolution level of the diffuse (getDiffuseLevel): the trailMap is averaged down, blurred at 1 / scale resolution,
+// upsampled bilinearly and blended with the full resolution trailMap, which keeps the deposits and is what agents sense
+typedef struct CpuLevel{
+	int maxScale;	// requested scale, 1: diffuse at full resolution
+	int scale, radius;	// of the last diffuse, the tables are built for them
+	int width, height;	// pixels of the level
+	float* map;	// downsampled trailMap, width * height * species, fits a level of scale 2
+	float* blurred;
+	int* columns;	// [x + radius]: offset of level column x in a row, wrapped or clamped
+	int* rows;	// [y + radius]: level row y, wrapped or clamped
+	int* sourceX;	// [2 * x]: offsets of the level columns left / right of trailMap column x
+	int* sourceY;	// [2 * y]: level rows above / below trailMap row y
+	float* fractionX;	// [x]: bilinear weight of the right column
+	float* fractionY;	// [y]: bilinear weight of the lower row
+}CpuLevel;
+
+/*
+Task graph of cpuStepPipelined: per step and band of rows one agent task per worker (the agents in the band),
+one deposit task and one diffuse task. A task waits only for the tasks of the bands within reach of its own:
+deposits into a band start when every agent task that reads the band or moves agents into it is done,
+the diffuse of a band when the deposits of the rows it blurs are done, the agents of the next step
+when the diffuse of the rows they sense is done.
+*/
+typedef struct CpuPipeline{
+	TaskGraph graph;
+	int steps, bands, workers, reach;	// graph built for them, reach: bands around a band that its tasks read or move agents to
+	// [parity of the step][(band * workers + worker) * (2 * reach + 1) + reach + delta]: agents the agent task of
+	// band and worker moved into band + delta, ~id for agents that leave no trail (inactive, bounced)
+	DepositBin* bins;
+	int binCount;	// per parity
+	float* maps[2];	// trailMap of even / odd steps of the current graph
+	unsigned int time;	// time of the first step of the current graph
+}CpuPipeline;
+
+// CPU version of the compute shaders for a rectangular region of the world
+// The trailMap covers the region plus a halo of pixels that belong to the neighboring regions
+typedef struct CpuSim{
+	int width, height;	// size of the whole world
+	int x0, y0, x1, y1;	// region [x0, x1) x [y0, y1) owned by this sim
+	int halo;
+	int species;	// channels per pixel
+	int stride;	// floats per row of the trailMap
+	float* trailMap;	// (region + halo) pixels, one float per species and pixel, taken from an arena
+	float* diffusedMap;	// ping-pong, swapped after every diffuse
+	void* agents;	// Agent or CompactAgent, use cpuGetAgent / cpuSetAgent
+	int compact;	// agents are stored as CompactAgent
+	size_t agentSize;
+	unsigned char* leaving;	// AGENT_* of every agent after the last update
+	int agentCount, agentCapacity;
+	unsigned int time;	// steps done, used for random numbers
+	const Species* speciesSettings;
+	const Simulation* simulationSettings;
+	ThreadPool* pool;	// runs cpuUpdate / cpuDiffuseRegion in parallel if not NULL
+	DepositBin* bins;	// [worker * bands + band], deposits are merged per band after the agent update
+	int binWorkers, bands;
+	int fastTrig;	// directions from a table, sensor directions rotated from the forward direction
+	float sensorRotation[MAX_SPECIES][2];	// cos / sin of the sensor angle of each species
+	float sensorAngleRad[MAX_SPECIES], turnRadians[MAX_SPECIES];	// updated at the start of every update
+	int wrap;	// toroidal world: samples and agents wrap around instead of being clamped / bouncing, set before the first update
+	int reach;	// pixels around the region covered by the offset tables, grows with the sensor offset / blur radius
+	int* columnOffsets;	// [x - x0 + reach]: offset of column x in a row, wrapped or clamped to the world or in the halo
+	size_t* rowOffsets;	// [y - y0 + reach]: offset of row y in a trailMap
+	float* columnSums;	// [worker * columnSumsSize]: vertical sums of the separable blur, one buffer per worker
+	size_t columnSumsSize;	// floats per worker, grows with the blur radius
+	int columnSumsWorkers;
+	unsigned int activeThreshold;	// agents with (cpuHash(id / ACTIVE_BLOCK) >> 16) < activeThreshold move, 65536: all
+	int blurStep;	// 1: every blur tap, 2: every other tap (half resolution)
+	int multiRate;	// species move every stepPeriods[s]-th step as far as in that many steps (getStepPeriods)
+	int stepPeriods[MAX_SPECIES];	// updated at the start of every update, all 1 without multiRate
+	int diffusePeriod;	// steps from one diffuse and decay to the next, each covers that many steps (1: every step)
+	CpuLevel level;	// diffuse at reduced resolution, set up by initCpuLevel (whole world only)
+	int agentChunk;	// agents per chunk of the parallel agent update (CPU_AGENT_CHUNK, tuned by libphysarum)
+	int diffuseBands;	// bands per chunk of the parallel diffuse (1)
+	CpuPipeline* pipeline;	// state of cpuStepPipelined, created by its first call
+}CpuSim;
+
+// Bytes initCpuSim takes from the arena
+size_t getCpuSimSize(int x0, int y0, int x1, int y1, int halo, int species, int agentCapacity, int compact);
+
+// Bytes initCpuLevel takes from the arena
+size_t getCpuLevelSize(int width, int height, int species);
+
+// Diffuse the whole world through a level of up to 1 / scale resolution (getDiffuseLevel), after initCpuSim with the arena
+// of both sizes and after wrap is set
+// Returns -1 if the level maps do not fit into the arena (getCpuLevelSize)
+int initCpuLevel(CpuSim* sim, int scale, Arena* arena);
+
+// trailMaps and agents (at most agentCapacity, as CompactAgent if compact) are taken from arena, which has to fit getCpuSimSize
+// Returns -1 if they do not fit into the arena, the sim can only be freed then
+int initCpuSim(CpuSim* sim, int width, int height, int x0, int y0, int x1, int y1, int halo, Arena* arena, int agentCapacity, int compact, const Species* speciesSettings, const Simulation* simulationSettings);
+
+// Clear the trailMaps and the agent buffer, has to be done before spawning
+// With a pool every band of rows and chunk of [0, agents) (the agents the region spawns) is written by the worker that starts with it,
+// so on the first use of the arena the pages end up on the NUMA node of that worker (first touch)
+void cpuClearSim(CpuSim* sim, int agents);
+
+void freeCpuSim(CpuSim* sim);
+
+// Pixels a species can look at from its position (sensor offset + sensor size), at least blurRadius
+int getCpuSimHalo(const Species* speciesSettings, const Simulation* simulationSettings);
+
+// Pointer to the channels of pixel (x, y) in world coordinates, has to be inside region + halo
+float* getTrail(CpuSim* sim, float* map, int x, int y);
+
+// Spawn agents [0, count) of the world like "spawnShader.glsl" and keep the ones inside the region
+void cpuSpawnAgents(CpuSim* sim, int count, const int speciesCounts[MAX_SPECIES], unsigned int seed);
+
+// Number of agents cpuSpawnAgents would keep, without spawning them
+int cpuCountSpawnedAgents(CpuSim* sim, int count, const int speciesCounts[MAX_SPECIES], unsigned int seed);
+
+void cpuAddAgent(CpuSim* sim, Agent agent);
+
+// Agent i, decoded if the agents are compact
+Agent cpuGetAgent(const CpuSim* sim, int i);
+
+void cpuSetAgent(CpuSim* sim, int i, Agent agent);
+
+// Sense, steer and move agents [first, last), leave trails inside the region, mark agents outside
+void cpuUpdateAgents(CpuSim* sim, int first, int last);
+
+// Leave the trail of agent in the trailMap (agent has to be inside the region)
+void cpuDeposit(CpuSim* sim, const Agent* agent);
+
+// Diffuse and decay rows [yStart, yEnd) of the region into diffusedMap, cpuDiffuseRegion / cpuUpdate prepare the tables it reads through
+// Not for the workers of the pool, which share its scratch
+void cpuDiffuse(CpuSim* sim, int yStart, int yEnd);
+
+// Update all agents: on the pool the agents only read the trailMap while they move, their trails are merged band by band afterwards
+void cpuUpdate(CpuSim* sim);
+
+// Diffuse and decay the whole region, in bands of rows on the pool
+void cpuDiffuseRegion(CpuSim* sim);
+
+// steps times cpuUpdate, cpuDiffuseRegion and cpuSwapTrailMaps, the same results
+// If the sim covers the whole world and has a pool, the phases of up to CPU_PIPELINE_STEPS steps overlap band by band
+void cpuStepPipelined(CpuSim* sim, int steps);
+
+// Pages of the bands / agent chunks that are on the node of their worker (local) or on another node (remote)
+void cpuCountPages(CpuSim* sim, long trailPages[2], long agentPages[2]);
+
+// Swap trailMap and diffusedMap after all rows are diffused (only in steps that diffuse), count the step
+void cpuSwapTrailMaps(CpuSim* sim);
+
+// 1 if step time diffuses and decays the trailMap: the last step of every diffusePeriod steps
+int isDiffuseStep(unsigned int time, int diffusePeriod);
+
+// Steps between two updates of each species for multi-rate stepping (shared with the shaders): a species with 1 / k
+// of the speed of the fastest one with agents (percent > 0) moves every k-th step (at most MAX_STEP_PERIOD), species s in the steps with
+// (time + s) % period == 0 so the slow species do not all move in the same step
+void getStepPeriods(const Species* speciesSettings, int species, int periods[MAX_SPECIES]);
+
+// Resolution divisor of a diffuse of blurRadius with --diffuse-scale diffuseScale (shared with the shaders), 1: full resolution
+// The level radius (*levelRadius) is chosen so that averaging down, the box blur of the level and the bilinear upsampling
+// spread trails about as far (same variance) as the full resolution box blur; the scale is lowered until the resampling
+// alone does not blur more than that (radius 1 and 0: full resolution, 2: 1 / 2, 3: 1 / 4)
+int getDiffuseLevel(int blurRadius, int diffuseScale, int* levelRadius);
+
+// hash function shared with the shaders
+unsigned int cpuHash(unsigned int state);
+
+#endif
@@ -0,0 +1,631 @@
+#include "domain.h"
+#include "numa.h"
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Agent in flight between two regions
+typedef struct Migrant{
+	Agent agent;
+	int deposit;	// leave a trail when it arrives
+}Migrant;
+
+// List of migrants that grows on demand
+typedef struct MigrantList{
+	Migrant* data;
+	int count, capacity;
+}MigrantList;
+
+static double getSeconds(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void pushMigrant(MigrantList* list, Migrant migrant){
+	if (list->count == list->capacity){
+		list->capacity = list->capacity ? list->capacity * 2 : 256;
+		list->data = realloc(list->data, list->capacity * sizeof(Migrant));
+	}
+	list->data[list->count++] = migrant;
+}
+
+void getDomainRegion(int width, int height, int countX, int countY, int px, int py, int* x0, int* y0, int* x1, int* y1){
+	*x0 = (int)((long)px * width / countX);
+	*x1 = (int)((long)(px + 1) * width / countX);
+	*y0 = (int)((long)py * height / countY);
+	*y1 = (int)((long)(py + 1) * height / countY);
+}
+
+/*----------------------------------*/
+
+// Send one message and receive one message over a socket at the same time.
+// Both neighbors send at once, blocking writes of big halos could fill both socket buffers and deadlock.
+// A message is a 64 bit size followed by the data, the received data has to be freed.
+static int exchangeMessage(int fd, const void* sendData, uint64_t sendSize, void** recvData, uint64_t* recvSize){
+	uint64_t sendHeader = sendSize, recvHeader = 0;
+	uint64_t sent = 0, received = 0;	// bytes including the header
+	char* recvBuffer = NULL;
+	
+	while (sent < sendSize + sizeof(uint64_t) || recvBuffer == NULL || received < recvHeader + sizeof(uint64_t)){
+		struct pollfd pfd = {.fd = fd, .events = 0};
+		if (sent < sendSize + sizeof(uint64_t)) pfd.events |= POLLOUT;
+		if (recvBuffer == NULL || received < recvHeader + sizeof(uint64_t)) pfd.events |= POLLIN;
+		
+		if (poll(&pfd, 1, -1) < 0){
+			if (errno == EINTR) continue;
+			free(recvBuffer);
+			return -1;
+		}
+		
+		if (pfd.revents & POLLOUT){
+			const char* data = sent < sizeof(uint64_t) ? (const char*)&sendHeader + sent : (const char*)sendData + (sent - sizeof(uint64_t));
+			uint64_t left = sent < sizeof(uint64_t) ? sizeof(uint64_t) - sent : sendSize + sizeof(uint64_t) - sent;
+			ssize_t n = send(fd, data, left, MSG_NOSIGNAL);
+			if (n < 0 && errno != EAGAIN && errno != EINTR){
+				free(recvBuffer);
+				return -1;
+			}
+			if (n > 0) sent += n;
+		}
+		
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)){
+			char* data = received < sizeof(uint64_t) ? (char*)&recvHeader + received : recvBuffer + (received - sizeof(uint64_t));
+			uint64_t left = received < sizeof(uint64_t) ? sizeof(uint64_t) - received : recvHeader + sizeof(uint64_t) - received;
+			ssize_t n = recv(fd, data, left, 0);
+			if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)){
+				// Neighbor is gone
+				free(recvBuffer);
+				return -1;
+			}
+			if (n > 0) received += n;
+			// Header complete, allocate the data (at least 1 byte so NULL means "no header yet")
+			if (recvBuffer == NULL && received == sizeof(uint64_t)){
+				recvBuffer = malloc(recvHeader ? recvHeader : 1);
+			}
+		}
+	}
+	
+	*recvData = recvBuffer;
+	*recvSize = recvHeader;
+	return 0;
+}
+
+// Order in which the two neighbors in one axis are visited: even regions start with the higher neighbor, odd regions with the lower one.
+// So both ends of every link exchange at the same time and no process waits for a neighbor that is busy with another link.
+static void getExchangeOrder(int position, int lower, int higher, int order[2]){
+	order[0] = (position % 2 == 0) ? higher : lower;
+	order[1] = (position % 2 == 0) ? lower : higher;
+}
+
+// Copy the pixels [xa, xb) x [ya, yb) of map into / out of a contiguous buffer
+static void copyRect(CpuSim* sim, float* map, int xa, int ya, int xb, int yb, float* buffer, int pack){
+	size_t rowSize = (size_t)(xb - xa) * sim->species;
+	int y;
+	for (y = ya; y < yb; y++, buffer += rowSize){
+		float* row = getTrail(sim, map, xa, y);
+		if (pack){
+			memcpy(buffer, row, rowSize * sizeof(float));
+		}else{
+			memcpy(row, buffer, rowSize * sizeof(float));
+		}
+	}
+}
+
+int exchangeHalo(Domain* domain, int width){
+	CpuSim* sim = &domain->sim;
+	if (width <= 0) return 0;
+	
+	int axis, i;
+	for (axis = 0; axis < 2; axis++){
+		int order[2];
+		if (axis == 0){
+			getExchangeOrder(domain->px, LEFT, RIGHT, order);
+		}else{
+			getExchangeOrder(domain->py, DOWN, UP, order);
+		}
+		
+		for (i = 0; i < 2; i++){
+			int direction = order[i];
+			if (domain->links[direction] < 0) continue;
+			
+			// Edge of the region that is sent and halo that is received
+			// The y exchange includes the x halos so the corners arrive as well
+			int sendX0, sendY0, sendX1, sendY1, recvX0, recvY0, recvX1, recvY1;
+			if (axis == 0){
+				sendY0 = recvY0 = sim->y0;
+				sendY1 = recvY1 = sim->y1;
+				sendX0 = direction == LEFT ? sim->x0 : sim->x1 - width;
+				recvX0 = direction == LEFT ? sim->x0 - width : sim->x1;
+				sendX1 = sendX0 + width;
+				recvX1 = recvX0 + width;
+			}else{
+				sendX0 = recvX0 = sim->x0 - width;
+				sendX1 = recvX1 = sim->x1 + width;
+				sendY0 = direction == DOWN ? sim->y0 : sim->y1 - width;
+				recvY0 = direction == DOWN ? sim->y0 - width : sim->y1;
+				sendY1 = sendY0 + width;
+				recvY1 = recvY0 + width;
+			}
+			
+			uint64_t sendSize = (uint64_t)(sendX1 - sendX0) * (sendY1 - sendY0) * sim->species * sizeof(float);
+			float* sendBuffer = malloc(sendSize);
+			copyRect(sim, sim->trailMap, sendX0, sendY0, sendX1, sendY1, sendBuffer, 1);
+			
+			void* recvBuffer;
+			uint64_t recvSize;
+			int status = exchangeMessage(domain->links[direction], sendBuffer, sendSize, &recvBuffer, &recvSize);
+			free(sendBuffer);
+			if (status != 0) return -1;
+			
+			if (recvSize == sendSize){
+				copyRect(sim, sim->trailMap, recvX0, recvY0, recvX1, recvY1, recvBuffer, 0);
+			}
+			free(recvBuffer);
+			if (recvSize != sendSize) return -1;
+		}
+	}
+	return 0;
+}
+
+// Send the migrants of each direction of one axis, keep the others and add the received ones to kept
+static int exchangeMigrants(Domain* domain, int axis, MigrantList* pending, MigrantList* kept){
+	CpuSim* sim = &domain->sim;
+	MigrantList outgoing[4] = {{0}};
+	
+	int i;
+	for (i = 0; i < pending->count; i++){
+		Migrant* migrant = &pending->data[i];
+		int v = axis == 0 ? (int)migrant->agent.x : (int)migrant->agent.y;
+		int v0 = axis == 0 ? sim->x0 : sim->y0, v1 = axis == 0 ? sim->x1 : sim->y1;
+		if (v >= v0 && v < v1){
+			pushMigrant(kept, *migrant);
+			continue;
+		}
+		// Pixels beyond the lower / upper edge, with wrap an agent that left over the edge of the world arrived on the other side
+		int size = axis == 0 ? sim->width : sim->height;
+		int below = v0 - v, above = v - v1 + 1;
+		if (domain->wrap){
+			below = (below + size) % size;
+			above = (above + size) % size;
+		}else{
+			below = below > 0 ? below : size;
+			above = above > 0 ? above : size;
+		}
+		pushMigrant(&outgoing[axis * 2 + (above < below)], *migrant);
+	}
+	
+	int order[2], status = 0;
+	if (axis == 0){
+		getExchangeOrder(domain->px, LEFT, RIGHT, order);
+	}else{
+		getExchangeOrder(domain->py, DOWN, UP, order);
+	}
+	for (i = 0; i < 2 && status == 0; i++){
+		int direction = order[i];
+		if (domain->links[direction] < 0) continue;
+		
+		void* recvBuffer;
+		uint64_t recvSize;
+		status = exchangeMessage(domain->links[direction], outgoing[direction].data, outgoing[direction].count * sizeof(Migrant), &recvBuffer, &recvSize);
+		if (status != 0) break;
+		
+		uint64_t k;
+		for (k = 0; k < recvSize / sizeof(Migrant); k++){
+			pushMigrant(kept, ((Migrant*)recvBuffer)[k]);
+		}
+		free(recvBuffer);
+	}
+	
+	for (i = 0; i < 4; i++){
+		free(outgoing[i].data);
+	}
+	return status;
+}
+
+int migrateAgents(Domain* domain){
+	CpuSim* sim = &domain->sim;
+	MigrantList pending = {0}, afterX = {0}, arrived = {0};
+	
+	// Take the agents that left out of the agent list
+	int i, count = 0;
+	for (i = 0; i < sim->agentCount; i++){
+		if (sim->leaving[i] == AGENT_STAYS){
+			// Stored bytes are moved as they are, compact agents are not decoded
+			memmove((char*)sim->agents + count++ * sim->agentSize, (char*)sim->agents + i * sim->agentSize, sim->agentSize);
+		}else{
+			pushMigrant(&pending, (Migrant){.agent = cpuGetAgent(sim, i), .deposit = sim->leaving[i] == AGENT_LEAVES});
+		}
+	}
+	sim->agentCount = count;
+	
+	// Agents move less than one region per step, diagonal moves are forwarded in y after the x exchange
+	int status = exchangeMigrants(domain, 0, &pending, &afterX);
+	if (status == 0) status = exchangeMigrants(domain, 1, &afterX, &arrived);
+	
+	for (i = 0; i < arrived.count; i++){
+		cpuAddAgent(sim, arrived.data[i].agent);
+		if (arrived.data[i].deposit){
+			cpuDeposit(sim, &arrived.data[i].agent);
+		}
+	}
+	
+	free(pending.data);
+	free(afterX.data);
+	free(arrived.data);
+	return status;
+}
+
+/*----------------------------------*/
+
+int runDomain(Domain* domain, int width, int height, int steps, int agents, const int speciesCounts[MAX_SPECIES], unsigned int seed, const Species* speciesSettings, const Simulation* simulationSettings, DomainResult* result){
+	int x0, y0, x1, y1;
+	getDomainRegion(width, height, domain->countX, domain->countY, domain->px, domain->py, &x0, &y0, &x1, &y1);
+	
+	// Halo: max(blurRadius, sensorOffset + sensorSize), neighbors have to be at least that wide
+	int halo = getCpuSimHalo(speciesSettings, simulationSettings);
+	if ((domain->countX > 1 && x1 - x0 < halo) || (domain->countY > 1 && y1 - y0 < halo)){
+		printf("Regions of %dx%d pixels are smaller than the halo of %d pixels, use fewer processes\n", x1 - x0, y1 - y0, halo);
+		return -1;
+	}
+	
+	memset(result, 0, sizeof(DomainResult));
+	long faults = getPageFaults();
+	
+	// One mapping for everything, any region may end up with all agents
+	Arena arena;
+	initArena(&arena);
+	if (reserveArena(&arena, getCpuSimSize(x0, y0, x1, y1, halo, (int)simulationSettings->species, agents, domain->compactAgents)) < 0){
+		return -1;
+	}
+	
+	// Workers live for the whole run, every phase of a step is one parallel loop
+	ThreadPool pool;
+	if (domain->threads > 1){
+		int* cpus = malloc(domain->threads * sizeof(int));
+		getWorkerCpus(domain->firstWorker, domain->threads, domain->totalWorkers, cpus);
+		initThreadPool(&pool, domain->threads, cpus);
+		free(cpus);
+	}
+	
+	CpuSim* sim = &domain->sim;
+	if (initCpuSim(sim, width, height, x0, y0, x1, y1, halo, &arena, agents, domain->compactAgents, speciesSettings, simulationSettings) != 0){
+		if (domain->threads > 1){
+			destroyThreadPool(&pool);
+		}
+		freeCpuSim(sim);
+		destroyArena(&arena);
+		return -1;
+	}
+	sim->pool = domain->threads > 1 ? &pool : NULL;
+	sim->fastTrig = domain->fastTrig;
+	sim->wrap = domain->wrap;
+	// Bands and agent chunks are first touched by the workers that start with them,
+	// the agent update splits the agents of the region, not the capacity of the whole world
+	cpuClearSim(sim, cpuCountSpawnedAgents(sim, agents, speciesCounts, seed));
+	cpuSpawnAgents(sim, agents, speciesCounts, seed);
+	
+	cpuCountPages(sim, result->trailPages, result->agentPages);
+	result->arenaSize = arena.size;
+	result->pageKind = arena.pageKind;
+	result->setupFaults = getPageFaults() - faults;
+	faults = getPageFaults();
+	int step, status = 0;
+	for (step = 0; step < steps && status == 0; step++){
+		double start = getSeconds();
+		cpuUpdate(sim);
+		double updated = getSeconds();
+		
+		// Arriving agents leave their trail before the neighbors copy it for their diffuse
+		status = migrateAgents(domain);
+		if (status == 0) status = exchangeHalo(domain, (int)simulationSettings->blurRadius);
+		double exchanged = getSeconds();
+		
+		cpuDiffuseRegion(sim);
+		cpuSwapTrailMaps(sim);
+		double diffused = getSeconds();
+		
+		// Sensors of the next step look into the halo
+		if (status == 0) status = exchangeHalo(domain, halo);
+		
+		result->updateTime += updated - start;
+		result->exchangeTime += exchanged - updated + getSeconds() - diffused;
+		result->diffuseTime += diffused - exchanged;
+	}
+	
+	int x, y, s;
+	for (y = sim->y0; y < sim->y1; y++){
+		for (x = sim->x0; x < sim->x1; x++){
+			const float* trail = getTrail(sim, sim->trailMap, x, y);
+			for (s = 0; s < sim->species; s++){
+				result->sums[s] += trail[s];
+			}
+		}
+	}
+	result->agentCount = sim->agentCount;
+	result->runFaults = getPageFaults() - faults;
+	
+	if (sim->pool){
+		result->steals = atomic_load(&pool.steals);
+		destroyThreadPool(&pool);
+	}
+	freeCpuSim(sim);
+	destroyArena(&arena);
+	return status;
+}
+
+void printDomainResult(const DomainResult* result, int species, int steps, double elapsed){
+	printf("Time: %.3f s, %.3f ms / step, %.1f steps / s\n", elapsed, elapsed * 1000. / steps, steps / elapsed);
+	printf("Update %.3f ms, exchange %.3f ms, diffuse %.3f ms / step\n", 
+		result->updateTime * 1000. / steps, result->exchangeTime * 1000. / steps, result->diffuseTime * 1000. / steps);
+	printf("Agents: %d, work steals: %ld\n", result->agentCount, result->steals);
+	if (result->trailPages[0] + result->trailPages[1] > 0){
+		printf("NUMA nodes: %d, trailMap pages local %.1f %% (%ld remote), agent pages local %.1f %% (%ld remote)\n", getNumaNodeCount(),
+			100. * result->trailPages[0] / (result->trailPages[0] + result->trailPages[1]), result->trailPages[1],
+			100. * result->agentPages[0] / (result->agentPages[0] + result->agentPages[1] > 0 ? result->agentPages[0] + result->agentPages[1] : 1), result->agentPages[1]);
+	}
+	Arena arena = {.pageKind = result->pageKind};
+	printf("Arena: %zu MB of %s, page faults: %ld during setup, %ld during the run\n", 
+		result->arenaSize >> 20, getArenaPageKindName(&arena), result->setupFaults, result->runFaults);
+	printf("TrailMap sum:");
+	int s;
+	for (s = 0; s < species; s++){
+		printf(" %d = %.3f", s + 1, result->sums[s]);
+	}
+	printf("\n");
+}
+
+void closeDomain(Domain* domain){
+	int i;
+	for (i = 0; i < 4; i++){
+		if (domain->links[i] >= 0) close(domain->links[i]);
+		domain->links[i] = -1;
+	}
+}
+
+// Index of the link on the other end
+static int oppositeDirection(int direction){
+	return direction ^ 1;
+}
+
+// Rank of the neighbor in direction or -1, with wrap the regions at the edges are neighbors (unless the region is the whole axis)
+static int getNeighborRank(int countX, int countY, int px, int py, int direction, int wrap){
+	int dx = direction == LEFT ? -1 : (direction == RIGHT ? 1 : 0);
+	int dy = direction == DOWN ? -1 : (direction == UP ? 1 : 0);
+	if ((dx != 0 && countX == 1) || (dy != 0 && countY == 1)) return -1;
+	if (wrap) return (py + dy + countY) % countY * countX + (px + dx + countX) % countX;
+	if (px + dx < 0 || px + dx >= countX || py + dy < 0 || py + dy >= countY) return -1;
+	return (py + dy) * countX + px + dx;
+}
+
+int runLocalDomains(int countX, int countY, int threads, int compactAgents, int fastTrig, int wrap, int width, int height, int steps, int agents, const int speciesCounts[MAX_SPECIES], unsigned int seed, const Species* speciesSettings, const Simulation* simulationSettings){
+	int processes = countX * countY;
+	int species = (int)simulationSettings->species;
+	
+	// Every process writes its result into shared memory
+	DomainResult* results = mmap(NULL, processes * sizeof(DomainResult), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (results == MAP_FAILED){
+		printf("Failed to map shared memory\n");
+		return -1;
+	}
+	
+	// links[rank * 4 + direction]: one socket pair per pair of neighbors
+	int* links = malloc(processes * 4 * sizeof(int));
+	int rank, direction, i;
+	for (i = 0; i < processes * 4; i++) links[i] = -1;
+	for (rank = 0; rank < processes; rank++){
+		for (direction = RIGHT; direction <= UP; direction += 2){
+			int neighbor = getNeighborRank(countX, countY, rank % countX, rank / countX, direction, wrap);
+			if (neighbor < 0) continue;
+			int pair[2];
+			if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0){
+				printf("Failed to create socket pair\n");
+				return -1;
+			}
+			fcntl(pair[0], F_SETFL, O_NONBLOCK);
+			fcntl(pair[1], F_SETFL, O_NONBLOCK);
+			links[rank * 4 + direction] = pair[0];
+			links[neighbor * 4 + oppositeDirection(direction)] = pair[1];
+		}
+	}
+	
+	printf("Running %d steps with %d agents on a %dx%d trailMap in %dx%d processes with %d threads\n", steps, agents, width, height, countX, countY, threads);
+	fflush(stdout);
+	double start = getSeconds();
+	
+	pid_t* pids = malloc(processes * sizeof(pid_t));
+	for (rank = 0; rank < processes; rank++){
+		pids[rank] = fork();
+		if (pids[rank] == 0){
+			// Every process pins its workers to its own cpus
+			Domain domain = {.countX = countX, .countY = countY, .px = rank % countX, .py = rank / countX, .threads = threads, .compactAgents = compactAgents, .fastTrig = fastTrig, .wrap = wrap, .firstWorker = rank * threads, .totalWorkers = processes * threads};
+			// Keep only the own links
+			for (i = 0; i < processes * 4; i++){
+				if (i / 4 != rank && links[i] >= 0) close(links[i]);
+			}
+			memcpy(domain.links, links + rank * 4, sizeof(domain.links));
+			
+			int status = runDomain(&domain, width, height, steps, agents, speciesCounts, seed, speciesSettings, simulationSettings, &results[rank]);
+			closeDomain(&domain);
+			_exit(status == 0 ? 0 : 1);
+		}
+	}
+	for (i = 0; i < processes * 4; i++){
+		if (links[i] >= 0) close(links[i]);
+	}
+	
+	int failed = 0;
+	for (rank = 0; rank < processes; rank++){
+		int status;
+		waitpid(pids[rank], &status, 0);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+	}
+	double elapsed = getSeconds() - start;
+	
+	// Sum up over all regions, times of the slowest process
+	DomainResult total;
+	memset(&total, 0, sizeof(total));
+	for (rank = 0; rank < processes; rank++){
+		int s;
+		for (s = 0; s < species; s++) total.sums[s] += results[rank].sums[s];
+		total.agentCount += results[rank].agentCount;
+		total.steals += results[rank].steals;
+		total.arenaSize += results[rank].arenaSize;
+		total.pageKind = results[rank].pageKind;
+		total.setupFaults += results[rank].setupFaults;
+		total.runFaults += results[rank].runFaults;
+		for (i = 0; i < 2; i++){
+			total.trailPages[i] += results[rank].trailPages[i];
+			total.agentPages[i] += results[rank].agentPages[i];
+		}
+		if (results[rank].updateTime > total.updateTime) total.updateTime = results[rank].updateTime;
+		if (results[rank].exchangeTime > total.exchangeTime) total.exchangeTime = results[rank].exchangeTime;
+		if (results[rank].diffuseTime > total.diffuseTime) total.diffuseTime = results[rank].diffuseTime;
+	}
+	printDomainResult(&total, species, steps, elapsed);
+	
+	free(pids);
+	free(links);
+	munmap(results, processes * sizeof(DomainResult));
+	
+	if (failed){
+		printf("A process failed\n");
+		return -1;
+	}
+	return 0;
+}
+
+/*----------------------------------*/
+
+// Split "host:port" number index of the comma separated peers list
+static int getPeer(const char* peers, int index, char* host, size_t hostSize, char* port, size_t portSize){
+	const char* start = peers;
+	while (index-- > 0){
+		start = strchr(start, ',');
+		if (start == NULL) return -1;
+		start++;
+	}
+	const char* end = strchr(start, ',');
+	if (end == NULL) end = start + strlen(start);
+	const char* colon = memchr(start, ':', end - start);
+	if (colon == NULL || (size_t)(colon - start) >= hostSize || (size_t)(end - colon - 1) >= portSize) return -1;
+	
+	memcpy(host, start, colon - start);
+	host[colon - start] = '\0';
+	memcpy(port, colon + 1, end - colon - 1);
+	port[end - colon - 1] = '\0';
+	return 0;
+}
+
+int connectDomain(Domain* domain, int countX, int countY, int rank, const char* peers, int wrap){
+	domain->countX = countX;
+	domain->countY = countY;
+	domain->px = rank % countX;
+	domain->py = rank / countX;
+	domain->threads = 1;
+	domain->compactAgents = 0;
+	domain->fastTrig = 0;
+	domain->wrap = wrap;
+	domain->firstWorker = 0;
+	domain->totalWorkers = 1;
+	int direction;
+	for (direction = 0; direction < 4; direction++) domain->links[direction] = -1;
+	
+	char host[256], port[16];
+	if (getPeer(peers, rank, host, sizeof(host), port, sizeof(port)) != 0){
+		printf("No address for rank %d in %s\n", rank, peers);
+		return -1;
+	}
+	
+	// Listen for the neighbors with a higher rank
+	struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE}, *info;
+	if (getaddrinfo(NULL, port, &hints, &info) != 0){
+		printf("Invalid port %s\n", port);
+		return -1;
+	}
+	int server = socket(info->ai_family, info->ai_socktype, 0);
+	int yes = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+	if (bind(server, info->ai_addr, info->ai_addrlen) != 0 || listen(server, 4) != 0){
+		printf("Failed to listen on port %s\n", port);
+		freeaddrinfo(info);
+		close(server);
+		return -1;
+	}
+	freeaddrinfo(info);
+	
+	int accepts = 0;
+	for (direction = 0; direction < 4; direction++){
+		int neighbor = getNeighborRank(countX, countY, domain->px, domain->py, direction, wrap);
+		if (neighbor < 0) continue;
+		if (neighbor > rank){
+			accepts++;
+			continue;
+		}
+		
+		// Connect to the neighbors with a lower rank, they may still be starting
+		if (getPeer(peers, neighbor, host, sizeof(host), port, sizeof(port)) != 0){
+			printf("No address for rank %d in %s\n", neighbor, peers);
+			close(server);
+			return -1;
+		}
+		int fd = -1, attempt;
+		for (attempt = 0; attempt < 300 && fd < 0; attempt++){
+			hints = (struct addrinfo){.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+			if (getaddrinfo(host, port, &hints, &info) == 0){
+				fd = socket(info->ai_family, info->ai_socktype, 0);
+				if (connect(fd, info->ai_addr, info->ai_addrlen) != 0){
+					close(fd);
+					fd = -1;
+					usleep(100000);
+				}
+				freeaddrinfo(info);
+			}
+		}
+		if (fd < 0){
+			printf("Failed to connect to rank %d (%s:%s)\n", neighbor, host, port);
+			close(server);
+			return -1;
+		}
+		// With wrap and 2 regions in a row the same neighbor is on both sides, the direction tells the links apart
+		int32_t id = rank * 4 + direction;
+		send(fd, &id, sizeof(id), 0);
+		domain->links[direction] = fd;
+	}
+	
+	// The neighbor tells its rank and the direction of the link on its side
+	while (accepts-- > 0){
+		int fd = accept(server, NULL, NULL);
+		int32_t id = -1;
+		if (fd < 0 || recv(fd, &id, sizeof(id), MSG_WAITALL) != sizeof(id)){
+			printf("Failed to accept a neighbor\n");
+			close(server);
+			return -1;
+		}
+		direction = oppositeDirection(id & 3);
+		if (getNeighborRank(countX, countY, domain->px, domain->py, direction, wrap) != id / 4 || domain->links[direction] >= 0){
+			printf("Unexpected neighbor %d\n", id / 4);
+			close(fd);
+			close(server);
+			return -1;
+		}
+		domain->links[direction] = fd;
+	}
+	close(server);
+	
+	for (direction = 0; direction < 4; direction++){
+		if (domain->links[direction] < 0) continue;
+		setsockopt(domain->links[direction], IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		fcntl(domain->links[direction], F_SETFL, O_NONBLOCK);
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "settings.h"
+#include "cpusim.h"
+
+// Directions of the neighbor links
+#define LEFT 0
+#define RIGHT 1
+#define DOWN 2
+#define UP 3
+
+// One process of a simulation that is split into countX * countY rectangular regions
+typedef struct Domain{
+	int countX, countY;	// number of regions in x / y
+	int px, py;	// region of this process
+	int links[4];	// stream sockets to the neighbors (LEFT, RIGHT, DOWN, UP), -1 at the border of the world
+	int threads;	// worker threads of this process
+	int compactAgents;	// store agents as CompactAgent
+	int fastTrig;	// directions from a table instead of sinf / cosf
+	int wrap;	// toroidal world, the regions at the edges are neighbors of the regions at the opposite edges
+	int firstWorker, totalWorkers;	// workers of this process among all workers on the machine, they are spread over the NUMA nodes
+	CpuSim sim;
+}Domain;
+
+// Statistics of one process after a run
+typedef struct DomainResult{
+	double sums[MAX_SPECIES];	// trailMap sum of each species in the region
+	int agentCount;
+	double updateTime, exchangeTime, diffuseTime;
+	long steals;	// chunk ranges stolen by idle workers
+	long trailPages[2], agentPages[2];	// pages on the NUMA node of their worker / on another node
+	size_t arenaSize;
+	int pageKind;	// ARENA_* of the arena
+	long setupFaults, runFaults;	// page faults while allocating and spawning / while running
+}DomainResult;
+
+// Region [x0, x1) x [y0, y1) of process (px, py)
+void getDomainRegion(int width, int height, int countX, int countY, int px, int py, int* x0, int* y0, int* x1, int* y1);
+
+// Copy width pixels at the edges of the region into the halos of the neighbors (x first, then y with the corners)
+int exchangeHalo(Domain* domain, int width);
+
+// Hand agents that left the region to the neighbors (x first, then y), agents leave their trail where they arrive
+int migrateAgents(Domain* domain);
+
+// Spawn the agents of the region and run steps, the neighbor links have to be connected
+int runDomain(Domain* domain, int width, int height, int steps, int agents, const int speciesCounts[MAX_SPECIES], unsigned int seed, const Species* speciesSettings, const Simulation* simulationSettings, DomainResult* result);
+
+// Run countX * countY processes with threads workers each on this machine, connected by unix domain sockets
+int runLocalDomains(int countX, int countY, int threads, int compactAgents, int fastTrig, int wrap, int width, int height, int steps, int agents, const int speciesCounts[MAX_SPECIES], unsigned int seed, const Species* speciesSettings, const Simulation* simulationSettings);
+
+// Connect process rank to its neighbors over tcp, peers has one "host:port" per rank (rank = py * countX + px)
+int connectDomain(Domain* domain, int countX, int countY, int rank, const char* peers, int wrap);
+
+void closeDomain(Domain* domain);
+
+void printDomainResult(const DomainResult* result, int species, int steps, double elapsed);
+
+#endif
@@ -0,0 +1,237 @@
+#include "framering.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+https://man7.org/linux/man-pages/man7/shm_overview.7.html
+https://www.hpl.hp.com/techreports/2012/HPL-2012-68.pdf	(Can Seqlocks Get Along With Programming Language Memory Models?)
+*/
+
+static FrameSlot* getSlot(FrameRingHeader* header, uint64_t index){
+	return (FrameSlot*)((char*)header + sizeof(FrameRingHeader) + index * header->slotStride);
+}
+
+// Bytes of the pixels of a frame
+static size_t getFrameBytes(int format, int width, int height, int channels){
+	return format == FRAME_RING_RGBA8 ? (size_t)width * height * 4 : (size_t)width * height * channels * sizeof(float);
+}
+
+// Map a new shared memory object for frames of width x height x channels
+static int mapFrameRing(FrameRing* ring, int width, int height, int channels){
+	size_t slotSize = getFrameBytes(ring->format, width, height, channels);
+	size_t slotStride = sizeof(FrameSlot) + (slotSize + 63) / 64 * 64;
+	size_t size = sizeof(FrameRingHeader) + ring->slotCount * slotStride;
+
+	// A ring left behind by an earlier run is not ours to reuse, its readers would see frames of another size
+	shm_unlink(ring->name);
+	int fd = shm_open(ring->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0){
+		perror("shm_open");
+		return -1;
+	}
+	if (ftruncate(fd, size) != 0){
+		perror("ftruncate");
+		close(fd);
+		shm_unlink(ring->name);
+		return -1;
+	}
+	FrameRingHeader* header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED){
+		perror("mmap");
+		shm_unlink(ring->name);
+		return -1;
+	}
+
+	// The object starts out zeroed: every sequence is 0 and nothing is published
+	header->magic = FRAME_RING_MAGIC;
+	header->version = FRAME_RING_VERSION;
+	header->format = ring->format;
+	header->width = width;
+	header->height = height;
+	header->channels = ring->format == FRAME_RING_RGBA8 ? 4 : channels;
+	header->slotCount = ring->slotCount;
+	header->slotSize = slotSize;
+	header->slotStride = slotStride;
+	atomic_store_explicit(&header->published, 0, memory_order_relaxed);
+	atomic_store_explicit(&header->state, FRAME_RING_LIVE, memory_order_release);
+
+	ring->header = header;
+	ring->size = size;
+	return 0;
+}
+
+int createFrameRing(FrameRing* ring, const char* name, int format, int slotCount, int width, int height, int channels, const Species* species){
+	memset(ring, 0, sizeof(FrameRing));
+	snprintf(ring->name, sizeof(ring->name), "%s%s", name[0] == '/' ? "" : "/", name);
+	ring->format = format;
+	ring->slotCount = slotCount < 2 ? 2 : slotCount;
+	ring->species = species;
+	return mapFrameRing(ring, width, height, channels);
+}
+
+// Tell the readers to reopen and unmap the ring
+static void releaseFrameRing(FrameRing* ring){
+	if (ring->header == NULL) return;
+	atomic_store_explicit(&ring->header->state, FRAME_RING_REPLACED, memory_order_release);
+	munmap(ring->header, ring->size);
+	ring->header = NULL;
+}
+
+void publishFrame(const float* pixels, int width, int height, int channels, long frame, void* userData){
+	FrameRing* ring = (FrameRing*)userData;
+
+	// More species (or a new size) than the ring was made for after a reset: a new ring under the same name
+	if (ring->header == NULL || getFrameBytes(ring->format, width, height, channels) > ring->header->slotSize
+		|| (ring->format == FRAME_RING_FLOAT && (int)ring->header->channels != channels)){
+		releaseFrameRing(ring);
+		if (mapFrameRing(ring, width, height, channels) != 0){
+			ring->dropped++;
+			return;
+		}
+	}
+	FrameRingHeader* header = ring->header;
+
+	uint64_t n = atomic_load_explicit(&header->published, memory_order_relaxed);
+	FrameSlot* slot = getSlot(header, n % header->slotCount);
+
+	// Odd: readers that look at this slot now or started before will drop what they read
+	atomic_store_explicit(&slot->sequence, 2 * n + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	slot->frame = frame;
+	slot->width = width;
+	slot->height = height;
+	slot->channels = header->channels;
+
+	// Channel c of the captured frame: layer c / components, component c % components (see FrameCallback)
+	size_t pixelCount = (size_t)width * height;
+	int components = channels <= 4 ? channels : 4;
+	const float* channelBase[MAX_SPECIES];
+	int c;
+	for (c = 0; c < channels && c < MAX_SPECIES; c++){
+		channelBase[c] = pixels + (size_t)(c / components) * pixelCount * components + c % components;
+	}
+	size_t i;
+	if (ring->format == FRAME_RING_RGBA8){
+		// Same colors as the window: trail of every species times its color, clamped by the 8 bit channels
+		// (colors scaled to 0..255 up front, clamped with compares: fminf / fmaxf are library calls without -ffast-math)
+		unsigned char* out = (unsigned char*)(slot + 1);
+		float colors[MAX_SPECIES][3];
+		int colorCount = channels < MAX_SPECIES ? channels : MAX_SPECIES;
+		for (c = 0; c < colorCount; c++){
+			colors[c][0] = ring->species[c].r * 255.0f;
+			colors[c][1] = ring->species[c].g * 255.0f;
+			colors[c][2] = ring->species[c].b * 255.0f;
+		}
+		for (i = 0; i < pixelCount; i++){
+			float rgb[3] = {0.5f, 0.5f, 0.5f};	// rounding
+			for (c = 0; c < colorCount; c++){
+				float trail = channelBase[c][i * components];
+				rgb[0] += trail * colors[c][0];
+				rgb[1] += trail * colors[c][1];
+				rgb[2] += trail * colors[c][2];
+			}
+			int k;
+			for (k = 0; k < 3; k++){
+				out[i * 4 + k] = rgb[k] >= 255.0f ? 255 : (rgb[k] > 0.0f ? (unsigned char)rgb[k] : 0);
+			}
+			out[i * 4 + 3] = 255;
+		}
+	}else if (channels <= 4){
+		// One layer is already one float per species
+		memcpy(slot + 1, pixels, pixelCount * channels * sizeof(float));
+	}else{
+		float* out = (float*)(slot + 1);
+		for (i = 0; i < pixelCount; i++){
+			for (c = 0; c < channels; c++){
+				out[i * channels + c] = channelBase[c][i * components];
+			}
+		}
+	}
+
+	// Even: the frame is complete, then it becomes the newest
+	atomic_store_explicit(&slot->sequence, 2 * n + 2, memory_order_release);
+	atomic_store_explicit(&header->published, n + 1, memory_order_release);
+}
+
+void destroyFrameRing(FrameRing* ring){
+	releaseFrameRing(ring);
+	shm_unlink(ring->name);
+}
+
+int openFrameRing(FrameRingReader* reader, const char* name){
+	char path[sizeof(reader->name)];
+	snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+	memset(reader, 0, sizeof(FrameRingReader));
+	memcpy(reader->name, path, sizeof(path));
+
+	int fd = shm_open(reader->name, O_RDONLY, 0);
+	if (fd < 0){
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FrameRingHeader)){
+		close(fd);
+		return -1;
+	}
+	FrameRingHeader* header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (header == MAP_FAILED){
+		return -1;
+	}
+	// The publisher may still be filling in the header
+	if (atomic_load_explicit(&header->state, memory_order_acquire) != FRAME_RING_LIVE || header->magic != FRAME_RING_MAGIC
+		|| header->version != FRAME_RING_VERSION || sizeof(FrameRingHeader) + header->slotCount * header->slotStride > (size_t)st.st_size){
+		munmap(header, st.st_size);
+		return -1;
+	}
+	reader->header = header;
+	reader->size = st.st_size;
+	return 0;
+}
+
+int readLatestFrame(FrameRingReader* reader, FrameView* view){
+	if (reader->header && atomic_load_explicit(&reader->header->state, memory_order_acquire) != FRAME_RING_LIVE){
+		// Keep the old mapping until the new ring is there
+		FrameRingReader newReader;
+		if (openFrameRing(&newReader, reader->name) != 0) return 0;
+		closeFrameRing(reader);
+		*reader = newReader;
+	}
+	if (reader->header == NULL && openFrameRing(reader, reader->name) != 0) return 0;
+	FrameRingHeader* header = reader->header;
+
+	uint64_t published = atomic_load_explicit(&header->published, memory_order_acquire);
+	if (published == 0) return 0;
+	uint64_t n = published - 1;
+	const FrameSlot* slot = getSlot(header, n % header->slotCount);
+	uint64_t sequence = atomic_load_explicit(&((FrameSlot*)slot)->sequence, memory_order_acquire);
+	if (sequence != 2 * n + 2) return 0;	// the publisher lapped us between the two loads
+
+	view->pixels = slot + 1;
+	view->width = slot->width;
+	view->height = slot->height;
+	view->channels = slot->channels;
+	view->format = header->format;
+	view->frame = slot->frame;
+	view->sequence = sequence;
+	view->slot = slot;
+	return frameStillValid(view);
+}
+
+int frameStillValid(const FrameView* view){
+	// Everything read before the fence was read before the sequence below
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&((FrameSlot*)view->slot)->sequence, memory_order_relaxed) == view->sequence;
+}
+
+void closeFrameRing(FrameRingReader* reader){
+	if (reader->header){
+		munmap(reader->header, reader->size);
+		reader->header = NULL;
+	}
+}
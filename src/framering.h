@@ -0,0 +1,96 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "settings.h"
+
+#define FRAME_RING_MAGIC 0x474e4952	// "RING"
+#define FRAME_RING_VERSION 1
+#define FRAME_RING_SLOTS 4	// default: a reader has 3 frames of time before its frame is overwritten
+
+// Pixel formats of a ring
+#define FRAME_RING_RGBA8 0	// species colors added up like "fragmentShader.glsl", 4 bytes per pixel
+#define FRAME_RING_FLOAT 1	// float trail of every species, channels floats per pixel
+
+// State of a ring
+#define FRAME_RING_LIVE 1
+#define FRAME_RING_REPLACED 2	// frames got bigger (more species), the publisher made a new ring under the same name
+
+/*
+Layout of the shared memory object: FrameRingHeader, then slotCount times (FrameSlot + slotSize bytes of pixels).
+Frame n goes into slot n % slotCount. Each slot is a sequence lock: sequence is odd while the publisher writes,
+2 * n + 2 once frame n is complete. Readers use the pixels in place and check afterwards that sequence did not change,
+the publisher never waits for them.
+*/
+typedef struct FrameRingHeader{
+	uint32_t magic, version;
+	_Atomic uint32_t state;	// FRAME_RING_*
+	uint32_t format;	// FRAME_RING_RGBA8 or FRAME_RING_FLOAT
+	uint32_t width, height, channels;	// channels: 4 bytes (RGBA8) or floats per pixel, species order
+	uint32_t slotCount;
+	uint64_t slotSize;	// bytes of pixels per slot
+	uint64_t slotStride;	// bytes from one FrameSlot to the next
+	_Atomic uint64_t published;	// frames published so far, the newest is published - 1
+	char padding[64 - 56];
+}FrameRingHeader;
+
+typedef struct FrameSlot{
+	_Atomic uint64_t sequence;
+	uint64_t frame;	// step of the frame
+	uint32_t width, height, channels;
+	char padding[64 - 28];
+}FrameSlot;
+
+// Publisher side, owns the shared memory object
+typedef struct FrameRing{
+	char name[64];	// e.g. "/physarum"
+	int format, slotCount;
+	FrameRingHeader* header;
+	size_t size;	// bytes mapped
+	const Species* species;	// colors of FRAME_RING_RGBA8, read at every frame
+	long dropped;	// frames that did not fit and were skipped while the ring was replaced
+}FrameRing;
+
+// Reader side
+typedef struct FrameRingReader{
+	char name[64];
+	FrameRingHeader* header;
+	size_t size;
+}FrameRingReader;
+
+// A frame a reader looks at, valid while frameStillValid returns 1
+typedef struct FrameView{
+	const void* pixels;	// uint8_t RGBA or float, width * height * channels values
+	int width, height, channels, format;
+	uint64_t frame;
+	uint64_t sequence;
+	const FrameSlot* slot;
+}FrameView;
+
+// Create (or take over) the shared memory object name for frames of width x height with channels species channels
+// species: colors for FRAME_RING_RGBA8, returns 0 on success
+int createFrameRing(FrameRing* ring, const char* name, int format, int slotCount, int width, int height, int channels, const Species* species);
+
+// FrameCallback (capture.h) with a FrameRing as userData: colorize or repack the frame straight into the next slot
+void publishFrame(const float* pixels, int width, int height, int channels, long frame, void* userData);
+
+// Unmap and remove the shared memory object, readers keep their mapping
+void destroyFrameRing(FrameRing* ring);
+
+// Map the ring of a publisher read only, returns 0 on success
+int openFrameRing(FrameRingReader* reader, const char* name);
+
+// Newest complete frame in place, 0 if there is none yet (or the ring was replaced, then it is reopened)
+int readLatestFrame(FrameRingReader* reader, FrameView* view);
+
+// 1 if the publisher has not started to overwrite the frame of view, anything read from it before is good
+int frameStillValid(const FrameView* view);
+
+void closeFrameRing(FrameRingReader* reader);
+
+#endif
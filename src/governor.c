@@ -0,0 +1,217 @@
+#include "governor.h"
+
+#include <time.h>
+#include <math.h>
+
+/*
+https://www.khronos.org/opengl/wiki/Query_Object#Timer_queries
+*/
+
+static const char* phaseNames[GOVERNOR_PHASES] = {"agents", "diffuse", "upload"};
+
+static double getSeconds(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void initGovernor(Governor* governor, double budget, FILE* log, int gpu){
+	memset(governor, 0, sizeof(Governor));
+	governor->budget = budget;
+	governor->log = log;
+	governor->gpu = gpu;
+	governor->stepsPerFrame = 1 << 30;	// limited by the setting on the first update
+	governor->blurStep = 1;
+	governor->activeFraction = 1.0f;
+	governor->settle = GOVERNOR_SETTLE;
+	if (gpu){
+		glGenQueries(GOVERNOR_QUERY_RING * GOVERNOR_PHASES, &governor->queries[0][0]);
+	}
+	fprintf(log, "[governor] budget %.2f ms per frame\n", budget * 1000.);
+	fflush(log);
+}
+
+void destroyGovernor(Governor* governor){
+	if (governor->gpu){
+		glDeleteQueries(GOVERNOR_QUERY_RING * GOVERNOR_PHASES, &governor->queries[0][0]);
+	}
+}
+
+// Add the result of a finished query to its phase, wait only if block
+static void collectQuery(Governor* governor, int slot, int phase, int block){
+	if (!governor->queryUsed[slot][phase]) return;
+	if (!block){
+		GLint available = 0;
+		glGetQueryObjectiv(governor->queries[slot][phase], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) return;
+	}
+	GLuint64 nanoseconds = 0;
+	glGetQueryObjectui64v(governor->queries[slot][phase], GL_QUERY_RESULT, &nanoseconds);
+	governor->phaseTime[phase] += nanoseconds * 1e-9;
+	governor->queryUsed[slot][phase] = 0;
+}
+
+void beginPhase(Governor* governor, int phase){
+	if (governor->finish){
+		glFinish();
+	}
+	if (!governor->gpu || governor->finish){
+		governor->phaseStart = getSeconds();
+		return;
+	}
+	if (phase == GOVERNOR_AGENTS){
+		// The slot of a step GOVERNOR_QUERY_RING steps ago, its results are there unless the gpu is that far behind
+		governor->queryHead = (governor->queryHead + 1) % GOVERNOR_QUERY_RING;
+		int p;
+		for (p = 0; p < GOVERNOR_PHASES; p++){
+			collectQuery(governor, governor->queryHead, p, 1);
+		}
+	}
+	glBeginQuery(GL_TIME_ELAPSED, governor->queries[governor->queryHead][phase]);
+	governor->queryUsed[governor->queryHead][phase] = 1;
+}
+
+void endPhase(Governor* governor, int phase){
+	if (governor->finish){
+		glFinish();
+	}
+	if (!governor->gpu || governor->finish){
+		governor->phaseTime[phase] += getSeconds() - governor->phaseStart;
+		return;
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+unsigned int getActiveThreshold(const Governor* governor){
+	return (unsigned int)(governor->activeFraction * 65536.0f + 0.5f);
+}
+
+// Costs of the averaged frame for the log
+static void logFrame(Governor* governor, double total, const char* change){
+	fprintf(governor->log, "[governor] frame %ld: %.2f ms (budget %.2f ms", governor->frame, total * 1000., governor->budget * 1000.);
+	int p;
+	for (p = 0; p < GOVERNOR_PHASES; p++){
+		if (governor->averageTime[p] > 0) fprintf(governor->log, ", %s %.2f ms", phaseNames[p], governor->averageTime[p] * 1000.);
+	}
+	fprintf(governor->log, "): %s\n", change);
+	fflush(governor->log);
+}
+
+// Over budget: take away the cheapest quality that helps, returns 0 if there is nothing left
+static int shed(Governor* governor, int blurRadius, double total){
+	double agents = governor->averageTime[GOVERNOR_AGENTS], diffuse = governor->averageTime[GOVERNOR_DIFFUSE];
+	char change[128];
+	if (governor->stepsPerFrame > 1){
+		// The work per frame scales with the steps, every step keeps its quality
+		int steps = (int)(governor->stepsPerFrame * governor->budget / total);
+		steps = steps < 1 ? 1 : (steps < governor->stepsPerFrame ? steps : governor->stepsPerFrame - 1);
+		snprintf(change, sizeof(change), "steps per frame %d -> %d", governor->stepsPerFrame, steps);
+		governor->stepsPerFrame = steps;
+	}else if (governor->blurStep == 1 && blurRadius >= 2 && (diffuse > agents || governor->activeFraction <= GOVERNOR_MIN_ACTIVE)){
+		governor->fullDiffuseTime = diffuse;
+		governor->blurStep = 2;
+		snprintf(change, sizeof(change), "blur at half resolution (radius %d)", blurRadius);
+	}else if (governor->activeFraction > GOVERNOR_MIN_ACTIVE && agents > 0){
+		// The agent phase scales with the active agents: take away the excess and 10 % margin, rounded down to a step
+		float fraction = governor->activeFraction * (float)(1.0 - (total - governor->budget) * 1.1 / agents);
+		fraction = floorf(fraction * GOVERNOR_ACTIVE_STEPS) / GOVERNOR_ACTIVE_STEPS;
+		if (fraction >= governor->activeFraction) fraction = governor->activeFraction - 1.0f / GOVERNOR_ACTIVE_STEPS;
+		if (fraction < GOVERNOR_MIN_ACTIVE) fraction = GOVERNOR_MIN_ACTIVE;
+		snprintf(change, sizeof(change), "active agents %.1f %% -> %.1f %%", governor->activeFraction * 100., fraction * 100.);
+		governor->activeFraction = fraction;
+	}else{
+		if (!governor->saturated){
+			logFrame(governor, total, "over budget at the lowest quality");
+		}
+		governor->saturated = 1;
+		return 0;
+	}
+	logFrame(governor, total, change);
+	return 1;
+}
+
+// Headroom: bring back the quality that fits, most visible first, returns 0 if nothing fits
+static int restore(Governor* governor, int maxSteps, double total){
+	double target = governor->budget * GOVERNOR_HEADROOM;
+	double agents = governor->averageTime[GOVERNOR_AGENTS], diffuse = governor->averageTime[GOVERNOR_DIFFUSE];
+	char change[128];
+	if (governor->activeFraction < 1.0f){
+		// Grow the active agents into the spare time
+		float fraction = agents > 0 ? governor->activeFraction * (float)(1.0 + (target - total) / agents) : 1.0f;
+		fraction = floorf(fraction * GOVERNOR_ACTIVE_STEPS) / GOVERNOR_ACTIVE_STEPS;
+		if (fraction <= governor->activeFraction) fraction = governor->activeFraction + 1.0f / GOVERNOR_ACTIVE_STEPS;
+		if (fraction > 1.0f) fraction = 1.0f;
+		snprintf(change, sizeof(change), "active agents %.1f %% -> %.1f %%", governor->activeFraction * 100., fraction * 100.);
+		governor->activeFraction = fraction;
+	}else if (governor->blurStep == 2 && total - diffuse + governor->fullDiffuseTime < target){
+		governor->blurStep = 1;
+		snprintf(change, sizeof(change), "blur at full resolution");
+	}else if (governor->stepsPerFrame < maxSteps && total * (governor->stepsPerFrame + 1) / governor->stepsPerFrame < target){
+		snprintf(change, sizeof(change), "steps per frame %d -> %d", governor->stepsPerFrame, governor->stepsPerFrame + 1);
+		governor->stepsPerFrame++;
+	}else{
+		return 0;
+	}
+	governor->saturated = 0;
+	logFrame(governor, total, change);
+	return 1;
+}
+
+void updateGovernor(Governor* governor, int maxSteps, int blurRadius){
+	int slot, p;
+	double now = getSeconds();
+	if (governor->gpu && !governor->finish){
+		// Results that are already there, the rest is collected when the slot is reused
+		for (slot = 0; slot < GOVERNOR_QUERY_RING; slot++){
+			for (p = 0; p < GOVERNOR_PHASES; p++){
+				if (slot != governor->queryHead) collectQuery(governor, slot, p, 0);
+			}
+		}
+	}
+
+	double total = 0;
+	for (p = 0; p < GOVERNOR_PHASES; p++){
+		if (governor->frame == 0){
+			governor->averageTime[p] = governor->phaseTime[p];
+		}else{
+			governor->averageTime[p] += GOVERNOR_SMOOTHING * (governor->phaseTime[p] - governor->averageTime[p]);
+		}
+		governor->phaseTime[p] = 0;
+		total += governor->averageTime[p];
+	}
+	governor->frame++;
+
+	// Some drivers (software rasterizers) answer timer queries with next to nothing: wait for the gpu around every phase instead
+	if (governor->gpu && !governor->finish && governor->frame > 1){
+		governor->wallTime += now - governor->frameStart;
+		if (governor->frame == GOVERNOR_QUERY_RING + 2 && total < governor->wallTime / (GOVERNOR_QUERY_RING + 1) * 0.01){
+			fprintf(governor->log, "[governor] timer queries report %.3f ms of %.2f ms per frame, timing phases with glFinish\n", total * 1000., governor->wallTime / (GOVERNOR_QUERY_RING + 1) * 1000.);
+			fflush(governor->log);
+			governor->finish = 1;
+			for (slot = 0; slot < GOVERNOR_QUERY_RING; slot++){
+				for (p = 0; p < GOVERNOR_PHASES; p++){
+					governor->queryUsed[slot][p] = 0;
+				}
+			}
+			governor->frame = 0;
+			governor->settle = GOVERNOR_SETTLE;
+		}
+	}
+	governor->frameStart = now;
+
+	// The setting may have been lowered in the tui
+	if (maxSteps < 1) maxSteps = 1;
+	if (governor->stepsPerFrame > maxSteps) governor->stepsPerFrame = maxSteps;
+	if (blurRadius < 2) governor->blurStep = 1;
+
+	if (--governor->settle > 0) return;
+
+	int changed = 0;
+	if (total > governor->budget){
+		changed = shed(governor, blurRadius, total);
+	}else if (total < governor->budget * GOVERNOR_HEADROOM){
+		changed = restore(governor, maxSteps, total);
+	}
+	// Look again after the averages have seen the change
+	governor->settle = changed ? GOVERNOR_SETTLE : 1;
+}
@@ -0,0 +1,65 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GL/glew.h>
+
+// Phases of a step that are measured
+#define GOVERNOR_AGENTS 0	// sense, steer, move and deposit
+#define GOVERNOR_DIFFUSE 1	// blur and decay
+#define GOVERNOR_UPLOAD 2	// cpu trailMap into the texture (cpu simulation only)
+#define GOVERNOR_PHASES 3
+
+#define GOVERNOR_QUERY_RING 8	// steps whose gpu timer queries can be in flight
+#define GOVERNOR_SETTLE 12	// frames after a change before the next decision, the averages have to catch up
+#define GOVERNOR_SMOOTHING 0.25	// weight of the newest frame in the averages
+#define GOVERNOR_HEADROOM 0.8	// quality comes back while the frame takes less than this part of the budget
+#define GOVERNOR_MIN_ACTIVE (1.0f / 16)	// the last agents that are kept moving
+#define GOVERNOR_ACTIVE_STEPS 64	// the active part of the agents changes in steps of 1 / 64
+
+// Holds the simulation work of a frame below a budget by shedding quality and brings it back when there is headroom.
+// Shed in this order: steps per frame (speed, not quality), half resolution blur if the diffuse costs more than the agents,
+// active agents (proportional to the excess), half resolution blur. Restored in the opposite order.
+typedef struct Governor{
+	double budget;	// seconds of simulation work per frame
+	FILE* log;	// every decision is written here
+	int gpu;	// phases are timed with gpu timer queries instead of the wall clock
+
+	unsigned int queries[GOVERNOR_QUERY_RING][GOVERNOR_PHASES];	// GL_TIME_ELAPSED queries of the last steps
+	int queryUsed[GOVERNOR_QUERY_RING][GOVERNOR_PHASES];	// query was issued and its result is not collected yet
+	int queryHead;	// slot of the current step
+	int finish;	// the timer queries do not measure: phases are timed with the wall clock after glFinish
+	double frameStart;	// wall clock at the last update
+	double wallTime;	// wall clock of the first frames, to check the timer queries against
+	double phaseStart;	// wall clock at beginPhase
+	double phaseTime[GOVERNOR_PHASES];	// seconds measured since the last frame
+	double averageTime[GOVERNOR_PHASES];	// smoothed seconds per frame
+	long frame;
+	int settle;	// frames until the next decision
+	int saturated;	// nothing left to shed, logged once
+
+	int stepsPerFrame;	// at most the steps per frame setting
+	int blurStep;	// 1: every blur tap, 2: every other tap (half resolution)
+	float activeFraction;	// part of the agent blocks that move
+	double fullDiffuseTime;	// diffuse time per frame before the blur was halved
+}Governor;
+
+// budget in seconds per frame, gpu: time phases with timer queries (needs a current OpenGL context)
+void initGovernor(Governor* governor, double budget, FILE* log, int gpu);
+
+void destroyGovernor(Governor* governor);
+
+// Phases of a step are measured between beginPhase and endPhase, one at a time; GOVERNOR_AGENTS starts a new step
+void beginPhase(Governor* governor, int phase);
+
+void endPhase(Governor* governor, int phase);
+
+// After every frame: add up the measured phases and adjust the quality (maxSteps = steps per frame setting)
+void updateGovernor(Governor* governor, int maxSteps, int blurRadius);
+
+// Agent blocks with (hash(id / ACTIVE_BLOCK) >> 16) < threshold move, 65536: all
+unsigned int getActiveThreshold(const Governor* governor);
+
+#endif
@@ -0,0 +1,106 @@
+#include "headless.h"
+
+/*
+https://www.khronos.org/registry/EGL/extensions/MESA/EGL_MESA_platform_surfaceless.txt
+https://developer.nvidia.com/blog/egl-eye-opengl-visualization-without-x-server/	(EGL without X server)
+*/
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLSurface surface = EGL_NO_SURFACE;
+
+// Prefer the surfaceless platform (no X11 / Wayland needed), otherwise use the default display
+static EGLDisplay getHeadlessDisplay(void){
+	const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	
+	if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless")){
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay){
+			EGLDisplay dpy = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (dpy != EGL_NO_DISPLAY) return dpy;
+		}
+	}
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+int createHeadlessContext(void){
+	display = getHeadlessDisplay();
+	
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)){
+		printf("Failed to initialize EGL (0x%x)\n", eglGetError());
+		return -1;
+	}
+	
+	if (!eglBindAPI(EGL_OPENGL_API)){
+		printf("EGL has no desktop OpenGL support\n");
+		destroyHeadlessContext();
+		return -1;
+	}
+	
+	EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = NULL;
+	EGLint numConfigs = 0;
+	eglChooseConfig(display, configAttribs, &config, 1, &numConfigs);
+	
+	// We want OpenGL 4.3 (necessary for compute shaders and image load / store)
+	EGLint contextAttribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	
+	const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+	int surfaceless = extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+	int configless = extensions && strstr(extensions, "EGL_KHR_no_config_context");
+	
+	if (numConfigs == 0 && !(surfaceless && configless)){
+		printf("No suitable EGL config found\n");
+		destroyHeadlessContext();
+		return -1;
+	}
+	
+	context = eglCreateContext(display, numConfigs ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttribs);
+	if (context == EGL_NO_CONTEXT){
+		printf("Failed to create OpenGL 4.3 context (0x%x)\n", eglGetError());
+		destroyHeadlessContext();
+		return -1;
+	}
+	
+	// We never draw to the default framebuffer, so a 1x1 pbuffer is enough when surfaceless contexts are not supported
+	if (!surfaceless){
+		EGLint pbufferAttribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+		surface = eglCreatePbufferSurface(display, config, pbufferAttribs);
+		if (surface == EGL_NO_SURFACE){
+			printf("Failed to create EGL pbuffer (0x%x)\n", eglGetError());
+			destroyHeadlessContext();
+			return -1;
+		}
+	}
+	
+	if (!eglMakeCurrent(display, surface, surface, context)){
+		printf("Failed to make EGL context current (0x%x)\n", eglGetError());
+		destroyHeadlessContext();
+		return -1;
+	}
+	
+	return 0;
+}
+
+void destroyHeadlessContext(void){
+	if (display == EGL_NO_DISPLAY) return;
+	
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+	if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+	eglTerminate(display);
+	
+	display = EGL_NO_DISPLAY;
+	context = EGL_NO_CONTEXT;
+	surface = EGL_NO_SURFACE;
+}
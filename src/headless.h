@@ -0,0 +1,15 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+// Create an OpenGL 4.3 core context without a window or display server (EGL surfaceless, falls back to a pbuffer)
+int createHeadlessContext(void);
+
+void destroyHeadlessContext(void);
+
+#endif
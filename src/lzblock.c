@@ -0,0 +1,142 @@
+#include "lzblock.h"
+
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 16
+#define LZ_MAX_OFFSET 65535
+// End of a block (format rules): the last 5 bytes are literals, the last match starts at least 12 bytes before the end
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+
+static uint32_t read32(const uint8_t* p){
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint64_t read64(const uint8_t* p){
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static uint32_t hashSequence(uint32_t sequence){
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+size_t lzCompressBound(size_t size){
+	return size + size / 255 + 16;
+}
+
+// Lengths from 15 on continue in bytes of 255 and one smaller byte
+static uint8_t* writeLength(uint8_t* out, size_t length){
+	while (length >= 255){
+		*out++ = 255;
+		length -= 255;
+	}
+	*out++ = (uint8_t)length;
+	return out;
+}
+
+// Token, literals and (unless matchLength is 0: the last sequence) offset and match length
+static uint8_t* writeSequence(uint8_t* out, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength){
+	uint8_t* token = out++;
+	*token = (uint8_t)((literalLength < 15 ? literalLength : 15) << 4);
+	if (literalLength >= 15) out = writeLength(out, literalLength - 15);
+	memcpy(out, literals, literalLength);
+	out += literalLength;
+	if (matchLength == 0) return out;
+
+	*out++ = (uint8_t)(offset & 255);
+	*out++ = (uint8_t)(offset >> 8);
+	size_t length = matchLength - LZ_MIN_MATCH;
+	*token |= (uint8_t)(length < 15 ? length : 15);
+	if (length >= 15) out = writeLength(out, length - 15);
+	return out;
+}
+
+size_t lzCompress(const uint8_t* in, size_t size, uint8_t* out){
+	const uint8_t* anchor = in;	// start of the literals that are not written yet
+	uint8_t* start = out;
+	if (size > LZ_MATCH_LIMIT){
+		// Positions of the last sequence with each hash (garbage is fine: a candidate is only used if its bytes match)
+		uint32_t* table = calloc((size_t)1 << LZ_HASH_BITS, sizeof(uint32_t));
+		const uint8_t* matchStartLimit = in + size - LZ_MATCH_LIMIT;
+		const uint8_t* matchEndLimit = in + size - LZ_LAST_LITERALS;
+		const uint8_t* position = in;
+		while (position < matchStartLimit){
+			uint32_t sequence = read32(position);
+			uint32_t* entry = &table[hashSequence(sequence)];
+			const uint8_t* candidate = in + *entry;
+			*entry = (uint32_t)(position - in);
+			if (candidate >= position || position - candidate > LZ_MAX_OFFSET || read32(candidate) != sequence){
+				// Step faster through data that does not compress
+				position += 1 + ((position - anchor) >> 6);
+				continue;
+			}
+
+			// 8 bytes at a time through long runs (empty trailMap)
+			const uint8_t* end = position + LZ_MIN_MATCH, *reference = candidate + LZ_MIN_MATCH;
+			while (end + 8 <= matchEndLimit && read64(end) == read64(reference)){
+				end += 8;
+				reference += 8;
+			}
+			while (end < matchEndLimit && *end == *reference){
+				end++;
+				reference++;
+			}
+			out = writeSequence(out, anchor, position - anchor, position - candidate, end - position);
+			position = end;
+			anchor = end;
+		}
+		free(table);
+	}
+	out = writeSequence(out, anchor, in + size - anchor, 0, 0);
+	return out - start;
+}
+
+// Length continued in bytes of 255, 0 if in ends first
+static int readLength(const uint8_t** in, const uint8_t* end, size_t* length){
+	uint8_t byte;
+	do{
+		if (*in >= end) return 0;
+		byte = *(*in)++;
+		*length += byte;
+	}while (byte == 255);
+	return 1;
+}
+
+size_t lzDecompress(const uint8_t* in, size_t size, uint8_t* out, size_t capacity){
+	const uint8_t* end = in + size;
+	uint8_t* position = out, *outEnd = out + capacity;
+	while (in < end){
+		uint8_t token = *in++;
+		size_t literals = token >> 4;
+		if (literals == 15 && !readLength(&in, end, &literals)) return 0;
+		if (literals > (size_t)(end - in) || literals > (size_t)(outEnd - position)) return 0;
+		memcpy(position, in, literals);
+		position += literals;
+		in += literals;
+		if (in == end) break;	// the last sequence has no match
+
+		if (end - in < 2) return 0;
+		size_t offset = in[0] | (size_t)in[1] << 8;
+		in += 2;
+		size_t length = token & 15;
+		if (length == 15 && !readLength(&in, end, &length)) return 0;
+		length += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(position - out) || length > (size_t)(outEnd - position)) return 0;
+
+		// Overlapping matches repeat the last offset bytes: copy in pieces that do not overlap,
+		// every piece doubles the repeated bytes (runs of zeros are offset 1)
+		const uint8_t* source = position - offset;
+		while (length > 0){
+			size_t piece = length < (size_t)(position - source) ? length : (size_t)(position - source);
+			memcpy(position, source, piece);
+			position += piece;
+			length -= piece;
+		}
+	}
+	return position - out;
+}
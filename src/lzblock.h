@@ -0,0 +1,23 @@
+#ifndef LZBLOCK_H
+#define LZBLOCK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+Byte oriented LZ77 in the LZ4 block format: fast enough to compress every step on a background thread
+and to decode recordings faster than they were simulated, no dependency.
+https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+*/
+
+// Bytes lzCompress may write for size input bytes
+size_t lzCompressBound(size_t size);
+
+// Compress size bytes of in into out (lzCompressBound(size) bytes), returns the compressed size
+size_t lzCompress(const uint8_t* in, size_t size, uint8_t* out);
+
+// Decompress size bytes of in into out, returns the decompressed size, 0 if in is corrupt or needs more than capacity bytes
+size_t lzDecompress(const uint8_t* in, size_t size, uint8_t* out, size_t capacity);
+
+#endif
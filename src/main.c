@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include <math.h>
+#include <string.h>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -13,44 +14,22 @@
 	#include <ncurses.h>
 #endif
 
+#include "settings.h"
 #include "sfd.h" // library to open file explorer (link comdlg32 when compiling on windows)
-#include "shader.h"
+#include "physarum.h"
+#include "framering.h"
+#include "recording.h"
+#include "analytics.h"
+#include "headless.h"
+#include "domain.h"
+#include "numa.h"
+#include "autotune.h"
+#include "control.h"
 
 #define WIDTH 1080
 #define HEIGHT 720
-#define COLUMNS 1080	// WIDTH / COLUMNS has to be an Integer
-#define ROWS 720	// HEIGHT / ROWS has to be an Integer
-
-
-typedef enum Mode{
-	CENTER, CIRCLE, RING, RANDOM, ICIRCLE
-}Mode;
-
-typedef struct Agent{
-	float x, y, angle;
-	int speciesIdx; // 3 species supported --> 0, 1, 2
-}Agent;
-
-typedef struct SpeciesSettings{
-	Mode spawnMode;
-	float sensorSize, 
-		sensorOffsetDistance, 
-		sensorAngle, 
-		turnSpeed, 
-		moveSpeed,
-		r, g, b;
-}Species;
-
-typedef struct SimulationSettings{
-	float agents, 
-		s1inp, s2inp, s3inp,	// s1inp = species 1 in percent
-		fps, fpsoff,
-		avoid, 
-		blurRadius,
-		trailWeight, 
-		diffuseWeight, 
-		decayRate;
-}Simulation;
+#define COLUMNS PHYSARUM_COLUMNS	// WIDTH / COLUMNS has to be an Integer
+#define ROWS PHYSARUM_ROWS	// HEIGHT / ROWS has to be an Integer
 
 typedef struct Setting{
 	char* name;
@@ -64,19 +43,17 @@ sfd_Options opt = {
     .filter = "*.txt|*"
 };
 
-// Set default settings for the species
-Species speciesSettings[] = {
-	(Species){.spawnMode = CENTER, .sensorSize = 1., .sensorOffsetDistance = 13., .sensorAngle = 22, .turnSpeed = 0.125, .moveSpeed = 1.0, .r = 1., .g = 0., .b = 0.}, 
-	(Species){.spawnMode = ICIRCLE, .sensorSize = 1., .sensorOffsetDistance = 42., .sensorAngle = 22, .turnSpeed = 0.125, .moveSpeed = .8, .r = 0., .g = 1., .b = 0.},
-	(Species){.spawnMode = ICIRCLE, .sensorSize = 1., .sensorOffsetDistance = 4., .sensorAngle = 22, .turnSpeed = 0.125, .moveSpeed = 1., .r = 0., .g = 0., .b = 1.}
+// Set default settings for the species (species 4 to MAX_SPECIES are set in initSpeciesSettings)
+Species speciesSettings[MAX_SPECIES] = {
+	(Species){.spawnMode = CENTER, .sensorSize = 1., .sensorOffsetDistance = 13., .sensorAngle = 22, .turnSpeed = 0.125, .moveSpeed = 1.0, .r = 1., .g = 0., .b = 0., .percent = 100}, 
+	(Species){.spawnMode = ICIRCLE, .sensorSize = 1., .sensorOffsetDistance = 42., .sensorAngle = 22, .turnSpeed = 0.125, .moveSpeed = .8, .r = 0., .g = 1., .b = 0., .percent = 0},
+	(Species){.spawnMode = ICIRCLE, .sensorSize = 1., .sensorOffsetDistance = 4., .sensorAngle = 22, .turnSpeed = 0.125, .moveSpeed = 1., .r = 0., .g = 0., .b = 1., .percent = 0}
 };
 
 // Set default settings for simulation
 Simulation simulationSettings = {
 	.agents = 25000,
-	.s1inp = 100,
-	.s2inp = 0,
-	.s3inp = 0,
+	.species = 3,
 	.fps = 120,
 	.fpsoff = 0,
 	.avoid = 1,
@@ -86,12 +63,17 @@ Simulation simulationSettings = {
 	.decayRate = 0.01
 };
 
+// Worker threads of the cpu simulation (--cpu), a property of the machine and not saved with the settings
+float cpuThreads = 1;
+// Steps simulated per drawn frame, the governor may run fewer, not saved either
+float stepsPerFrame = 1;
+
 // Give each setting thats being displayed a name, min, max and step value
 Setting speciesSettingsTable[] = {
 	(Setting){
 		.name = "Species",
 		.min = 0, 
-		.max = 2,
+		.max = 2,	// number of species - 1
 		.step = 1
 	},
 	(Setting){
@@ -147,6 +129,12 @@ Setting speciesSettingsTable[] = {
 		.min = 0, 
 		.max = 1,
 		.step = 0.01
+	},
+	(Setting){
+		.name = "Species %",
+		.min = 0, 
+		.max = 100,
+		.step = 1
 	}
 };
 
@@ -159,25 +147,11 @@ Setting simulationSettingsTable[] = {
 		.valuePtr = &simulationSettings.agents
 	},
 	(Setting){
-		.name = "Species 1 %",
-		.min = 0, 
-		.max = 100,
-		.step = 1,
-		.valuePtr = &simulationSettings.s1inp
-	},
-	(Setting){
-		.name = "Species 2 %",
-		.min = 0, 
-		.max = 100,
-		.step = 1,
-		.valuePtr = &simulationSettings.s2inp
-	},
-	(Setting){
-		.name = "Species 3 %",
-		.min = 0, 
-		.max = 100,
+		.name = "Species",
+		.min = 1, 
+		.max = MAX_SPECIES,
 		.step = 1,
-		.valuePtr = &simulationSettings.s3inp
+		.valuePtr = &simulationSettings.species
 	},
 	(Setting){
 		.name = "FPS",
@@ -227,9 +201,41 @@ Setting simulationSettingsTable[] = {
 		.max = 1,
 		.step = 0.001,
 		.valuePtr = &simulationSettings.decayRate
+	},
+	(Setting){
+		.name = "Threads",
+		.min = 1, 
+		.max = 64,	// number of cpus
+		.step = 1,
+		.valuePtr = &cpuThreads
+	},
+	(Setting){
+		.name = "Steps / Frame",
+		.min = 1, 
+		.max = 16,
+		.step = 1,
+		.valuePtr = &stepsPerFrame
 	}
 };
 
+// Settings of simulationSettingsTable that are written to settings files
+#define SAVED_SIMULATION_SETTINGS 9
+
+// give the species without default settings the settings of the first three species and their own color
+void initSpeciesSettings(){
+	int s;
+	for (s = 3; s < MAX_SPECIES; s++){
+		speciesSettings[s] = speciesSettings[s % 3];
+		speciesSettings[s].percent = 0;
+		
+		// Evenly spaced hues
+		float hue = s * 6.f / MAX_SPECIES;
+		speciesSettings[s].r = fminf(1.f, fmaxf(0.f, fabsf(hue - 3.f) - 1.f));
+		speciesSettings[s].g = fminf(1.f, fmaxf(0.f, 2.f - fabsf(hue - 2.f)));
+		speciesSettings[s].b = fminf(1.f, fmaxf(0.f, 2.f - fabsf(hue - 4.f)));
+	}
+}
+
 // Keep track of current Species thats being edited
 float speciesIdx = 0;
 // Keep track of current Settings Table
@@ -258,6 +264,8 @@ float* getSpeciesSetting(int idx){
 		break;
 		case 9:	return &(speciesSettings[(int)speciesIdx].b);
 		break;
+		case 10: return &(speciesSettings[(int)speciesIdx].percent);
+		break;
         default: return NULL;
         break;
 	}
@@ -316,28 +324,97 @@ void display(int oldOption, int newOption, int startX, int startY){
     refresh();
 }
 
+// first line of settings files, files without it are from the version with 3 fixed species
+#define SETTINGS_HEADER "# physarum settings"
+
+// save all settings to textfile at path
+int saveSettingsFile(const char* filename){
+    FILE* fptr = fopen(filename, "w");
+    if (fptr == NULL){
+        return -1;
+    }
+    
+    fprintf(fptr, "%s\n", SETTINGS_HEADER);
+    
+    size_t i, j;
+    for (i = 0; i < SAVED_SIMULATION_SETTINGS; i++){
+        fprintf(fptr, "%f\n", *simulationSettingsTable[i].valuePtr);
+    }
+    
+    float tempSpeciesIdx = speciesIdx;
+    for (j = 0; j < simulationSettings.species; j++){
+        speciesIdx = (float)j;
+        for (i = 1; i < sizeof(speciesSettingsTable) / sizeof(Setting); i++){ 
+            fprintf(fptr, "%f\n", *getSpeciesSetting(i));
+        }
+    }
+    speciesIdx = tempSpeciesIdx;
+    fclose(fptr);
+    return 0;
+}
+
 // save all settings in a text file
 // use sfd library to open file explorer
 void saveSettings(){
     const char *filename = sfd_save_dialog(&opt);
     
     if (filename){
-        FILE* fptr = fopen(filename, "w");
-        
-        float tempSpeciesIdx = speciesIdx;
-        size_t i, j;
+        saveSettingsFile(filename);
+    }
+}
+
+// read the next line of a settings file as float
+float readSetting(FILE* fptr){
+    char str[32];
+    if (fgets(str, sizeof(str), fptr) == NULL){
+        return 0;
+    }
+    return atof(str);
+}
+
+// load all settings from textfile at path
+int loadSettingsFile(const char* filename){
+    FILE* fptr = fopen(filename, "r");
+    if (fptr == NULL){
+        return -1;
+    }
+    char str[32];
+    
+    float tempSpeciesIdx = speciesIdx;
+    size_t i, j;
+    if (fgets(str, sizeof(str), fptr) && strncmp(str, SETTINGS_HEADER, strlen(SETTINGS_HEADER)) == 0){
+        // Simulation settings first, they contain the number of species that follow
+        for (i = 0; i < SAVED_SIMULATION_SETTINGS; i++){
+            *simulationSettingsTable[i].valuePtr = readSetting(fptr);
+        }
+        simulationSettings.species = fminf(MAX_SPECIES, fmaxf(1, simulationSettings.species));
+        for (j = 0; j < simulationSettings.species; j++){
+            speciesIdx = (float)j;
+            for (i = 1; i < sizeof(speciesSettingsTable) / sizeof(Setting); i++){
+                *getSpeciesSetting(i) = readSetting(fptr);
+            }
+        }
+    }else{
+        // Old format: spawn mode to blue value of 3 species, agents, 3 percentages, fps to decay rate
+        rewind(fptr);
         for (j = 0; j < 3; j++){
             speciesIdx = (float)j;
-            for (i = 1; i < sizeof(speciesSettingsTable) / sizeof(Setting); i++){ 
-                fprintf(fptr, "%f\n", *getSpeciesSetting(i));
+            for (i = 1; i <= 9; i++){
+                *getSpeciesSetting(i) = readSetting(fptr);
             }
         }
-        for (i = 0; i < sizeof(simulationSettingsTable) / sizeof(Setting); i++){
-            fprintf(fptr, "%f\n", *simulationSettingsTable[i].valuePtr);
+        simulationSettings.agents = readSetting(fptr);
+        for (j = 0; j < 3; j++){
+            speciesSettings[j].percent = readSetting(fptr);
+        }
+        simulationSettings.species = 3;
+        for (i = 2; i < SAVED_SIMULATION_SETTINGS; i++){
+            *simulationSettingsTable[i].valuePtr = readSetting(fptr);
         }
-        speciesIdx = tempSpeciesIdx;
-        fclose(fptr);
     }
+    speciesIdx = tempSpeciesIdx;
+    fclose(fptr);
+    return 0;
 }
 
 // load all settings from textfile
@@ -346,285 +423,145 @@ void loadSettings(){
     const char* filename = sfd_open_dialog(&opt);
     
     if (filename){
-        FILE* fptr = fopen(filename, "r");
-        char str[16];
-        
-        float tempSpeciesIdx = speciesIdx;
-        size_t i, j;
-        for (j = 0; j < 3; j++){
-            speciesIdx = (float)j;
-            for (i = 1; i < sizeof(speciesSettingsTable) / sizeof(Setting); i++){
-                fgets(str, 16, fptr);
-                *getSpeciesSetting(i) = atof(str);
-            }
-        }
-        for (i = 0; i < sizeof(simulationSettingsTable) / sizeof(Setting); i++){
-            fgets(str, 16, fptr);
-            *simulationSettingsTable[i].valuePtr = atof(str);
-        }
-        speciesIdx = tempSpeciesIdx;
-        fclose(fptr);
+        loadSettingsFile(filename);
     }
 }
 
-// give agents a x, y and angle value based on spawnMode
-unsigned int initAgents(){
-	Agent* agents = (Agent*)malloc(simulationSettings.agents * sizeof(Agent));
-	
-	srand(time(NULL));
-	
-	// Spawn variables
-	int radius = ROWS / 2;
-	int center[] = {COLUMNS / 2, ROWS / 2};
-	float x, y, alpha;
-	Mode spawnMode = 0;
-
-	int a;
-	for (a = 0; a < simulationSettings.agents; a++){
-		if (a < simulationSettings.agents * (simulationSettings.s1inp / 100.)){
-			spawnMode = (int)*(float*)&(speciesSettings[0].spawnMode);
-			agents[a].speciesIdx = 0;
-		}else if (a < simulationSettings.agents * ((simulationSettings.s2inp + simulationSettings.s1inp) / 100.)){
-			spawnMode = (int)*(float*)&(speciesSettings[1].spawnMode);
-			agents[a].speciesIdx = 1;
-		}else if (a < simulationSettings.agents * ((simulationSettings.s3inp + simulationSettings.s1inp + simulationSettings.s2inp) / 100.)){
-			spawnMode = (int)*(float*)&(speciesSettings[2].spawnMode);
-			agents[a].speciesIdx = 2;
-		}
-		
-		switch (spawnMode){
-			case CENTER: 
-				agents[a].x = COLUMNS * 0.5;
-				agents[a].y = ROWS * 0.5;
-				agents[a].angle = ((float)rand() / (float)RAND_MAX) * 2 * M_PI;
-			break;
-			case RING:
-				alpha = ((float)rand() / (float)RAND_MAX) * 2 * M_PI;
-				x = center[0] + cos(alpha) * radius;
-				y = center[1] + sin(alpha) * radius;
-				
-				agents[a].x = x;
-				agents[a].y = y;
-				agents[a].angle = atan2((double)(center[1] - y), (double)(center[0] - x));	// Angle pointing to the center
-			break;
-			case ICIRCLE:
-				while (1){	// Repeat until the point is in the circle
-					x = (rand() % (2 * radius)) + (center[0] - radius);
-					y = (rand() % (2 * radius)) + (center[1] - radius);
-					
-					if ((x - center[0]) * (x - center[0]) + (y - center[1]) * (y - center[1]) <= radius * radius){
-						agents[a].x = x;
-						agents[a].y = y;
-						agents[a].angle = atan2((double)(center[1] - y), (double)(center[0] - x));	// Angle pointing to the center
-						break;
-					}
-				}
-			break;
-			case CIRCLE:
-				while (1){	// Repeat until the point is in the circle
-					x = (rand() % (2 * radius)) + (center[0] - radius);
-					y = (rand() % (2 * radius)) + (center[1] - radius);
-					
-					if ((x - center[0]) * (x - center[0]) + (y - center[1]) * (y - center[1]) <= radius * radius){
-						agents[a].x = x;
-						agents[a].y = y;
-						agents[a].angle = ((float)rand() / (float)RAND_MAX) * 2 * M_PI;	// Random angle
-						break;
-					}
-				}
-			break;
-			case RANDOM:
-				agents[a].x = rand() % COLUMNS;
-				agents[a].y = rand() % ROWS;
-				agents[a].angle = ((float)rand() / (float)RAND_MAX) * 2 * M_PI;
-			break;
-		}
-	}
+// Where every step goes: a recording and / or a shared memory ring for other processes
+typedef struct FrameOutputs{
+	FILE* record;	// raw float32
+	Recorder* recorder;	// delta compressed
+	FrameRing* ring;
+}FrameOutputs;
 
-	// Create SSBO (Shader Storage Buffer Object) for agents
-	unsigned int agentsSSBO;
-	glGenBuffers(1, &agentsSSBO);
-	
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, agentsSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, simulationSettings.agents * sizeof(Agent), agents, GL_STATIC_DRAW);
-	// "layout(binding = 2)"
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, agentsSSBO);
-	
-	// Free Memory
-	free(agents);
-	
-	return agentsSSBO;
+// FrameCallback that hands a frame to all outputs
+void writeFrameOutputs(const float* pixels, int width, int height, int channels, long frame, void* userData){
+	FrameOutputs* outputs = (FrameOutputs*)userData;
+	if (outputs->record){
+		writeFrame(pixels, width, height, channels, frame, outputs->record);
+	}
+	if (outputs->recorder){
+		recordFrame(pixels, width, height, channels, frame, outputs->recorder);
+	}
+	if (outputs->ring){
+		publishFrame(pixels, width, height, channels, frame, outputs->ring);
+	}
 }
 
-// load species settings into shader
-void updateSpeciesSettings(unsigned int speciesSettingsSSBO){
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, speciesSettingsSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(speciesSettings), speciesSettings, GL_STATIC_DRAW);
-}
+// Network metrics of the trailMap every few steps (--analytics), NULL if off
+Analytics* analytics = NULL;
 
-// loas simulation settings into shader
-void updateSimulationSettings(unsigned int simulationSettingsSSBO){
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, simulationSettingsSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(simulationSettings), &simulationSettings, GL_STATIC_DRAW);
+// Analyze the trailMap if the next analysis is due, steps: steps done since the start
+void updateAnalytics(Physarum* physarum, long steps){
+	if (analytics == NULL || steps < analytics->nextStep) return;
+	
+	PhysarumInfo info;
+	physarumGetInfo(physarum, &info);
+	PhysarumTrailLayout layout;
+	// Waits for the last step on the gpu
+	const float* trailMap = physarumMapTrailMap(physarum, &layout);
+	if (trailMap){
+		analyzeTrailMap(analytics, trailMap, &layout, info.speciesCount, steps);
+	}
+	physarumUnmapTrailMap(physarum);
 }
 
-// reset simulation with current settings
-void reset(unsigned int agentsSSBO, unsigned int trailMapTexture){
-    // Reset agents
-    glDeleteBuffers(1, &agentsSSBO);
-	agentsSSBO = initAgents();
-
-	// Reset trailMap
-	float* trailMap = calloc(COLUMNS * ROWS * 3, sizeof(float));
-	glBindTexture(GL_TEXTURE_2D, trailMapTexture); 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, COLUMNS, ROWS, 0, GL_RGB, GL_FLOAT, trailMap);
-	free(trailMap);
-}
+// Control and telemetry socket (--control), NULL if off
+ControlServer* control = NULL;
 
+// wall clock in seconds (glfwGetTime is not available without a window)
+double getTime(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-int main(int argc, char* argv[]) {
-	// Check user input
-	if (simulationSettings.s1inp + simulationSettings.s2inp + simulationSettings.s3inp > 100.0){
-		printf("Species percentages are bigger then 100.\n");
-		return -1;
+// run a fixed number of steps without window / tui and report the timing
+int runHeadless(Physarum* physarum, int steps){
+	PhysarumInfo info;
+	physarumGetInfo(physarum, &info);
+	printf("Renderer: %s (%s)\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+	printf("Running %d steps with %d agents on a %dx%d trailMap\n", steps, (int)simulationSettings.agents, COLUMNS, ROWS);
+	// Every step reads and writes every agent once
+	printf("Agents: %d bytes each, %.1f MB buffer, %.1f MB agent traffic per step\n", info.agentSize, 
+		info.agentCount * (double)info.agentSize / (1 << 20), 2. * info.agentCount * info.agentSize / (1 << 20));
+	printf("Work sizes: gpu %d agents / workgroup, %dx%d diffuse tiles; cpu %d agents / chunk, %d bands / diffuse chunk\n",
+		info.agentGroup, info.diffuseTile, info.diffuseTile, info.agentChunk, info.diffuseBands);
+	if (info.tuned == 1){
+		printf("Autotune: %.2f ms / step with the sizes above, %s %s\n", info.tunedStepTime * 1000., info.tunedPath[0] ? "cached in" : "not cached", info.tunedPath);
 	}
-	
-	/*----------------------------------*/
-	
-	/*
-	http://www.opengl-tutorial.org/beginners-tutorials/tutorial-1-opening-a-window/	(Create window using glfw, glew)
-	*/
-    // Initialize GLFW
-	if(!glfwInit())
-	{
-		printf("Failed to initialize GLFW\n");
-		return -1;
+	if (info.diffuseScale > 1){
+		printf("Diffuse: blur at 1 / %d resolution with radius %d, upsampled\n", info.diffuseScale, info.levelRadius);
 	}
 	
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); // We want OpenGL 4.3 (necessary for image load / store)
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);	
-	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // We don't want the old OpenGL 
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);	// Make window not resizable
-
-	// Open a window and create its OpenGL context
-	GLFWwindow* window; 
-	window = glfwCreateWindow(WIDTH, HEIGHT, "Physarum", NULL, NULL);
-	if(window == NULL){
-		printf("Failed to open GLFW window.\n");
-		glfwTerminate();
-		return -1;
-	}
-	glfwMakeContextCurrent(window); 
+	// Make sure setup work is not part of the measurement
+	physarumFlush(physarum);
+	long faults = info.pageFaults;
+	double start = getTime();
 	
-	// Initialize GLEW
-	if (glewInit() != GLEW_OK) {
-		printf("Failed to initialize GLEW\n");
-		return -1;
+	// Frames of stepsPerFrame steps, the last frame may run over (with --control and --steps 0 until a client sends quit)
+	int s, frameSteps;
+	double frameStart = start;
+	for (s = 0; s < steps || (steps == 0 && control);){
+		frameSteps = physarumStepFrame(physarum, (int)stepsPerFrame);
+		s += frameSteps;
+		updateAnalytics(physarum, s);
+		if (control){
+			// From frame to frame, the gpu catches up when the queue is full
+			double now = getTime();
+			publishTelemetry(control, physarum, frameSteps, now - frameStart);
+			frameStart = now;
+			if (pollControl(control, physarum) & CONTROL_QUIT) break;
+		}
 	}
+	physarumFlush(physarum);
 	
-	/*----------------------------------*/
-	
-	// Create Normal shader with function from shader.c
-	unsigned int shaderProgram = createShader("./src/shader/vertexShader.glsl", "./src/shader/fragmentShader.glsl");
-	
-	// Create Compute shader with function from shader.c
-	unsigned int computeProgram = createComputeShader("./src/shader/computeShader.glsl");
-	
-	// Create shader variable
-	int uniformWindowSize = glGetUniformLocation(shaderProgram, "windowSize");
-	int uniformTime = glGetUniformLocation(computeProgram, "time");
-	
-	/*----------------------------------*/
-	
-	float vertices[] = {
-		// positions
-		1.0f,  1.0f, 0.0f,	// top right
-		1.0f, -1.0f, 0.0f,  // bottom right
-	   -1.0f, -1.0f, 0.0f,  // bottom left
-	   -1.0f,  1.0f, 0.0f, 	// top left 
-	};  
-	
-	unsigned int indices[] = {  // start from 0
-		0, 1, 3,   // first triangle
-		1, 2, 3    // second triangle
-	}; 
-	
-	unsigned int VBO, VAO, EBO;
-	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
-	
-	// Bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
-	glBindVertexArray(VAO);
-	
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-	
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-	
-	// Position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-	
-	/*----------------------------------*/
-	
-	// Create textures
-	unsigned int trailMapTexture;
-	// 3: RGB(A)
-	float* trailMap = calloc(COLUMNS * ROWS * 3, sizeof(float));
-	
-	// trailMapTexture
-	glGenTextures(1, &trailMapTexture);
-	glBindTexture(GL_TEXTURE_2D, trailMapTexture); 
-	
-	// s = x, t = y when using textures
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	
-	// Set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		
-    // GL_RGB: our image has R, G and B values; GL_RGBA32F: Our R, G and B values are interpreted in this format
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, COLUMNS, ROWS, 0, GL_RGB, GL_FLOAT, trailMap);
-	
-	// Free Memory
-	free(trailMap);
-	
-	// Unbind
-    glBindTexture(GL_TEXTURE_2D, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
-	
-	/*----------------------------------*/
-	
-	// Spawn agents and create SSBO (returns SSBO so we can delete it later)
-	unsigned int agentsSSBO = initAgents();
-	
-	// Create SSBO for species settings
-	unsigned int speciesSettingsSSBO;
-	glGenBuffers(1, &speciesSettingsSSBO);
-	
-	// Set settings
-	updateSpeciesSettings(speciesSettingsSSBO);
-	
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, speciesSettingsSSBO);
+	double elapsed = getTime() - start;
+	steps = s;
+	printf("Time: %.3f s, %.3f ms / step, %.1f steps / s\n", elapsed, elapsed * 1000. / fmax(1, steps), steps / elapsed);
+	physarumGetInfo(physarum, &info);
+	if (info.governed){
+		printf("Governor: %d steps / frame, blur %s resolution, %.1f %% active agents\n", info.stepsPerFrame < (int)stepsPerFrame ? info.stepsPerFrame : (int)stepsPerFrame,
+			info.blurStep == 1 ? "full" : "half", info.activeFraction * 100.);
+	}
 	
-	// Create SSBO for simulation settings
-	unsigned int simulationSettingsSSBO;
-	glGenBuffers(1, &simulationSettingsSSBO);
+	long runFaults = info.pageFaults - faults;
 	
-	// Set settings
-	updateSimulationSettings(simulationSettingsSSBO);
+	// Sum up the trailMap of each species so runs can be checked against each other
+	PhysarumTrailLayout layout;
+	const float* trailMap = physarumMapTrailMap(physarum, &layout);
+	size_t pixels = (size_t)layout.width * layout.height;
 	
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, simulationSettingsSSBO);
+	printf("TrailMap sum:");
+	size_t i;
+	int species;
+	for (species = 0; species < info.speciesCount && trailMap; species++){
+		// Layer species / channels, channel species % channels
+		const float* layer = trailMap + (size_t)(species / layout.channels) * pixels * layout.channels;
+		double sum = 0.;
+		for (i = 0; i < pixels; i++){
+			sum += layer[i * layout.channels + species % layout.channels];
+		}
+		printf(" %d = %.3f", species + 1, sum);
+	}
+	printf("\n");
+	physarumUnmapTrailMap(physarum);
 	
-	// Unbind
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	printf("Arena: %zu MB of %s, page faults: %ld before the run, %ld during the run\n", 
+		info.arenaSize >> 20, info.arenaPageKind, faults, runFaults);
 	
-	/*----------------------------------*/
+	// Where the memory of the cpu simulation ended up
+	if (info.trailPages[0] + info.trailPages[1] + info.agentPages[0] + info.agentPages[1] > 0){
+		printf("NUMA nodes: %d, trailMap pages local %.1f %% (%ld remote), agent pages local %.1f %% (%ld remote)\n", getNumaNodeCount(),
+			100. * info.trailPages[0] / fmax(1, info.trailPages[0] + info.trailPages[1]), info.trailPages[1],
+			100. * info.agentPages[0] / fmax(1, info.agentPages[0] + info.agentPages[1]), info.agentPages[1]);
+	}
 	
+	return (glGetError() == GL_NO_ERROR) ? 0 : -1;
+}
+
+// run the simulation in a glfw window, settings are changed with the tui
+int runInteractive(Physarum* physarum, GLFWwindow* window){
 	// init ncurses / pdcurses
 	initscr();		
 	noecho();
@@ -653,6 +590,11 @@ int main(int argc, char* argv[]) {
     float deltaTime = 0.0f;
     float lastFrame = 0.0f;
 	
+	// Steps since the start (for the analytics, resets keep counting)
+	long steps = 0;
+	int frameSteps;
+	double frameStart = glfwGetTime();
+	
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
 	
@@ -724,7 +666,8 @@ int main(int argc, char* argv[]) {
 			break;
             case 10:	// ENTER 
 			case 13:	// ENTER: Reset simulation
-                reset(agentsSSBO, trailMapTexture);
+                physarumSetSettings(physarum, speciesSettings, &simulationSettings);
+                quit = physarumReset(physarum) != 0;
 			break;
             case 83:	// S
             case 115:	// S to save settings
@@ -733,7 +676,8 @@ int main(int argc, char* argv[]) {
             case 76:	// L
             case 108:	// L to load settings
                 loadSettings();
-                reset(agentsSSBO, trailMapTexture);
+                physarumSetSettings(physarum, speciesSettings, &simulationSettings);
+                quit = physarumReset(physarum) != 0;
 				oldOption = -1;
 				newOption = 0;
                 display(oldOption, newOption, startX, startY);
@@ -743,9 +687,27 @@ int main(int argc, char* argv[]) {
 			break;
 		}
 		
-		// Reupload settings
-		updateSpeciesSettings(speciesSettingsSSBO);
-		updateSimulationSettings(simulationSettingsSSBO);
+		// Commands of the control socket, between two steps like the keys
+		if (control){
+			int flags = pollControl(control, physarum);
+			if (flags & CONTROL_CHANGED){
+				oldOption = -1;
+				display(oldOption, newOption, startX, startY);
+			}
+			if (flags & CONTROL_QUIT){
+				quit = 1;
+			}
+		}
+		
+		// Only species in use can be edited
+		speciesSettingsTable[0].max = simulationSettings.species - 1;
+		if (speciesIdx > speciesSettingsTable[0].max){
+			speciesIdx = speciesSettingsTable[0].max;
+		}
+		
+		// Hand the edited settings to the simulation (adds / removes agents on the gpu)
+		physarumSetSettings(physarum, speciesSettings, &simulationSettings);
+		physarumSetThreads(physarum, (int)cpuThreads);
 		
 		/*----------------------------------*/
 		
@@ -763,55 +725,25 @@ int main(int argc, char* argv[]) {
 		
 		/*----------------------------------*/
 		
-		/*
-		Bind our texture to binding point 1. This means we can access it in our shaders using
-		"layout(binding = 1)"
-		and we can both read and write from it. 
-		*/
-		glBindImageTexture(1, trailMapTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
-		
-		// Use Compute Shader to update the agents
-		glUseProgram(computeProgram);
-		// Set shader variable
-		glUniform1i(uniformTime, time(NULL));
-		// Specify number of workgroups: x, y, z --> can be optimized
-		glDispatchCompute(simulationSettings.agents / 16, 1, 1);
-		// If the special value GL_ALL_BARRIER_BITS is specified, all supported barriers for the corresponding command will be inserted.
-		glMemoryBarrier(GL_ALL_BARRIER_BITS);
-
-		// Use shader to draw trailMap
-		glUseProgram(shaderProgram);
-		// Set shader variable
-		glUniform2i(uniformWindowSize, WIDTH, HEIGHT);
-		
-		// Draw two triangles to form a rectangle
+		// Move agents, diffuse and decay (one or more steps, the governor keeps them in the budget)
+		frameSteps = physarumStepFrame(physarum, (int)stepsPerFrame);
+		steps += frameSteps;
+		updateAnalytics(physarum, steps);
+		if (control){
+			publishTelemetry(control, physarum, frameSteps, glfwGetTime() - frameStart);
+			frameStart = glfwGetTime();
+		}
+
+		// Draw the trailMap
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT);
-		
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-		
-		glMemoryBarrier(GL_ALL_BARRIER_BITS);
+		physarumDraw(physarum, WIDTH, HEIGHT);
 		
 		// Swap buffers
 		glfwSwapBuffers(window);
 		
 	}
 	
-	// Clean Up
-	glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
-	glDeleteBuffers(1, &agentsSSBO);
-	glDeleteBuffers(1, &speciesSettingsSSBO);
-	glDeleteBuffers(1, &simulationSettingsSSBO);
-	glDeleteTextures(1, &trailMapTexture);
-	glDeleteProgram(shaderProgram);
-	glDeleteProgram(computeProgram);
-	
-	// glfw: terminate, clearing all previously allocated GLFW resources.
-    glfwTerminate();
-	
 	// Curses cleanup
 	delwin(win);
     endwin();
@@ -819,3 +751,355 @@ int main(int argc, char* argv[]) {
 	return 0;
 }
 
+
+int main(int argc, char* argv[]) {
+	// Defaults for the species that have no settings yet
+	initSpeciesSettings();
+	
+	// Parse command line
+	int headless = 0, steps = 1000;
+	const char* recordPath = NULL;
+	int recordDelta = 0, keyframes = RECORDING_KEYFRAMES;
+	const char* publishName = NULL;
+	int publishFormat = FRAME_RING_RGBA8, publishSlots = FRAME_RING_SLOTS;
+	const char* governorLogPath = NULL;
+	double frameBudget = 0;
+	const char* analyticsPath = NULL;
+	int analyticsInterval = ANALYTICS_INTERVAL;
+	float analyticsLevel = ANALYTICS_LEVEL;
+	int cpu = 0, pipeline = 0, compactAgents = 0, fastTrig = 0, wrap = 0, multiRate = 0, diffusePeriod = 1, diffuseScale = 1, autotune = 1, domains = 0, domainsX = 1, domainsY = 1, gridWidth = COLUMNS, gridHeight = ROWS, rank = -1;
+	const char* peers = NULL;
+	const char* controlPath = NULL;
+	unsigned int seed = 0;
+	int seedGiven = 0;
+	int i;
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--headless") == 0){
+			headless = 1;
+		}else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc){
+			steps = atoi(argv[++i]);
+		}else if (strcmp(argv[i], "--preset") == 0 && i + 1 < argc){
+			if (loadSettingsFile(argv[++i]) != 0){
+				printf("Failed to load preset: %s\n", argv[i]);
+				return -1;
+			}
+		}else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc){
+			recordPath = argv[++i];
+		}else if (strcmp(argv[i], "--record-delta") == 0){
+			recordDelta = 1;
+		}else if (strcmp(argv[i], "--keyframes") == 0 && i + 1 < argc){
+			keyframes = atoi(argv[++i]);
+		}else if (strcmp(argv[i], "--publish") == 0 && i + 1 < argc){
+			publishName = argv[++i];
+		}else if (strcmp(argv[i], "--publish-raw") == 0){
+			publishFormat = FRAME_RING_FLOAT;
+		}else if (strcmp(argv[i], "--publish-slots") == 0 && i + 1 < argc){
+			publishSlots = atoi(argv[++i]);
+		}else if (strcmp(argv[i], "--cpu") == 0){
+			cpu = 1;
+		}else if (strcmp(argv[i], "--pipeline") == 0){
+			pipeline = 1;
+		}else if (strcmp(argv[i], "--domains") == 0 && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &domainsX, &domainsY) == 2 && domainsX > 0 && domainsY > 0){
+			domains = 1;
+			i++;
+		}else if (strcmp(argv[i], "--grid") == 0 && i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &gridWidth, &gridHeight) == 2 && gridWidth > 0 && gridHeight > 0){
+			i++;
+		}else if (strcmp(argv[i], "--rank") == 0 && i + 1 < argc){
+			rank = atoi(argv[++i]);
+		}else if (strcmp(argv[i], "--peers") == 0 && i + 1 < argc){
+			peers = argv[++i];
+		}else if (strcmp(argv[i], "--compact-agents") == 0){
+			compactAgents = 1;
+		}else if (strcmp(argv[i], "--fast-trig") == 0){
+			fastTrig = 1;
+		}else if (strcmp(argv[i], "--wrap") == 0){
+			wrap = 1;
+		}else if (strcmp(argv[i], "--no-autotune") == 0){
+			autotune = 0;
+		}else if (strcmp(argv[i], "--multi-rate") == 0){
+			multiRate = 1;
+		}else if (strcmp(argv[i], "--diffuse-every") == 0 && i + 1 < argc){
+			diffusePeriod = fmaxf(1, atoi(argv[++i]));
+		}else if (strcmp(argv[i], "--diffuse-scale") == 0 && i + 1 < argc){
+			diffuseScale = fminf(MAX_DIFFUSE_SCALE, fmaxf(1, atoi(argv[++i])));
+		}else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc){
+			frameBudget = atof(argv[++i]) / 1000.;
+		}else if (strcmp(argv[i], "--control") == 0 && i + 1 < argc){
+			controlPath = argv[++i];
+		}else if (strcmp(argv[i], "--governor-log") == 0 && i + 1 < argc){
+			governorLogPath = argv[++i];
+		}else if (strcmp(argv[i], "--analytics") == 0 && i + 1 < argc){
+			analyticsPath = argv[++i];
+		}else if (strcmp(argv[i], "--analytics-every") == 0 && i + 1 < argc){
+			analyticsInterval = atoi(argv[++i]);
+		}else if (strcmp(argv[i], "--analytics-level") == 0 && i + 1 < argc){
+			analyticsLevel = atof(argv[++i]);
+		}else if (strcmp(argv[i], "--steps-per-frame") == 0 && i + 1 < argc){
+			stepsPerFrame = fminf(simulationSettingsTable[SAVED_SIMULATION_SETTINGS + 1].max, fmaxf(1, atoi(argv[++i])));
+		}else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+			seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+			seedGiven = 1;
+		}else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+			cpuThreads = fmaxf(1, atoi(argv[++i]));
+		}else{
+			printf("Usage: %s [--headless] [--steps N] [--preset FILE] [--record FILE [--record-delta] [--keyframes N]] [--publish NAME [--publish-raw] [--publish-slots N]] [--seed N] [--compact-agents] [--fast-trig] [--wrap] [--no-autotune] [--multi-rate] [--diffuse-every N] [--diffuse-scale N] [--frame-budget MS [--governor-log FILE]] [--analytics FILE [--analytics-every K] [--analytics-level L]] [--control PATH] [--steps-per-frame N] [--cpu] [--threads N] [--pipeline] [--domains XxY] [--grid WxH] [--rank R --peers LIST]\n", argv[0]);
+			printf("  --headless     run without window / tui (EGL, no display server needed)\n");
+			printf("  --steps N      number of steps to run in headless mode (default 1000)\n");
+			printf("  --preset FILE  load settings from FILE (e.g. Presets/maze.txt)\n");
+			printf("  --record FILE  write every step to FILE (raw float32, %dx%d, one channel per species)\n", COLUMNS, ROWS);
+			printf("  --record-delta  record 8 bit trails, keyframes and tiles that changed, LZ4 compressed on a background thread\n");
+			printf("                 (see recording.h, play back with ./playback)\n");
+			printf("  --keyframes N  frames from one keyframe of --record-delta to the next (default %d), playback seeks to them\n", RECORDING_KEYFRAMES);
+			printf("  --publish NAME  write every step into the POSIX shared memory ring NAME (colors as RGBA8, see framering.h)\n");
+			printf("  --publish-raw  publish one float per species and pixel instead of colors\n");
+			printf("  --publish-slots N  frames in the ring (default %d), a reader has N - 1 steps to use a frame\n", FRAME_RING_SLOTS);
+			printf("  --seed N       seed of the spawn and the random steering, runs with the same seed are the same\n");
+			printf("  --compact-agents  store agents in 8 instead of 16 bytes (fixed point position, 16 bit angle)\n");
+			printf("  --fast-trig    one sin / cos per agent (cpu: a %d entry direction table), sensors rotated by constants per species\n", TRIG_TABLE_SIZE);
+			printf("  --wrap         toroidal world: agents and trails wrap around at the edges (seamless tiles)\n");
+			printf("  --no-autotune  use the default workgroup / chunk sizes instead of the fastest ones for this machine\n");
+			printf("                 (benchmarked on the first run of a device, grid and agent count, cached in ~/.cache/%s)\n", AUTOTUNE_FILE);
+			printf("  --multi-rate   a species k times slower than the fastest one moves k times as far every k-th step (k <= %d)\n", MAX_STEP_PERIOD);
+			printf("  --diffuse-every N  diffuse and decay the trailMap every N steps with the weight and decay of N steps\n");
+			printf("  --diffuse-scale N  blur the trailMap at 1 / N resolution (2: half, 4: quarter, at most %d) and upsample it,\n", MAX_DIFFUSE_SCALE);
+			printf("                 deposits and sensing stay at full resolution, small blur radii use a finer level\n");
+			printf("  --frame-budget MS  hold the simulation work of a frame below MS milliseconds: fewer steps per frame,\n");
+			printf("                 half resolution blur, fewer moving agents, restored when there is headroom\n");
+			printf("  --governor-log FILE  write the decisions of the governor to FILE (default stderr)\n");
+			printf("  --analytics FILE  write coverage, components, territories and the density histogram of the trailMap to FILE\n");
+			printf("                 (CSV, JSON lines if FILE ends with .json, - for stdout)\n");
+			printf("  --analytics-every K  steps from one analysis to the next (default %d)\n", ANALYTICS_INTERVAL);
+			printf("  --analytics-level L  trail above which a pixel belongs to the network (default %.2f)\n", ANALYTICS_LEVEL);
+			printf("  --control PATH  read and write settings, reset, snapshot and subscribe to step timing over the Unix socket PATH\n");
+			printf("                 (one command per line, e.g. set species.0.sensorAngle 30; with --headless --steps 0 runs until quit)\n");
+			printf("  --steps-per-frame N  steps simulated per drawn frame (default 1)\n");
+			printf("  --cpu          simulate on the cpu, OpenGL only draws (with --headless: records / checks)\n");
+			printf("  --threads N    worker threads of the cpu simulation (per process with --domains, default 1)\n");
+			printf("  --pipeline     cpu: overlap agent update, deposit and diffuse of up to %d steps band by band instead of barriers\n", CPU_PIPELINE_STEPS);
+			printf("  --domains XxY  split the trailMap into X * Y regions, one cpu process each (halo exchange over sockets, no OpenGL)\n");
+			printf("  --grid WxH     trailMap size of the cpu simulation (default %dx%d)\n", COLUMNS, ROWS);
+			printf("  --rank R       run only region R (= y * X + x) of --domains, the neighbors are other machines\n");
+			printf("  --peers LIST   host:port of every rank, comma separated (e.g. a:5000,b:5000)\n");
+			return -1;
+		}
+	}
+	
+	// Check user input
+	float percentSum = 0;
+	for (i = 0; i < simulationSettings.species; i++){
+		percentSum += speciesSettings[i].percent;
+	}
+	if (percentSum > 100.0){
+		printf("Species percentages are bigger then 100.\n");
+		return -1;
+	}
+	
+	// Every rank of a simulation spread over several machines needs the same seed (0 if none is given)
+	if (!seedGiven && rank < 0){
+		seed = (unsigned int)time(NULL);
+	}
+	
+	// Workers of the cpu simulation, at most one per cpu
+	simulationSettingsTable[SAVED_SIMULATION_SETTINGS].max = getCpuCount();
+	
+	// Cpu simulation in one or more processes, no OpenGL needed
+	if (domains || rank >= 0){
+		int speciesCounts[MAX_SPECIES];
+		physarumGetSpeciesCounts((int)simulationSettings.agents, (int)simulationSettings.species, speciesSettings, speciesCounts);
+		if (rank < 0){
+			return runLocalDomains(domainsX, domainsY, (int)cpuThreads, compactAgents, fastTrig, wrap, gridWidth, gridHeight, steps, (int)simulationSettings.agents, speciesCounts, seed, speciesSettings, &simulationSettings);
+		}
+		
+		// One region of a simulation spread over several machines
+		if (peers == NULL || rank >= domainsX * domainsY){
+			printf("--rank needs --peers and has to be smaller than the number of domains\n");
+			return -1;
+		}
+		Domain domain;
+		DomainResult result;
+		if (connectDomain(&domain, domainsX, domainsY, rank, peers, wrap) != 0){
+			return -1;
+		}
+		domain.threads = (int)cpuThreads;
+		domain.compactAgents = compactAgents;
+		domain.fastTrig = fastTrig;
+		domain.totalWorkers = domain.threads;
+		double start = getTime();
+		int status = runDomain(&domain, gridWidth, gridHeight, steps, (int)simulationSettings.agents, speciesCounts, seed, speciesSettings, &simulationSettings, &result);
+		printf("Rank %d:\n", rank);
+		printDomainResult(&result, (int)simulationSettings.species, steps, getTime() - start);
+		closeDomain(&domain);
+		return status;
+	}
+	
+	/*----------------------------------*/
+	
+	GLFWwindow* window = NULL;
+	
+	if (headless){
+		// No window and no display server, we only need a context for the compute shaders
+		if (createHeadlessContext() != 0){
+			return -1;
+		}
+	}else{
+		/*
+		http://www.opengl-tutorial.org/beginners-tutorials/tutorial-1-opening-a-window/	(Create window using glfw, glew)
+		*/
+		// Initialize GLFW
+		if(!glfwInit())
+		{
+			printf("Failed to initialize GLFW\n");
+			return -1;
+		}
+		
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4); // We want OpenGL 4.3 (necessary for image load / store)
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);	
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE); // We don't want the old OpenGL 
+		glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);	// Make window not resizable
+
+		// Open a window and create its OpenGL context
+		window = glfwCreateWindow(WIDTH, HEIGHT, "Physarum", NULL, NULL);
+		if(window == NULL){
+			printf("Failed to open GLFW window.\n");
+			glfwTerminate();
+			return -1;
+		}
+		glfwMakeContextCurrent(window); 
+	}
+	
+	/*----------------------------------*/
+	
+	// Frame time budget, every decision goes to the log
+	FILE* governorLog = NULL;
+	if (frameBudget > 0){
+		governorLog = governorLogPath ? fopen(governorLogPath, "w") : stderr;
+		if (governorLog == NULL){
+			printf("Failed to open %s\n", governorLogPath);
+			return -1;
+		}
+	}
+	
+	// Create shaders, buffers and textures, spawn agents (loads the GL functions of the context)
+	PhysarumConfig config;
+	physarumDefaultConfig(&config);
+	config.cpu = cpu;
+	config.threads = (int)cpuThreads;
+	config.pipeline = pipeline;
+	config.compactAgents = compactAgents;
+	config.fastTrig = fastTrig;
+	config.wrap = wrap;
+	config.multiRate = multiRate;
+	config.diffusePeriod = diffusePeriod;
+	config.diffuseScale = diffuseScale;
+	config.autotune = autotune;
+	config.seed = seed;
+	config.frameBudget = frameBudget;
+	config.governorLog = governorLog;
+	Physarum* physarum = physarumCreate(&config, speciesSettings, &simulationSettings);
+	if (physarum == NULL){
+		return -1;
+	}
+	
+	/*----------------------------------*/
+	
+	// Record / publish every step through a ring of pixel pack buffers
+	FrameOutputs outputs = {NULL, NULL, NULL};
+	FrameRing ring;
+	Recorder recorder;
+	if (recordPath && recordDelta){
+		if (createRecorder(&recorder, recordPath, keyframes, speciesSettings, (int)simulationSettings.species) != 0){
+			printf("Failed to open %s\n", recordPath);
+		}else{
+			outputs.recorder = &recorder;
+		}
+	}else if (recordPath){
+		outputs.record = fopen(recordPath, "wb");
+		if (outputs.record == NULL){
+			printf("Failed to open %s\n", recordPath);
+		}
+	}
+	if (publishName){
+		// Channels of a captured frame: one per species, 4 per layer above 4 species
+		PhysarumInfo info;
+		physarumGetInfo(physarum, &info);
+		int channels = info.trailLayers == 1 ? info.speciesCount : info.trailLayers * 4;
+		if (createFrameRing(&ring, publishName, publishFormat, publishSlots, COLUMNS, ROWS, channels, speciesSettings) != 0){
+			printf("Failed to create the shared memory ring %s\n", publishName);
+		}else{
+			outputs.ring = &ring;
+		}
+	}
+	if (outputs.record || outputs.recorder || outputs.ring){
+		physarumSetFrameCallback(physarum, writeFrameOutputs, &outputs);
+	}
+	
+	// Network metrics every few steps, JSON lines or CSV by the file name
+	Analytics analyticsStorage;
+	FILE* analyticsFile = NULL;
+	if (analyticsPath){
+		size_t length = strlen(analyticsPath);
+		int json = length >= 5 && strcmp(analyticsPath + length - 5, ".json") == 0;
+		analyticsFile = strcmp(analyticsPath, "-") == 0 ? stdout : fopen(analyticsPath, "w");
+		if (analyticsFile == NULL){
+			printf("Failed to open %s\n", analyticsPath);
+		}else{
+			initAnalytics(&analyticsStorage, analyticsFile, json ? ANALYTICS_JSON : ANALYTICS_CSV, analyticsInterval, analyticsLevel, (int)cpuThreads);
+			analytics = &analyticsStorage;
+		}
+	}
+	
+	// Settings and telemetry over a socket, commands are applied between frames
+	ControlServer controlStorage;
+	if (controlPath){
+		if (initControl(&controlStorage, controlPath, speciesSettings, &simulationSettings) != 0){
+			printf("Failed to create the control socket %s\n", controlPath);
+		}else{
+			control = &controlStorage;
+		}
+	}
+	
+	/*----------------------------------*/
+	
+	int status = headless ? runHeadless(physarum, steps) : runInteractive(physarum, window);
+	
+	// Clean Up
+	physarumDestroy(physarum);
+	if (outputs.record){
+		fclose(outputs.record);
+	}
+	if (outputs.recorder){
+		// The counters stay valid after the writer is done
+		if (closeRecorder(&recorder) != 0){
+			printf("Failed to write %s\n", recordPath);
+		}
+		printf("Recording: %ld frames (%ld keyframes), %.1f MB, %.1f x smaller than float32, simulation waited %.3f s for the writer\n",
+			(long)recorder.frameCount, recorder.keyframeCount, recorder.offset / 1e6, recorder.offset > 0 ? (double)recorder.rawBytes / recorder.offset : 0., recorder.waitTime);
+	}
+	if (outputs.ring){
+		if (outputs.ring->dropped > 0){
+			printf("Shared memory ring: %ld frames dropped\n", outputs.ring->dropped);
+		}
+		destroyFrameRing(outputs.ring);
+	}
+	if (governorLog && governorLog != stderr){
+		fclose(governorLog);
+	}
+	if (control){
+		destroyControl(control);
+	}
+	if (analytics){
+		destroyAnalytics(analytics);
+		if (analyticsFile != stdout){
+			fclose(analyticsFile);
+		}
+	}
+	
+	if (headless){
+		destroyHeadlessContext();
+	}else{
+		// glfw: terminate, clearing all previously allocated GLFW resources.
+		glfwTerminate();
+	}
+	
+	return status;
+}
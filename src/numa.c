@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include "numa.h"
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "threadpool.h"
+
+// Cpus of every node, read once
+static int nodeCount = 0;
+static int* nodeCpus[MAX_NUMA_NODES];
+static int nodeCpuCounts[MAX_NUMA_NODES];
+
+// Parse a cpu list like "0-7,16-23"
+static int parseCpuList(const char* list, int* cpus, int maxCpus){
+	int count = 0;
+	while (*list && *list != '\n'){
+		char* end;
+		int first = (int)strtol(list, &end, 10), last = first;
+		if (end == list) break;
+		if (*end == '-'){
+			list = end + 1;
+			last = (int)strtol(list, &end, 10);
+		}
+		for (; first <= last && count < maxCpus; first++){
+			cpus[count++] = first;
+		}
+		list = *end == ',' ? end + 1 : end;
+	}
+	return count;
+}
+
+static void readTopology(void){
+	if (nodeCount > 0) return;
+	
+	int cpuCount = getCpuCount(), node;
+	for (node = 0; node < MAX_NUMA_NODES; node++){
+		char path[64], list[4096];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		FILE* file = fopen(path, "r");
+		if (file == NULL) break;
+		int* cpus = malloc(cpuCount * sizeof(int));
+		int count = fgets(list, sizeof(list), file) ? parseCpuList(list, cpus, cpuCount) : 0;
+		fclose(file);
+		
+		// Nodes with memory only have no cpus
+		if (count == 0){
+			free(cpus);
+			continue;
+		}
+		nodeCpus[nodeCount] = cpus;
+		nodeCpuCounts[nodeCount++] = count;
+	}
+	
+	// No sysfs: one node with all cpus
+	if (nodeCount == 0){
+		nodeCpus[0] = malloc(cpuCount * sizeof(int));
+		for (node = 0; node < cpuCount; node++) nodeCpus[0][node] = node;
+		nodeCpuCounts[0] = cpuCount;
+		nodeCount = 1;
+	}
+}
+
+int getNumaNodeCount(void){
+	readTopology();
+	return nodeCount;
+}
+
+int getCpuNode(int cpu){
+	readTopology();
+	int node, i;
+	for (node = 0; node < nodeCount; node++){
+		for (i = 0; i < nodeCpuCounts[node]; i++){
+			if (nodeCpus[node][i] == cpu) return node;
+		}
+	}
+	return 0;
+}
+
+void getWorkerCpus(int firstWorker, int workers, int totalWorkers, int* cpus){
+	readTopology();
+	int i;
+	for (i = 0; i < workers; i++){
+		int worker = firstWorker + i;
+		// Block of workers per node, node n gets workers [n * total / nodes, (n + 1) * total / nodes)
+		int node = (int)((long)worker * nodeCount / totalWorkers);
+		int firstOfNode = (int)(((long)node * totalWorkers + nodeCount - 1) / nodeCount);
+		cpus[i] = nodeCpus[node][(worker - firstOfNode) % nodeCpuCounts[node]];
+	}
+}
+
+// move_pages without target nodes only reports where the pages are
+void countPageNodes(const void* address, size_t size, int node, long* local, long* remote){
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t first = (size_t)address & ~(pageSize - 1), last = ((size_t)address + size + pageSize - 1) & ~(pageSize - 1);
+	size_t count = (last - first) / pageSize, done = 0;
+	
+	// Batches of pages per system call
+	enum { BATCH = 1024 };
+	void* pages[BATCH];
+	int status[BATCH];
+	while (done < count){
+		size_t batch = count - done < BATCH ? count - done : BATCH, i;
+		for (i = 0; i < batch; i++){
+			pages[i] = (void*)(first + (done + i) * pageSize);
+		}
+		if (syscall(SYS_move_pages, 0, batch, pages, NULL, status, 0) != 0) return;
+		for (i = 0; i < batch; i++){
+			if (status[i] == node) (*local)++;
+			else if (status[i] >= 0) (*remote)++;	// negative: not touched yet
+		}
+		done += batch;
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// NUMA topology from /sys/devices/system/node (no libnuma needed), machines without it are one node
+#define MAX_NUMA_NODES 64
+
+// Number of memory nodes (sockets)
+int getNumaNodeCount(void);
+
+// Node of cpu
+int getCpuNode(int cpu);
+
+// Cpus for workers [firstWorker, firstWorker + workers) of totalWorkers spread evenly over all nodes,
+// consecutive workers share a node so neighboring bands of the trailMap stay on one socket
+void getWorkerCpus(int firstWorker, int workers, int totalWorkers, int* cpus);
+
+// Count the pages of [address, address + size) that are on node / on other nodes
+void countPageNodes(const void* address, size_t size, int node, long* local, long* remote);
+
+#endif
@@ -0,0 +1,1290 @@
+#include "physarum.h"
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <GL/glew.h>
+
+#include "shader.h"
+#include "cpusim.h"
+#include "numa.h"
+#include "governor.h"
+#include "autotune.h"
+
+#define COLUMNS PHYSARUM_COLUMNS
+#define ROWS PHYSARUM_ROWS
+#define PI 3.141592	// same as the shaders
+
+#define SNAPSHOT_MAGIC 0x53594850	// "PHYS"
+#define SNAPSHOT_VERSION 1
+
+// Sizes without tuning and the candidates of the autotuner
+#define AGENT_GROUP 64	// agents per workgroup of the compute shader
+#define DIFFUSE_TILE 16	// pixels per side of a workgroup of the diffuse shader
+static const int agentGroups[] = {16, 32, 64, 128, 256};
+static const int diffuseTiles[] = {8, 16};	// a 32 pixel tile and its halo do not fit into 32 KB of shared memory
+static const int agentChunks[] = {256, 1024, 4096, 16384};
+static const int diffuseBandCounts[] = {1, 2, 4, 8};
+
+// OpenGL objects and settings of a running simulation
+struct Physarum{
+	Species species[MAX_SPECIES];	// settings the simulation runs with, copied in by physarumSetSettings
+	Simulation simulation;
+	char shaderDirectory[256];
+	unsigned int shaderProgram, computeProgram, diffuseProgram, spawnProgram, compactProgram;
+	unsigned int levelProgram, levelDiffuseProgram;	// downsample / upsample and the blur of the level (diffuseScale > 1)
+	int uniformWindowSize, uniformTime;
+	unsigned int VAO, VBO, EBO;
+	unsigned int trailMapTexture, diffusedTexture;	// ping-pong, swapped after every diffuse
+	int speciesCount, trailLayers;	// species the shaders are compiled for, layers of the trailMap textures
+	unsigned int trailFormat;	// internal format of the trailMap textures
+	unsigned int agentsSSBO, speciesSettingsSSBO, simulationSettingsSSBO;
+	int agentCount, agentCapacity;	// number of agents in use / that fit into the agent buffer
+	int compactAgents;	// agents are stored as CompactAgent (8 bytes) on the gpu and cpu
+	int agentSize;	// bytes per agent
+	int fastTrig;	// sensor directions rotated from the forward direction with constants per species instead of sin / cos
+	int wrap;	// toroidal world: agents and samples wrap around at the edges instead of bouncing / clamping
+	int multiRate;	// species move every stepPeriods-th step as far as in that many steps
+	int diffusePeriod;	// steps from one diffuse to the next, the diffuse covers all of them
+	int diffuseScale;	// blur at up to 1 / diffuseScale resolution (getDiffuseLevel), 1: full resolution
+	unsigned int levelTexture, levelBlurredTexture;	// downsampled trailMap and its blur, created for levelScale
+	int levelScale;	// 0: no level textures
+	int agentGroup, diffuseTile;	// workgroup sizes the compute and diffuse shaders are compiled with
+	int agentChunk, diffuseBands;	// chunk sizes of the parallel agent update and diffuse of cpuSim
+	int autotune;	// benchmark the sizes on the first run of a device, grid and agent count, cached (autotune.h)
+	int tuning;	// autotune is running, its restores do not tune again
+	char tunedKey[AUTOTUNE_KEY];	// the sizes are tuned for this key
+	int tuned;	// 0: default sizes, 1: benchmarked, 2: loaded from the cache
+	double tunedStepTime;	// seconds per step of the benchmarked sizes
+	char tunedPath[512];	// cache the benchmarked sizes were saved to, "" if they were not
+	unsigned int step;	// steps since the start, random numbers of the agents depend on it
+	int speciesCounts[MAX_SPECIES];	// number of agents in use of each species
+	unsigned int seed;	// seed of the next spawn
+	Capture* capture;	// records every step if not NULL
+	Capture captureStorage;
+	Governor* governor;	// holds the frame time budget if not NULL
+	Governor governorStorage;
+	CpuSim* cpuSim;	// simulates on the cpu and uploads the trailMap after every step if not NULL
+	ThreadPool* pool;	// workers of cpuSim
+	int threads;	// workers of cpuSim the pool is resized to before the next step
+	int pipeline;	// cpuSim runs the steps of a frame as one task graph when nothing needs the trailMap in between
+	unsigned int mapBuffer;	// pixel pack buffer of physarumMapTrailMap (gpu)
+	size_t mapBufferSize;
+	float* upload;	// trailMap repacked into texture layers
+	Arena arena;	// cpu simulation, upload and readback buffers, mapped once for the biggest configuration
+};
+
+// Several simulations can share a context: bind the buffers and the trailMap of this one before it runs or draws
+static void bindPhysarum(Physarum* physarum){
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, physarum->agentsSSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, physarum->speciesSettingsSSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, physarum->simulationSettingsSSBO);
+	if (physarum->speciesCount > 0){
+		glBindImageTexture(1, physarum->trailMapTexture, 0, GL_TRUE, 0, GL_READ_WRITE, physarum->trailFormat);
+	}
+}
+
+
+void physarumGetSpeciesCounts(int count, int species, const Species speciesSettings[MAX_SPECIES], int speciesCounts[MAX_SPECIES]){
+	float sum = 0;
+	int assigned = 0, last = 0;
+	
+	int s;
+	for (s = 0; s < species; s++){
+		sum += speciesSettings[s].percent;
+		int end = (int)ceil(count * (sum / 100.));
+		speciesCounts[s] = (end < count ? end : count) - assigned;
+		assigned += speciesCounts[s];
+		if (speciesSettings[s].percent > 0) last = s;
+	}
+	speciesCounts[last] += count - assigned;
+}
+
+// give agents [offset, offset + count) a x, y and angle value based on spawnMode (on the gpu)
+static void spawnAgents(Physarum* physarum, int offset, int count, const int speciesCounts[MAX_SPECIES]){
+	if (count <= 0) return;
+	
+	int speciesEnd[MAX_SPECIES];
+	int s, end = 0;
+	for (s = 0; s < physarum->speciesCount; s++){
+		end += speciesCounts[s];
+		speciesEnd[s] = end;
+	}
+	
+	glUseProgram(physarum->spawnProgram);
+	glUniform2i(glGetUniformLocation(physarum->spawnProgram, "imgSize"), COLUMNS, ROWS);
+	glUniform1ui(glGetUniformLocation(physarum->spawnProgram, "seed"), physarum->seed++);
+	glUniform1i(glGetUniformLocation(physarum->spawnProgram, "spawnOffset"), offset);
+	glUniform1i(glGetUniformLocation(physarum->spawnProgram, "spawnCount"), count);
+	glUniform1iv(glGetUniformLocation(physarum->spawnProgram, "speciesEnd"), physarum->speciesCount, speciesEnd);
+	
+	glDispatchCompute((count + 63) / 64, 1, 1);
+	// Agents have to be written before the next step reads them
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+// one trailMap channel per species, 4 channels are packed into each layer of the texture array
+// up to 4 species use 32 bit floats, more species use 16 bit floats so each species costs 2 bytes per pixel
+static void setTrailFormat(Physarum* physarum, int species){
+	physarum->speciesCount = species;
+	physarum->trailLayers = (species + 3) / 4;
+	switch (species){
+		case 1: physarum->trailFormat = GL_R32F;
+		break;
+		case 2: physarum->trailFormat = GL_RG32F;
+		break;
+		case 3:
+		case 4: physarum->trailFormat = GL_RGBA32F;
+		break;
+		default: physarum->trailFormat = GL_RGBA16F;
+		break;
+	}
+}
+
+// format qualifier of the trailMap images in the shaders
+static const char* getTrailFormatName(unsigned int trailFormat){
+	switch (trailFormat){
+		case GL_R32F: return "r32f";
+		case GL_RG32F: return "rg32f";
+		case GL_RGBA16F: return "rgba16f";
+		default: return "rgba32f";
+	}
+}
+
+// pixel format to read back only the channels of the species in use
+static unsigned int getTrailReadFormat(Physarum* physarum){
+	switch (physarum->speciesCount){
+		case 1: return GL_RED;
+		case 2: return GL_RG;
+		case 3: return GL_RGB;
+		default: return GL_RGBA;
+	}
+}
+
+// set every pixel of a trailMap texture to 0
+static void clearTrailMap(unsigned int texture){
+	// GL_ARB_clear_texture (core in 4.4): no upload and no reallocation
+	glClearTexImage(texture, 0, GL_RGBA, GL_FLOAT, NULL);
+}
+
+// create an empty width x height texture array with the layout of setTrailFormat
+static unsigned int createLayerTexture(Physarum* physarum, int width, int height){
+	unsigned int texture;
+	
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture); 
+	
+	// s = x, t = y when using textures
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	
+	// Set texture filtering parameters
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		
+    // One layer per 4 species, immutable storage (allocated once)
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, physarum->trailFormat, width, height, physarum->trailLayers);
+	clearTrailMap(texture);
+	
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	
+	return texture;
+}
+
+// create an empty trailMap texture array
+static unsigned int createTrailMapTexture(Physarum* physarum){
+	return createLayerTexture(physarum, COLUMNS, ROWS);
+}
+
+// The shaders are specialized for the number of species, loops over species and layers have constant bounds
+static void getShaderDefines(Physarum* physarum, char* defines, size_t size){
+	char governorDefines[64] = "";
+	if (physarum->governor){
+		snprintf(governorDefines, sizeof(governorDefines), "#define GOVERNOR\n#define ACTIVE_BLOCK %d\n", ACTIVE_BLOCK);
+	}
+	snprintf(defines, size, 
+		"#define MAX_SPECIES %d\n#define SPECIES_COUNT %d\n#define TRAIL_LAYERS %d\n#define TRAIL_FORMAT %s\n#define DIFFUSE_STEPS %d\n"
+		"#define AGENT_GROUP %d\n#define DIFFUSE_TILE %d\n%s%s%s%s%s",
+		MAX_SPECIES, physarum->speciesCount, physarum->trailLayers, getTrailFormatName(physarum->trailFormat), physarum->diffusePeriod,
+		physarum->agentGroup, physarum->diffuseTile,
+		physarum->compactAgents ? "#define COMPACT_AGENTS\n" : "", physarum->fastTrig ? "#define FAST_TRIG\n" : "", physarum->wrap ? "#define WRAP\n" : "",
+		physarum->multiRate ? "#define MULTI_RATE\n" : "", governorDefines);
+}
+
+// compile the compute shaders of a step (their workgroup sizes are tuned)
+static void createSimulationPrograms(Physarum* physarum, const char* defines){
+	// Create Compute shader with function from shader.c
+	char path[320];
+	snprintf(path, sizeof(path), "%s/computeShader.glsl", physarum->shaderDirectory);
+	physarum->computeProgram = createComputeShader(path, defines);
+	physarum->uniformTime = glGetUniformLocation(physarum->computeProgram, "time");
+	
+	// Create Compute shader for diffuse and decay
+	snprintf(path, sizeof(path), "%s/diffuseShader.glsl", physarum->shaderDirectory);
+	physarum->diffuseProgram = createComputeShader(path, defines);
+	
+	// The same blur for the level of a reduced resolution diffuse, resampled by the level shader
+	if (physarum->diffuseScale > 1){
+		char levelDefines[576];
+		snprintf(levelDefines, sizeof(levelDefines), "%s#define LEVEL_BLUR\n", defines);
+		physarum->levelDiffuseProgram = createComputeShader(path, levelDefines);
+		snprintf(path, sizeof(path), "%s/levelShader.glsl", physarum->shaderDirectory);
+		physarum->levelProgram = createComputeShader(path, defines);
+	}
+}
+
+// delete the compute shaders of createSimulationPrograms
+static void deleteSimulationPrograms(Physarum* physarum){
+	glDeleteProgram(physarum->computeProgram);
+	glDeleteProgram(physarum->diffuseProgram);
+	glDeleteProgram(physarum->levelDiffuseProgram);
+	glDeleteProgram(physarum->levelProgram);
+	physarum->levelDiffuseProgram = 0;
+	physarum->levelProgram = 0;
+}
+
+// delete the level textures, the next level diffuse creates them for its scale
+static void deleteLevelTextures(Physarum* physarum){
+	if (physarum->levelScale == 0) return;
+	glDeleteTextures(1, &physarum->levelTexture);
+	glDeleteTextures(1, &physarum->levelBlurredTexture);
+	physarum->levelScale = 0;
+}
+
+// compile the shaders for species species and create matching trailMap textures
+static void createSpeciesPipeline(Physarum* physarum, int species){
+	// Delete the pipeline of the previous number of species
+	if (physarum->speciesCount > 0){
+		glDeleteProgram(physarum->shaderProgram);
+		deleteSimulationPrograms(physarum);
+		glDeleteProgram(physarum->spawnProgram);
+		glDeleteProgram(physarum->compactProgram);
+		glDeleteTextures(1, &physarum->trailMapTexture);
+		glDeleteTextures(1, &physarum->diffusedTexture);
+		deleteLevelTextures(physarum);
+	}
+	
+	setTrailFormat(physarum, species);
+	
+	char defines[512];
+	getShaderDefines(physarum, defines, sizeof(defines));
+	
+	// Create Normal shader with function from shader.c
+	char path[320], fragmentPath[320];
+	snprintf(path, sizeof(path), "%s/vertexShader.glsl", physarum->shaderDirectory);
+	snprintf(fragmentPath, sizeof(fragmentPath), "%s/fragmentShader.glsl", physarum->shaderDirectory);
+	physarum->shaderProgram = createShader(path, fragmentPath, defines);
+	
+	createSimulationPrograms(physarum, defines);
+	
+	// Create Compute shaders for spawning and removing agents
+	snprintf(path, sizeof(path), "%s/spawnShader.glsl", physarum->shaderDirectory);
+	physarum->spawnProgram = createComputeShader(path, defines);
+	snprintf(path, sizeof(path), "%s/compactShader.glsl", physarum->shaderDirectory);
+	physarum->compactProgram = createComputeShader(path, defines);
+	
+	// Create shader variable
+	physarum->uniformWindowSize = glGetUniformLocation(physarum->shaderProgram, "windowSize");
+	
+	// Create textures
+	physarum->trailMapTexture = createTrailMapTexture(physarum);
+	physarum->diffusedTexture = createTrailMapTexture(physarum);
+	
+	// Recorded frames change their size with the number of species
+	if (physarum->capture){
+		FrameCallback callback = physarum->capture->callback;
+		void* userData = physarum->capture->userData;
+		destroyCapture(physarum->capture);
+		initCapture(physarum->capture, COLUMNS, ROWS, physarum->trailLayers, getTrailReadFormat(physarum), callback, userData);
+	}
+}
+
+// load species settings into shader
+static void updateSpeciesSettings(Physarum* physarum){
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, physarum->speciesSettingsSSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(physarum->species), physarum->species, GL_STATIC_DRAW);
+}
+
+// loas simulation settings into shader
+static void updateSimulationSettings(Physarum* physarum){
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, physarum->simulationSettingsSSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(physarum->simulation), &physarum->simulation, GL_STATIC_DRAW);
+}
+
+// make sure the agent buffer fits count agents, grows geometrically and keeps the first keep agents
+static void reserveAgents(Physarum* physarum, int count, int keep){
+	if (count <= physarum->agentCapacity) return;
+	
+	int capacity = physarum->agentCapacity * 2 > count ? physarum->agentCapacity * 2 : count;
+	
+	if (keep == 0){
+		// Nothing to keep, reallocate in place
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, physarum->agentsSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)capacity * physarum->agentSize, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}else{
+		// Copy the agents into a bigger buffer on the gpu
+		unsigned int agentsSSBO;
+		glGenBuffers(1, &agentsSSBO);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, agentsSSBO);
+		glBufferData(GL_COPY_WRITE_BUFFER, (size_t)capacity * physarum->agentSize, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, physarum->agentsSSBO);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (size_t)keep * physarum->agentSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		
+		glDeleteBuffers(1, &physarum->agentsSSBO);
+		physarum->agentsSSBO = agentsSSBO;
+		// "layout(binding = 2)"
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, physarum->agentsSSBO);
+	}
+	physarum->agentCapacity = capacity;
+}
+
+// remove removeCounts[s] agents of each species s by moving agents from the end into the gaps
+static void removeAgents(Physarum* physarum, const int removeCounts[MAX_SPECIES]){
+	unsigned int counts[MAX_SPECIES];
+	int removed = 0, s;
+	for (s = 0; s < physarum->speciesCount; s++){
+		counts[s] = removeCounts[s];
+		removed += removeCounts[s];
+	}
+	int oldCount = physarum->agentCount;
+	int newCount = oldCount - removed;
+	if (removed <= 0) return;
+	
+	// Counters, hole list and bit mask of the removed agents behind newCount, "layout(binding = 5)"
+	unsigned int compactionSSBO;
+	glGenBuffers(1, &compactionSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, compactionSSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (MAX_SPECIES + 2 + removed + (removed + 31) / 32) * sizeof(unsigned int), NULL, GL_STREAM_COPY);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, compactionSSBO);
+	
+	glUseProgram(physarum->compactProgram);
+	glUniform1i(glGetUniformLocation(physarum->compactProgram, "oldCount"), oldCount);
+	glUniform1i(glGetUniformLocation(physarum->compactProgram, "newCount"), newCount);
+	glUniform1i(glGetUniformLocation(physarum->compactProgram, "maskOffset"), removed);
+	glUniform1uiv(glGetUniformLocation(physarum->compactProgram, "removeCounts"), physarum->speciesCount, counts);
+	
+	// Pass 0: mark removed agents and collect the holes
+	glUniform1i(glGetUniformLocation(physarum->compactProgram, "pass"), 0);
+	glDispatchCompute((oldCount + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	
+	// Pass 1: fill the holes with the agents behind newCount
+	glUniform1i(glGetUniformLocation(physarum->compactProgram, "pass"), 1);
+	glDispatchCompute((removed + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	
+	glDeleteBuffers(1, &compactionSSBO);
+	physarum->agentCount = newCount;
+}
+
+// apply a changed agents setting to the running simulation without a reset
+// new agents spawn with the spawn mode of their species, the species percentages are kept
+static void resizeAgents(Physarum* physarum){
+	int targetCounts[MAX_SPECIES];
+	physarumGetSpeciesCounts((int)physarum->simulation.agents, physarum->speciesCount, physarum->species, targetCounts);
+	
+	int removeCounts[MAX_SPECIES], addCounts[MAX_SPECIES];
+	int added = 0, s;
+	for (s = 0; s < physarum->speciesCount; s++){
+		removeCounts[s] = physarum->speciesCounts[s] > targetCounts[s] ? physarum->speciesCounts[s] - targetCounts[s] : 0;
+		addCounts[s] = targetCounts[s] > physarum->speciesCounts[s] ? targetCounts[s] - physarum->speciesCounts[s] : 0;
+		added += addCounts[s];
+		physarum->speciesCounts[s] = targetCounts[s];
+	}
+	
+	removeAgents(physarum, removeCounts);
+	
+	if (added > 0){
+		reserveAgents(physarum, physarum->agentCount + added, physarum->agentCount);
+		spawnAgents(physarum, physarum->agentCount, added, addCounts);
+		physarum->agentCount += added;
+	}
+}
+
+// reset simulation with current settings, everything stays on the gpu
+// Returns -1 if the arena of the cpu simulation could not be mapped or is too small
+static int reset(Physarum* physarum){
+	// Spawn modes may just have been loaded
+	updateSpeciesSettings(physarum);
+	
+	// Shaders and textures depend on the number of species
+	if ((int)physarum->simulation.species != physarum->speciesCount){
+		createSpeciesPipeline(physarum, (int)physarum->simulation.species);
+	}
+	
+	int count = (int)physarum->simulation.agents;
+	physarumGetSpeciesCounts(count, physarum->speciesCount, physarum->species, physarum->speciesCounts);
+	
+	// The arena only grows, resets with the same or a smaller configuration reuse its pages
+	size_t trailMapSize = (size_t)COLUMNS * ROWS * 4 * physarum->trailLayers * sizeof(float) + 64;
+	size_t arenaSize = trailMapSize;	// readback of the trailMap
+	if (physarum->cpuSim){
+		arenaSize += getCpuSimSize(0, 0, COLUMNS, ROWS, 0, physarum->speciesCount, count, physarum->compactAgents) + trailMapSize;
+		if (physarum->diffuseScale > 1){
+			arenaSize += getCpuLevelSize(COLUMNS, ROWS, physarum->speciesCount);
+		}
+	}
+	if (reserveArena(&physarum->arena, arenaSize) < 0) return -1;
+	clearArena(&physarum->arena);
+	
+	if (physarum->cpuSim){
+		// The cpu simulation covers the whole trailMap, no halo
+		freeCpuSim(physarum->cpuSim);
+		int status = initCpuSim(physarum->cpuSim, COLUMNS, ROWS, 0, 0, COLUMNS, ROWS, 0, &physarum->arena, count, physarum->compactAgents, physarum->species, &physarum->simulation);
+		physarum->cpuSim->pool = physarum->pool;
+		physarum->cpuSim->fastTrig = physarum->fastTrig;
+		physarum->cpuSim->wrap = physarum->wrap;
+		physarum->cpuSim->multiRate = physarum->multiRate;
+		physarum->cpuSim->diffusePeriod = physarum->diffusePeriod;
+		physarum->cpuSim->agentChunk = physarum->agentChunk;
+		physarum->cpuSim->diffuseBands = physarum->diffuseBands;
+		if (status == 0){
+			status = initCpuLevel(physarum->cpuSim, physarum->diffuseScale, &physarum->arena);
+		}
+		physarum->upload = arenaAlloc(&physarum->arena, (size_t)COLUMNS * ROWS * 4 * sizeof(float));
+		if (status != 0 || physarum->upload == NULL) return -1;
+		cpuClearSim(physarum->cpuSim, count);
+		cpuSpawnAgents(physarum->cpuSim, count, physarum->speciesCounts, physarum->seed++);
+		physarum->agentCount = count;
+	}else{
+		// The agent buffer is only reallocated if it is too small
+		reserveAgents(physarum, count, 0);
+		physarum->agentCount = count;
+		
+		// Reset agents
+		spawnAgents(physarum, 0, count, physarum->speciesCounts);
+	}
+
+	// Reset trailMap (both ping-pong textures)
+	clearTrailMap(physarum->trailMapTexture);
+	clearTrailMap(physarum->diffusedTexture);
+	return 0;
+}
+
+// start / resize the workers of the cpu simulation if the thread setting changed
+static void updateThreadPool(Physarum* physarum){
+	if (physarum->cpuSim == NULL || (physarum->pool && physarum->pool->threadCount == physarum->threads)) return;
+	
+	if (physarum->pool){
+		destroyThreadPool(physarum->pool);
+	}else{
+		physarum->pool = malloc(sizeof(ThreadPool));
+	}
+	// Workers spread over the NUMA nodes, the memory follows them
+	int* cpus = malloc(physarum->threads * sizeof(int));
+	getWorkerCpus(0, physarum->threads, physarum->threads, cpus);
+	initThreadPool(physarum->pool, physarum->threads, cpus);
+	free(cpus);
+	physarum->cpuSim->pool = physarum->pool;
+}
+
+// copy a trailMap with one channel per species (cpu simulation, snapshots) into the trailMap texture, 4 channels per layer
+static void uploadTrailMap(Physarum* physarum, const float* trailMap){
+	GLenum format = physarum->speciesCount == 1 ? GL_RED : (physarum->speciesCount == 2 ? GL_RG : GL_RGBA);
+	int components = physarum->speciesCount < 4 && physarum->speciesCount != 3 ? physarum->speciesCount : 4;
+	
+	glBindTexture(GL_TEXTURE_2D_ARRAY, physarum->trailMapTexture);
+	if (components == physarum->speciesCount){
+		// Same layout as the texture (1, 2 or 4 species), no copy
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, COLUMNS, ROWS, 1, format, GL_FLOAT, trailMap);
+	}else{
+		int layer, i, c;
+		for (layer = 0; layer < physarum->trailLayers; layer++){
+			for (i = 0; i < COLUMNS * ROWS; i++){
+				for (c = 0; c < 4; c++){
+					int species = layer * 4 + c;
+					physarum->upload[i * 4 + c] = species < physarum->speciesCount ? trailMap[(size_t)i * physarum->speciesCount + species] : 0.0f;
+				}
+			}
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, COLUMNS, ROWS, 1, format, GL_FLOAT, physarum->upload);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+// Sensor rotations and turn speeds of the fast trig compute shader, the settings can change every step
+static void updateSpeciesRotations(Physarum* physarum){
+	float rotations[MAX_SPECIES][2], turnRadians[MAX_SPECIES];
+	int s;
+	for (s = 0; s < physarum->speciesCount; s++){
+		float sensorAngleRad = physarum->species[s].sensorAngle * (PI / 180.0f);
+		rotations[s][0] = cosf(sensorAngleRad);
+		rotations[s][1] = sinf(sensorAngleRad);
+		turnRadians[s] = physarum->species[s].turnSpeed * 2 * PI;
+	}
+	glUniform2fv(glGetUniformLocation(physarum->computeProgram, "sensorRotation"), physarum->speciesCount, &rotations[0][0]);
+	glUniform1fv(glGetUniformLocation(physarum->computeProgram, "turnRadians"), physarum->speciesCount, turnRadians);
+}
+
+// Steps between the updates of each species for the multi-rate compute shader, the speeds can change every step
+static void updateStepPeriods(Physarum* physarum){
+	int periods[MAX_SPECIES];
+	getStepPeriods(physarum->species, physarum->speciesCount, periods);
+	glUniform1iv(glGetUniformLocation(physarum->computeProgram, "stepPeriods"), physarum->speciesCount, periods);
+}
+
+// diffuse and decay the trailMap into the second texture through a level of 1 / scale resolution (levelShader.glsl)
+static void diffuseLevel(Physarum* physarum, int scale, int radius){
+	int width = (COLUMNS + scale - 1) / scale, height = (ROWS + scale - 1) / scale;
+	if (physarum->levelScale != scale){
+		// The blur radius changed the scale
+		deleteLevelTextures(physarum);
+		physarum->levelTexture = createLayerTexture(physarum, width, height);
+		physarum->levelBlurredTexture = createLayerTexture(physarum, width, height);
+		physarum->levelScale = scale;
+	}
+	
+	// Pass 0: average the trailMap into the level
+	glBindImageTexture(2, physarum->levelTexture, 0, GL_TRUE, 0, GL_READ_WRITE, physarum->trailFormat);
+	glUseProgram(physarum->levelProgram);
+	glUniform1i(glGetUniformLocation(physarum->levelProgram, "pass"), 0);
+	glUniform1i(glGetUniformLocation(physarum->levelProgram, "levelScale"), scale);
+	glDispatchCompute((width + 7) / 8, (height + 7) / 8, physarum->trailLayers);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	
+	// Blur the level with the diffuse shader
+	glBindImageTexture(1, physarum->levelTexture, 0, GL_TRUE, 0, GL_READ_WRITE, physarum->trailFormat);
+	glBindImageTexture(0, physarum->levelBlurredTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, physarum->trailFormat);
+	glUseProgram(physarum->levelDiffuseProgram);
+	glUniform1i(glGetUniformLocation(physarum->levelDiffuseProgram, "levelRadius"), radius);
+	if (physarum->governor){
+		glUniform1i(glGetUniformLocation(physarum->levelDiffuseProgram, "blurStep"), physarum->governor->blurStep);
+	}
+	glDispatchCompute((width + physarum->diffuseTile - 1) / physarum->diffuseTile, (height + physarum->diffuseTile - 1) / physarum->diffuseTile, physarum->trailLayers);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	
+	// Pass 1: upsample, blend and decay into the second texture
+	glBindImageTexture(1, physarum->trailMapTexture, 0, GL_TRUE, 0, GL_READ_WRITE, physarum->trailFormat);
+	glBindImageTexture(0, physarum->diffusedTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, physarum->trailFormat);
+	glBindImageTexture(2, physarum->levelBlurredTexture, 0, GL_TRUE, 0, GL_READ_WRITE, physarum->trailFormat);
+	glUseProgram(physarum->levelProgram);
+	glUniform1i(glGetUniformLocation(physarum->levelProgram, "pass"), 1);
+	glDispatchCompute((COLUMNS + 7) / 8, (ROWS + 7) / 8, physarum->trailLayers);
+}
+
+// advance the simulation by one step: move agents, then diffuse and decay the trailMap
+static void simulate(Physarum* physarum){
+	Governor* governor = physarum->governor;
+	if (physarum->cpuSim){
+		// Same steps on the cpu, the texture is only used for drawing and capture
+		if (governor){
+			physarum->cpuSim->activeThreshold = getActiveThreshold(governor);
+			physarum->cpuSim->blurStep = governor->blurStep;
+			beginPhase(governor, GOVERNOR_AGENTS);
+		}
+		cpuUpdate(physarum->cpuSim);
+		if (governor){
+			endPhase(governor, GOVERNOR_AGENTS);
+			beginPhase(governor, GOVERNOR_DIFFUSE);
+		}
+		cpuDiffuseRegion(physarum->cpuSim);
+		cpuSwapTrailMaps(physarum->cpuSim);
+		physarum->step++;
+		if (governor){
+			endPhase(governor, GOVERNOR_DIFFUSE);
+			beginPhase(governor, GOVERNOR_UPLOAD);
+		}
+		uploadTrailMap(physarum, physarum->cpuSim->trailMap);
+		if (governor){
+			endPhase(governor, GOVERNOR_UPLOAD);
+		}
+		if (physarum->capture){
+			captureFrame(physarum->capture, physarum->trailMapTexture);
+		}
+		return;
+	}
+	
+	/*
+	Bind our texture to binding point 1. This means we can access it in our shaders using
+	"layout(binding = 1)"
+	and we can both read and write from it. 
+	*/
+	glBindImageTexture(1, physarum->trailMapTexture, 0, GL_TRUE, 0, GL_READ_WRITE, physarum->trailFormat);
+	
+	// Use Compute Shader to update the agents
+	glUseProgram(physarum->computeProgram);
+	// Set shader variable (step counter, runs with the same seed are the same)
+	int diffuse = isDiffuseStep(physarum->step, physarum->diffusePeriod);
+	glUniform1i(physarum->uniformTime, physarum->step++);
+	if (physarum->fastTrig){
+		updateSpeciesRotations(physarum);
+	}
+	if (physarum->multiRate){
+		updateStepPeriods(physarum);
+	}
+	if (governor){
+		glUniform1ui(glGetUniformLocation(physarum->computeProgram, "activeThreshold"), getActiveThreshold(governor));
+		beginPhase(governor, GOVERNOR_AGENTS);
+	}
+	// Every agent, the last workgroup is cut off in the shader
+	glUniform1i(glGetUniformLocation(physarum->computeProgram, "agentCount"), physarum->agentCount);
+	glDispatchCompute((physarum->agentCount + physarum->agentGroup - 1) / physarum->agentGroup, 1, 1);
+	// Diffuse has to see all deposits of this step
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	if (governor){
+		endPhase(governor, GOVERNOR_AGENTS);
+	}
+	
+	// Deposits pile up in the trailMap until the diffuse of the last step of the period
+	if (!diffuse){
+		// The next step reads the agents, captures, maps and draws read the trailMap like after a diffuse
+		glMemoryBarrier(GL_ALL_BARRIER_BITS);
+		if (physarum->capture){
+			captureFrame(physarum->capture, physarum->trailMapTexture);
+		}
+		return;
+	}
+	
+	int levelRadius, scale = getDiffuseLevel((int)physarum->simulation.blurRadius, physarum->diffuseScale, &levelRadius);
+	if (governor){
+		beginPhase(governor, GOVERNOR_DIFFUSE);
+	}
+	if (scale > 1){
+		diffuseLevel(physarum, scale, levelRadius);
+	}else{
+		// Use Compute Shader to diffuse and decay the trailMap into the second texture (one invocation per pixel)
+		glBindImageTexture(0, physarum->diffusedTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, physarum->trailFormat);
+		glUseProgram(physarum->diffuseProgram);
+		if (governor){
+			glUniform1i(glGetUniformLocation(physarum->diffuseProgram, "blurStep"), governor->blurStep);
+		}
+		glDispatchCompute((COLUMNS + physarum->diffuseTile - 1) / physarum->diffuseTile, (ROWS + physarum->diffuseTile - 1) / physarum->diffuseTile, physarum->trailLayers);
+	}
+	// If the special value GL_ALL_BARRIER_BITS is specified, all supported barriers for the corresponding command will be inserted.
+	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	if (governor){
+		endPhase(governor, GOVERNOR_DIFFUSE);
+	}
+	
+	// The diffused texture is the trailMap of the next step
+	unsigned int temp = physarum->trailMapTexture;
+	physarum->trailMapTexture = physarum->diffusedTexture;
+	physarum->diffusedTexture = temp;
+	glBindImageTexture(1, physarum->trailMapTexture, 0, GL_TRUE, 0, GL_READ_WRITE, physarum->trailFormat);
+	
+	// Queue the readback of this step, the cpu gets it a few steps later without stalling
+	if (physarum->capture){
+		captureFrame(physarum->capture, physarum->trailMapTexture);
+	}
+}
+
+// advance the simulation by steps steps
+static void simulateSteps(Physarum* physarum, int steps){
+	// The governor times the phases and the capture takes every step, both need the steps one by one
+	if (physarum->cpuSim && physarum->pipeline && physarum->governor == NULL && physarum->capture == NULL){
+		cpuStepPipelined(physarum->cpuSim, steps);
+		physarum->step += steps;
+		uploadTrailMap(physarum, physarum->cpuSim->trailMap);
+		return;
+	}
+	int s;
+	for (s = 0; s < steps; s++){
+		simulate(physarum);
+	}
+}
+
+int physarumStepFrame(Physarum* physarum, int maxSteps){
+	bindPhysarum(physarum);
+	updateThreadPool(physarum);
+	int steps = physarum->governor ? physarum->governor->stepsPerFrame : maxSteps;
+	if (steps > maxSteps) steps = maxSteps;
+	if (steps < 1) steps = 1;
+	simulateSteps(physarum, steps);
+	if (physarum->governor){
+		updateGovernor(physarum->governor, maxSteps, (int)physarum->simulation.blurRadius);
+	}
+	return steps;
+}
+
+
+void physarumStep(Physarum* physarum, int steps){
+	bindPhysarum(physarum);
+	updateThreadPool(physarum);
+	simulateSteps(physarum, steps);
+}
+
+/*----------------------------------*/
+
+// Candidates are timed from the state the simulation had when autotune started
+typedef struct TuneRun{
+	Physarum* physarum;
+	void* snapshot;
+	size_t snapshotSize;
+}TuneRun;
+
+static double getSeconds(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The tuned sizes are only good for the machine, engine and device, grid, agents, species and kernel switches they were measured with
+static void getTuningKey(Physarum* physarum, char* key, size_t size){
+	char host[64] = "", device[128];
+	gethostname(host, sizeof(host) - 1);
+	if (physarum->cpuSim){
+		snprintf(device, sizeof(device), "cpu %d threads", physarum->threads);
+	}else{
+		const char* renderer = (const char*)glGetString(GL_RENDERER);
+		snprintf(device, sizeof(device), "gpu %s", renderer ? renderer : "unknown");
+	}
+	snprintf(key, size, "%s|%s|%dx%d|%d agents|%d species|%d%d%d%d%d%d%d%d", host, device, COLUMNS, ROWS, physarum->agentCount, physarum->speciesCount,
+		physarum->compactAgents, physarum->fastTrig, physarum->wrap, physarum->multiRate, physarum->diffusePeriod, physarum->governor != NULL, physarum->diffuseScale,
+		physarum->pipeline);
+	// Tabs and newlines separate the entries of the cache
+	char* c;
+	for (c = key; *c; c++){
+		if (*c == '\t' || *c == '\n') *c = ' ';
+	}
+}
+
+// Size parameter (0: agents, 1: diffuse) of the engine in use
+static int* getTunedSize(Physarum* physarum, int parameter){
+	if (physarum->cpuSim){
+		return parameter == 0 ? &physarum->agentChunk : &physarum->diffuseBands;
+	}
+	return parameter == 0 ? &physarum->agentGroup : &physarum->diffuseTile;
+}
+
+// Compile the compute shaders with the current workgroup sizes, returns 0 if they link
+static int rebuildSimulationPrograms(Physarum* physarum){
+	deleteSimulationPrograms(physarum);
+	char defines[512];
+	getShaderDefines(physarum, defines, sizeof(defines));
+	createSimulationPrograms(physarum, defines);
+	int computeLinked = 0, diffuseLinked = 0;
+	glGetProgramiv(physarum->computeProgram, GL_LINK_STATUS, &computeLinked);
+	glGetProgramiv(physarum->diffuseProgram, GL_LINK_STATUS, &diffuseLinked);
+	return computeLinked && diffuseLinked ? 0 : -1;
+}
+
+// TuneFunction: fastest of AUTOTUNE_STEPS steps with the candidate size
+static double measureCandidate(int parameter, int candidate, void* userData){
+	TuneRun* run = userData;
+	Physarum* physarum = run->physarum;
+	*getTunedSize(physarum, parameter) = candidate;
+	if (physarum->cpuSim == NULL && rebuildSimulationPrograms(physarum) != 0){
+		// Too big for the workgroups or shared memory of this device
+		return -1;
+	}
+	// Restore also passes the chunk sizes to the fresh cpuSim
+	if (physarumRestore(physarum, run->snapshot, run->snapshotSize) != 0){
+		return -1;
+	}
+	double best = -1;
+	int s;
+	for (s = 0; s < AUTOTUNE_WARMUP + AUTOTUNE_STEPS; s++){
+		double start = getSeconds();
+		simulate(physarum);
+		if (physarum->cpuSim == NULL){
+			glFinish();
+		}
+		double time = getSeconds() - start;
+		if (s >= AUTOTUNE_WARMUP && (best < 0 || time < best)){
+			best = time;
+		}
+	}
+	return best;
+}
+
+// Load the sizes for the current key from the cache or benchmark them, the simulation continues where it was
+static void autotune(Physarum* physarum){
+	if (!physarum->autotune || physarum->tuning || physarum->agentCount == 0) return;
+	// Chunk sizes only matter with workers
+	if (physarum->cpuSim && (physarum->pool == NULL || physarum->pool->threadCount < 2)) return;
+	// The candidates are timed with simulate(), the pipelined steps of simulateSteps() split the work by their own bands
+	if (physarum->cpuSim && physarum->pipeline) return;
+	char key[AUTOTUNE_KEY];
+	getTuningKey(physarum, key, sizeof(key));
+	if (strcmp(key, physarum->tunedKey) == 0) return;
+	snprintf(physarum->tunedKey, sizeof(physarum->tunedKey), "%s", key);
+
+	int values[AUTOTUNE_VALUES];
+	int cached = loadTuning(key, values) == 0;
+	physarum->tuning = 1;
+	if (!cached){
+		// Nothing is recorded or governed while the candidates run, the governor's switches are compiled in again below
+		Capture* capture = physarum->capture;
+		Governor* governor = physarum->governor;
+		physarum->capture = NULL;
+		physarum->governor = NULL;
+		TuneRun run;
+		run.physarum = physarum;
+		run.snapshotSize = physarumSnapshotSize(physarum);
+		run.snapshot = malloc(run.snapshotSize);
+		physarumSnapshot(physarum, run.snapshot, run.snapshotSize);
+
+		double seconds = 0;
+		if (physarum->cpuSim){
+			values[0] = tuneParameter(0, agentChunks, sizeof(agentChunks) / sizeof(int), CPU_AGENT_CHUNK, measureCandidate, &run, NULL);
+			physarum->agentChunk = values[0];
+			values[1] = tuneParameter(1, diffuseBandCounts, sizeof(diffuseBandCounts) / sizeof(int), 1, measureCandidate, &run, &seconds);
+		}else{
+			values[0] = tuneParameter(0, agentGroups, sizeof(agentGroups) / sizeof(int), AGENT_GROUP, measureCandidate, &run, NULL);
+			physarum->agentGroup = values[0];
+			values[1] = tuneParameter(1, diffuseTiles, sizeof(diffuseTiles) / sizeof(int), DIFFUSE_TILE, measureCandidate, &run, &seconds);
+		}
+		physarum->capture = capture;
+		physarum->governor = governor;
+
+		// Reported through physarumGetInfo
+		physarum->tuned = 1;
+		physarum->tunedStepTime = seconds;
+		if (getTuningPath(physarum->tunedPath, sizeof(physarum->tunedPath)) != 0 || saveTuning(key, values) != 0){
+			physarum->tunedPath[0] = '\0';
+		}
+		*getTunedSize(physarum, 0) = values[0];
+		*getTunedSize(physarum, 1) = values[1];
+		if (physarum->cpuSim == NULL){
+			rebuildSimulationPrograms(physarum);
+		}
+		physarumRestore(physarum, run.snapshot, run.snapshotSize);
+		free(run.snapshot);
+	}else{
+		physarum->tuned = 2;
+		*getTunedSize(physarum, 0) = values[0];
+		*getTunedSize(physarum, 1) = values[1];
+		if (physarum->cpuSim){
+			physarum->cpuSim->agentChunk = values[0];
+			physarum->cpuSim->diffuseBands = values[1];
+		}else if (rebuildSimulationPrograms(physarum) != 0){
+			// A cache of another driver version, back to the defaults
+			physarum->agentGroup = AGENT_GROUP;
+			physarum->diffuseTile = DIFFUSE_TILE;
+			physarum->tuned = 0;
+			rebuildSimulationPrograms(physarum);
+		}
+	}
+	physarum->tuning = 0;
+	bindPhysarum(physarum);
+}
+
+void physarumDefaultConfig(PhysarumConfig* config){
+	memset(config, 0, sizeof(PhysarumConfig));
+	config->threads = 1;
+}
+
+Physarum* physarumCreate(const PhysarumConfig* config, const Species species[MAX_SPECIES], const Simulation* simulation){
+	// Load the GL functions of the current context
+	// A GLX build of GLEW reports a missing X display for EGL contexts, the GL functions are loaded anyway
+	GLenum glewStatus = glewInit();
+	if (glewStatus != GLEW_OK && glewStatus != GLEW_ERROR_NO_GLX_DISPLAY) {
+		printf("Failed to initialize GLEW\n");
+		return NULL;
+	}
+	
+	Physarum* physarum = calloc(1, sizeof(Physarum));
+	memcpy(physarum->species, species, sizeof(physarum->species));
+	physarum->simulation = *simulation;
+	snprintf(physarum->shaderDirectory, sizeof(physarum->shaderDirectory), "%s", config->shaderDirectory ? config->shaderDirectory : "./src/shader");
+	
+	// Shaders and trailMap textures are created by reset for the number of species
+	physarum->speciesCount = 0;
+	physarum->capture = NULL;
+	physarum->governor = NULL;
+	physarum->compactAgents = config->compactAgents;
+	physarum->agentSize = config->compactAgents ? sizeof(CompactAgent) : sizeof(Agent);
+	physarum->fastTrig = config->fastTrig;
+	physarum->wrap = config->wrap;
+	physarum->multiRate = config->multiRate;
+	physarum->diffusePeriod = config->diffusePeriod > 1 ? config->diffusePeriod : 1;
+	physarum->diffuseScale = config->diffuseScale > 1 ? (config->diffuseScale < MAX_DIFFUSE_SCALE ? config->diffuseScale : MAX_DIFFUSE_SCALE) : 1;
+	physarum->levelScale = 0;
+	physarum->agentGroup = AGENT_GROUP;
+	physarum->diffuseTile = DIFFUSE_TILE;
+	physarum->agentChunk = CPU_AGENT_CHUNK;
+	physarum->diffuseBands = 1;
+	physarum->autotune = config->autotune;
+	physarum->pipeline = config->pipeline;
+	physarum->cpuSim = config->cpu ? calloc(1, sizeof(CpuSim)) : NULL;
+	physarum->pool = NULL;
+	physarum->threads = config->threads > 0 ? config->threads : 1;
+	physarum->upload = NULL;
+	initArena(&physarum->arena);
+	
+	/*----------------------------------*/
+	
+	float vertices[] = {
+		// positions
+		1.0f,  1.0f, 0.0f,	// top right
+		1.0f, -1.0f, 0.0f,  // bottom right
+	   -1.0f, -1.0f, 0.0f,  // bottom left
+	   -1.0f,  1.0f, 0.0f, 	// top left 
+	};  
+	
+	unsigned int indices[] = {  // start from 0
+		0, 1, 3,   // first triangle
+		1, 2, 3    // second triangle
+	}; 
+	
+	glGenVertexArrays(1, &physarum->VAO);
+	glGenBuffers(1, &physarum->VBO);
+	glGenBuffers(1, &physarum->EBO);
+	
+	// Bind the Vertex Array Object first, then bind and set vertex buffer(s), and then configure vertex attributes(s).
+	glBindVertexArray(physarum->VAO);
+	
+	glBindBuffer(GL_ARRAY_BUFFER, physarum->VBO);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, physarum->EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	
+	// Position attribute
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+	
+	// Unbind
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	
+	/*----------------------------------*/
+	
+	// Create SSBOs for species and simulation settings, "layout(binding = 3)" and "layout(binding = 4)"
+	glGenBuffers(1, &physarum->speciesSettingsSSBO);
+	updateSpeciesSettings(physarum);
+	glGenBuffers(1, &physarum->simulationSettingsSSBO);
+	updateSimulationSettings(physarum);
+	
+	// Create SSBO (Shader Storage Buffer Object) for agents, "layout(binding = 2)"
+	glGenBuffers(1, &physarum->agentsSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, physarum->agentsSSBO);
+	physarum->agentCount = 0;
+	physarum->agentCapacity = 0;
+	physarum->seed = config->seed;
+	physarum->step = 0;
+	
+	// Unbind
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	bindPhysarum(physarum);
+	
+	// Frame time budget, the shaders are compiled with the governor's switches
+	if (config->frameBudget > 0){
+		initGovernor(&physarum->governorStorage, config->frameBudget, config->governorLog ? config->governorLog : stderr, physarum->cpuSim == NULL);
+		physarum->governor = &physarum->governorStorage;
+	}
+	
+	updateThreadPool(physarum);
+	
+	// Create shaders and textures, spawn agents
+	if (reset(physarum) != 0){
+		physarumDestroy(physarum);
+		return NULL;
+	}
+	bindPhysarum(physarum);
+	autotune(physarum);
+	
+	return physarum;
+}
+
+void physarumDestroy(Physarum* physarum){
+	if (physarum->capture){
+		destroyCapture(physarum->capture);
+	}
+	if (physarum->governor){
+		destroyGovernor(physarum->governor);
+	}
+	glDeleteVertexArrays(1, &physarum->VAO);
+    glDeleteBuffers(1, &physarum->VBO);
+	glDeleteBuffers(1, &physarum->EBO);
+	glDeleteBuffers(1, &physarum->agentsSSBO);
+	glDeleteBuffers(1, &physarum->speciesSettingsSSBO);
+	glDeleteBuffers(1, &physarum->simulationSettingsSSBO);
+	if (physarum->mapBuffer){
+		glDeleteBuffers(1, &physarum->mapBuffer);
+	}
+
+	glDeleteTextures(1, &physarum->trailMapTexture);
+	glDeleteTextures(1, &physarum->diffusedTexture);
+	deleteLevelTextures(physarum);
+	glDeleteProgram(physarum->shaderProgram);
+	deleteSimulationPrograms(physarum);
+	glDeleteProgram(physarum->spawnProgram);
+	glDeleteProgram(physarum->compactProgram);
+	if (physarum->cpuSim){
+		freeCpuSim(physarum->cpuSim);
+		free(physarum->cpuSim);
+	}
+	destroyArena(&physarum->arena);
+	if (physarum->pool){
+		destroyThreadPool(physarum->pool);
+		free(physarum->pool);
+	}
+	free(physarum);
+}
+
+void physarumSetSettings(Physarum* physarum, const Species species[MAX_SPECIES], const Simulation* simulation){
+	memcpy(physarum->species, species, sizeof(physarum->species));
+	physarum->simulation = *simulation;
+	
+	// Reupload settings
+	updateSpeciesSettings(physarum);
+	updateSimulationSettings(physarum);
+	
+	// Add / remove agents if the agents or species settings changed (the cpu simulation only on reset)
+	if (physarum->cpuSim == NULL){
+		bindPhysarum(physarum);
+		resizeAgents(physarum);
+	}
+}
+
+void physarumGetSettings(const Physarum* physarum, Species species[MAX_SPECIES], Simulation* simulation){
+	memcpy(species, physarum->species, sizeof(physarum->species));
+	*simulation = physarum->simulation;
+}
+
+int physarumReset(Physarum* physarum){
+	bindPhysarum(physarum);
+	int status = reset(physarum);
+	bindPhysarum(physarum);
+	if (status == 0){
+		autotune(physarum);
+	}
+	return status;
+}
+
+void physarumSetThreads(Physarum* physarum, int threads){
+	physarum->threads = threads > 0 ? threads : 1;
+	updateThreadPool(physarum);
+}
+
+const float* physarumMapTrailMap(Physarum* physarum, PhysarumTrailLayout* layout){
+	layout->width = COLUMNS;
+	layout->height = ROWS;
+	if (physarum->cpuSim){
+		// The cpu simulation covers the whole world without halo, it is done with the last step
+		layout->layers = 1;
+		layout->channels = physarum->cpuSim->species;
+		return physarum->cpuSim->trailMap;
+	}
+	
+	// Same channels as a captured frame
+	layout->layers = physarum->trailLayers;
+	layout->channels = physarum->trailLayers == 1 ? physarum->speciesCount : 4;
+	size_t size = (size_t)COLUMNS * ROWS * layout->layers * layout->channels * sizeof(float);
+	if (physarum->mapBuffer == 0){
+		glGenBuffers(1, &physarum->mapBuffer);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, physarum->mapBuffer);
+	if (physarum->mapBufferSize != size){
+		// GL_STREAM_READ: written by the gpu once, read by the cpu once
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		physarum->mapBufferSize = size;
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, physarum->trailMapTexture);
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, getTrailReadFormat(physarum), GL_FLOAT, (void*)0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	
+	// Waits for the copy, the pixels are read where the driver put them
+	const float* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return pixels;
+}
+
+void physarumUnmapTrailMap(Physarum* physarum){
+	if (physarum->cpuSim) return;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, physarum->mapBuffer);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+unsigned int physarumGetTrailTexture(const Physarum* physarum){
+	return physarum->trailMapTexture;
+}
+
+void physarumDraw(Physarum* physarum, int width, int height){
+	bindPhysarum(physarum);
+	
+	// Use shader to draw trailMap
+	glUseProgram(physarum->shaderProgram);
+	// Set shader variable
+	glUniform2i(physarum->uniformWindowSize, width, height);
+	
+	// Draw two triangles to form a rectangle
+	glBindVertexArray(physarum->VAO);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	
+	glMemoryBarrier(GL_ALL_BARRIER_BITS);
+}
+
+void physarumSetFrameCallback(Physarum* physarum, FrameCallback callback, void* userData){
+	if (physarum->capture){
+		destroyCapture(physarum->capture);
+		physarum->capture = NULL;
+	}
+	if (callback){
+		initCapture(&physarum->captureStorage, COLUMNS, ROWS, physarum->trailLayers, getTrailReadFormat(physarum), callback, userData);
+		physarum->capture = &physarum->captureStorage;
+	}
+}
+
+void physarumFlush(Physarum* physarum){
+	if (physarum->capture){
+		flushCapture(physarum->capture);
+	}
+	glFinish();
+}
+
+/*----------------------------------*/
+
+// Start of a snapshot, followed by the agents (agentSize bytes each) and the trailMap (one float per species and pixel)
+typedef struct SnapshotHeader{
+	unsigned int magic, version;
+	int width, height;
+	int speciesCount, agentCount, agentSize;
+	unsigned int step, seed;
+	int speciesCounts[MAX_SPECIES];
+	Species species[MAX_SPECIES];
+	Simulation simulation;
+}SnapshotHeader;
+
+size_t physarumSnapshotSize(const Physarum* physarum){
+	return sizeof(SnapshotHeader) + (size_t)physarum->agentCount * physarum->agentSize + (size_t)COLUMNS * ROWS * physarum->speciesCount * sizeof(float);
+}
+
+size_t physarumSnapshot(Physarum* physarum, void* buffer, size_t size){
+	size_t snapshotSize = physarumSnapshotSize(physarum);
+	if (size < snapshotSize) return 0;
+	
+	SnapshotHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.width = COLUMNS;
+	header.height = ROWS;
+	header.speciesCount = physarum->speciesCount;
+	header.agentCount = physarum->agentCount;
+	header.agentSize = physarum->agentSize;
+	header.step = physarum->step;
+	header.seed = physarum->seed;
+	memcpy(header.speciesCounts, physarum->speciesCounts, sizeof(header.speciesCounts));
+	memcpy(header.species, physarum->species, sizeof(header.species));
+	header.simulation = physarum->simulation;
+	memcpy(buffer, &header, sizeof(header));
+	
+	char* agents = (char*)buffer + sizeof(header);
+	size_t agentBytes = (size_t)physarum->agentCount * physarum->agentSize;
+	float* trailMap = (float*)(agents + agentBytes);
+	size_t pixels = (size_t)COLUMNS * ROWS;
+	
+	if (physarum->cpuSim){
+		memcpy(agents, physarum->cpuSim->agents, agentBytes);
+		memcpy(trailMap, physarum->cpuSim->trailMap, pixels * physarum->speciesCount * sizeof(float));
+		return snapshotSize;
+	}
+	
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, physarum->agentsSSBO);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, agentBytes, agents);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	
+	// Layers of 4 species into one channel per species (readback into the arena)
+	size_t used = physarum->arena.used;
+	float* layers = arenaAlloc(&physarum->arena, pixels * 4 * physarum->trailLayers * sizeof(float));
+	if (layers == NULL) return 0;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, physarum->trailMapTexture);
+	glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_FLOAT, layers);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	size_t i;
+	int species;
+	for (i = 0; i < pixels; i++){
+		for (species = 0; species < physarum->speciesCount; species++){
+			trailMap[i * physarum->speciesCount + species] = layers[(species / 4) * pixels * 4 + i * 4 + species % 4];
+		}
+	}
+	physarum->arena.used = used;
+	return snapshotSize;
+}
+
+int physarumRestore(Physarum* physarum, const void* buffer, size_t size){
+	SnapshotHeader header;
+	if (size < sizeof(header)){
+		return -1;
+	}
+	memcpy(&header, buffer, sizeof(header));
+	if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.width != COLUMNS || header.height != ROWS || header.agentSize != physarum->agentSize
+		|| header.speciesCount < 1 || header.speciesCount > MAX_SPECIES || header.agentCount < 0){
+		printf("Snapshot does not fit this simulation\n");
+		return -1;
+	}
+	size_t agentBytes = (size_t)header.agentCount * header.agentSize;
+	size_t pixels = (size_t)COLUMNS * ROWS;
+	if (size < sizeof(header) + agentBytes + pixels * header.speciesCount * sizeof(float)){
+		printf("Snapshot is truncated\n");
+		return -1;
+	}
+	const char* agents = (const char*)buffer + sizeof(header);
+	const float* trailMap = (const float*)(agents + agentBytes);
+	
+	// Pipeline, buffers and the cpu simulation for the settings of the snapshot, sized for its agents
+	memcpy(physarum->species, header.species, sizeof(physarum->species));
+	physarum->simulation = header.simulation;
+	physarum->simulation.species = header.speciesCount;
+	float agentsSetting = physarum->simulation.agents;
+	physarum->simulation.agents = header.agentCount;
+	updateSimulationSettings(physarum);
+	int status = physarumReset(physarum);
+	physarum->simulation.agents = agentsSetting;
+	updateSimulationSettings(physarum);
+	if (status != 0) return -2;
+	
+	// Then the state of the snapshot on top of the fresh spawn
+	memcpy(physarum->speciesCounts, header.speciesCounts, sizeof(physarum->speciesCounts));
+	physarum->agentCount = header.agentCount;
+	physarum->step = header.step;
+	physarum->seed = header.seed;
+	if (physarum->cpuSim){
+		memcpy(physarum->cpuSim->agents, agents, agentBytes);
+		physarum->cpuSim->agentCount = header.agentCount;
+		physarum->cpuSim->time = header.step;
+		memcpy(physarum->cpuSim->trailMap, trailMap, pixels * header.speciesCount * sizeof(float));
+		uploadTrailMap(physarum, physarum->cpuSim->trailMap);
+	}else{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, physarum->agentsSSBO);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, agentBytes, agents);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		
+		// The repacking buffer only lives for the upload
+		size_t used = physarum->arena.used;
+		physarum->upload = arenaAlloc(&physarum->arena, pixels * 4 * sizeof(float));
+		if (physarum->upload == NULL) return -1;
+		uploadTrailMap(physarum, trailMap);
+		physarum->upload = NULL;
+		physarum->arena.used = used;
+	}
+	return 0;
+}
+
+void physarumGetInfo(const Physarum* physarum, PhysarumInfo* info){
+	memset(info, 0, sizeof(PhysarumInfo));
+	info->agentCount = physarum->agentCount;
+	info->agentSize = physarum->agentSize;
+	info->speciesCount = physarum->speciesCount;
+	info->trailLayers = physarum->trailLayers;
+	info->step = physarum->step;
+	info->governed = physarum->governor != NULL;
+	info->stepsPerFrame = physarum->governor ? physarum->governor->stepsPerFrame : 1;
+	info->blurStep = physarum->governor ? physarum->governor->blurStep : 1;
+	info->activeFraction = physarum->governor ? physarum->governor->activeFraction : 1.0f;
+	info->agentGroup = physarum->agentGroup;
+	info->diffuseTile = physarum->diffuseTile;
+	info->agentChunk = physarum->agentChunk;
+	info->diffuseBands = physarum->diffuseBands;
+	info->diffuseScale = getDiffuseLevel((int)physarum->simulation.blurRadius, physarum->diffuseScale, &info->levelRadius);
+	info->tuned = physarum->tuned;
+	info->tunedStepTime = physarum->tunedStepTime;
+	info->tunedPath = physarum->tunedPath;
+	info->arenaSize = physarum->arena.size;
+	info->arenaPageKind = getArenaPageKindName(&physarum->arena);
+	info->pageFaults = getPageFaults();
+	if (physarum->pool){
+		cpuCountPages(physarum->cpuSim, info->trailPages, info->agentPages);
+	}
+}
@@ -0,0 +1,130 @@
+#ifndef PHYSARUM_H
+#define PHYSARUM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "settings.h"
+#include "capture.h"
+
+/*
+libphysarum: the simulation without window, tui or command line.
+Every function needs the OpenGL 4.3 context that the simulation was created in to be current
+(also with cpu set, the trailMap is drawn and recorded from a texture).
+Several simulations can share one context, each step binds its own buffers and textures.
+*/
+
+#define PHYSARUM_COLUMNS 1080	// size of the trailMap
+#define PHYSARUM_ROWS 720
+
+// A simulation, created by physarumCreate
+typedef struct Physarum Physarum;
+
+// Choices that are fixed for the lifetime of a simulation (the shaders are compiled for them)
+typedef struct PhysarumConfig{
+	int cpu;	// simulate on the cpu, OpenGL only draws and records
+	int threads;	// workers of the cpu simulation
+	int compactAgents;	// 8 instead of 16 bytes per agent
+	int fastTrig;	// sensor directions rotated from the forward direction with constants per species
+	int wrap;	// toroidal world
+	int pipeline;	// cpu: overlap the agent, deposit and diffuse phases of several steps band by band (same results)
+	int multiRate;	// slower species move less often and further (getStepPeriods in cpusim.h)
+	int diffusePeriod;	// steps from one diffuse and decay of the trailMap to the next (0 or 1: every step)
+	int diffuseScale;	// blur at up to 1 / diffuseScale resolution, deposits and sensing stay at full resolution (getDiffuseLevel in cpusim.h, 0 or 1: full)
+	int autotune;	// benchmark the gpu workgroup / cpu chunk sizes on the first run of a device, grid and agent count (autotune.h)
+	unsigned int seed;	// seed of the first spawn
+	double frameBudget;	// seconds of simulation work per physarumStepFrame, 0: no governor
+	FILE* governorLog;	// decisions of the governor (stderr if NULL)
+	const char* shaderDirectory;	// directory of the .glsl files (./src/shader if NULL)
+}PhysarumConfig;
+
+// Layout of a mapped trailMap: layers * height * width pixels of channels floats, row by row
+// One layer holds one channel per species (the cpu simulation and up to 4 species on the gpu),
+// otherwise every layer holds 4 species (the last one padded with zeros)
+typedef struct PhysarumTrailLayout{
+	int width, height, layers, channels;
+}PhysarumTrailLayout;
+
+// State of a simulation for reports
+typedef struct PhysarumInfo{
+	int agentCount, agentSize;	// agents in use, bytes per agent
+	int speciesCount, trailLayers;	// species the pipeline is built for, layers of the trailMap texture
+	unsigned int step;	// steps since the last reset or restore
+	int governed;	// created with a frame budget
+	int stepsPerFrame, blurStep;	// chosen by the governor (1 without one)
+	float activeFraction;	// part of the agents that move (1 without a governor)
+	int agentGroup, diffuseTile;	// gpu workgroup sizes of the agent step and the diffuse
+	int agentChunk, diffuseBands;	// cpu agents per chunk of the agent update, bands of rows per chunk of the diffuse
+	int diffuseScale, levelRadius;	// resolution divisor and blur radius of the diffuse with the current blur radius (1 and blur radius: full resolution)
+	int tuned;	// how autotune chose the work sizes above: 0 defaults, 1 benchmarked, 2 from the cache
+	double tunedStepTime;	// seconds per step with the benchmarked sizes
+	const char* tunedPath;	// cache the benchmarked sizes were saved to, "" if they were not
+	size_t arenaSize;	// bytes of the cpu memory arena
+	const char* arenaPageKind;
+	long pageFaults;	// of the process so far
+	long trailPages[2], agentPages[2];	// pages of the cpu simulation on the NUMA node of their worker / elsewhere (0 without workers)
+}PhysarumInfo;
+
+// Defaults: gpu, one thread, 16 byte agents, seed 0, no governor
+void physarumDefaultConfig(PhysarumConfig* config);
+
+// Create a simulation in the current OpenGL context and spawn its agents, NULL on failure
+Physarum* physarumCreate(const PhysarumConfig* config, const Species species[MAX_SPECIES], const Simulation* simulation);
+
+void physarumDestroy(Physarum* physarum);
+
+// Copy the settings into the simulation, they are used from the next step on
+// The agents setting adds / removes agents right away on the gpu; the number of species, the spawn modes
+// and the agents on the cpu take effect on the next reset
+void physarumSetSettings(Physarum* physarum, const Species species[MAX_SPECIES], const Simulation* simulation);
+
+void physarumGetSettings(const Physarum* physarum, Species species[MAX_SPECIES], Simulation* simulation);
+
+// Clear the trailMap and spawn all agents again with the current settings
+// Returns -1 if the memory of the cpu simulation could not be mapped, the simulation can only be destroyed then
+int physarumReset(Physarum* physarum);
+
+// Workers of the cpu simulation (ignored on the gpu)
+void physarumSetThreads(Physarum* physarum, int threads);
+
+// Advance the simulation by steps steps
+void physarumStep(Physarum* physarum, int steps);
+
+// Steps of one drawn frame: at most maxSteps, fewer if the governor needs to, returns the steps done
+int physarumStepFrame(Physarum* physarum, int maxSteps);
+
+// Wait for the last step and map the trailMap for reading, valid until physarumUnmapTrailMap
+// The cpu simulation hands out its own trailMap, the gpu simulation a mapped pixel pack buffer
+const float* physarumMapTrailMap(Physarum* physarum, PhysarumTrailLayout* layout);
+
+void physarumUnmapTrailMap(Physarum* physarum);
+
+// GL_TEXTURE_2D_ARRAY with the trailMap of the last step (4 species per layer), for clients that stay on the gpu
+unsigned int physarumGetTrailTexture(const Physarum* physarum);
+
+// Draw the trailMap with the species colors into the current framebuffer
+void physarumDraw(Physarum* physarum, int width, int height);
+
+// Hand every step to callback (asynchronous readback, see capture.h), NULL stops it
+void physarumSetFrameCallback(Physarum* physarum, FrameCallback callback, void* userData);
+
+// Wait for the frames in flight of the frame callback
+void physarumFlush(Physarum* physarum);
+
+// Bytes of a snapshot of the current state
+size_t physarumSnapshotSize(const Physarum* physarum);
+
+// Settings, agents, trailMap and step counter into buffer, returns the bytes written or 0 if size is too small
+// Snapshots of the cpu and gpu simulation have the same layout and can be restored into either
+size_t physarumSnapshot(Physarum* physarum, void* buffer, size_t size);
+
+// Continue from a snapshot, the agent format (compact or not) has to match, returns 0 on success
+// -1 if the snapshot does not fit, -2 if the reset for it failed like physarumReset (the simulation can only be destroyed then)
+int physarumRestore(Physarum* physarum, const void* buffer, size_t size);
+
+void physarumGetInfo(const Physarum* physarum, PhysarumInfo* info);
+
+// Agents of each of the first species species for count agents, the left over percent go to the last species in use
+void physarumGetSpeciesCounts(int count, int species, const Species speciesSettings[MAX_SPECIES], int speciesCounts[MAX_SPECIES]);
+
+#endif
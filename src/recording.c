@@ -0,0 +1,407 @@
+#include "recording.h"
+#include "lzblock.h"
+
+#include <time.h>
+#include <sys/types.h>
+
+static double getSeconds(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Grow a buffer to at least size bytes
+static void reserveBuffer(uint8_t** buffer, size_t* capacity, size_t size){
+	if (size <= *capacity) return;
+	*buffer = realloc(*buffer, size);
+	*capacity = size;
+}
+
+// Layers of the FrameCallback layout: one layer of channels values per pixel, above 4 channels layers of 4
+static void getLayers(int channels, int* layers, int* components){
+	*components = channels <= 4 ? channels : 4;
+	*layers = channels / *components;
+}
+
+// Tiles of all layers, the flags of a delta frame
+static size_t getTileCount(int width, int height, int channels){
+	int layers, components;
+	getLayers(channels, &layers, &components);
+	return (size_t)layers * ((width + RECORDING_TILE - 1) / RECORDING_TILE) * ((height + RECORDING_TILE - 1) / RECORDING_TILE);
+}
+
+/*----------------------------------*/
+
+// Changed tiles of current as differences to previous, returns the bytes in delta
+static size_t encodeDelta(const uint8_t* current, const uint8_t* previous, int width, int height, int channels, uint8_t* delta){
+	int layers, components;
+	getLayers(channels, &layers, &components);
+	uint8_t* flags = delta;
+	uint8_t* out = delta + getTileCount(width, height, channels);
+	size_t layerSize = (size_t)width * height * components;
+	int layer, tileX, tileY, y, i;
+	for (layer = 0; layer < layers; layer++){
+		for (tileY = 0; tileY < height; tileY += RECORDING_TILE){
+			for (tileX = 0; tileX < width; tileX += RECORDING_TILE){
+				int rows = height - tileY < RECORDING_TILE ? height - tileY : RECORDING_TILE;
+				int rowBytes = (width - tileX < RECORDING_TILE ? width - tileX : RECORDING_TILE) * components;
+				size_t start = layer * layerSize + ((size_t)tileY * width + tileX) * components;
+
+				int changed = 0;
+				for (y = 0; y < rows && !changed; y++){
+					changed = memcmp(current + start + (size_t)y * width * components, previous + start + (size_t)y * width * components, rowBytes) != 0;
+				}
+				*flags++ = (uint8_t)changed;
+				if (!changed) continue;
+				for (y = 0; y < rows; y++){
+					const uint8_t* row = current + start + (size_t)y * width * components;
+					const uint8_t* previousRow = previous + start + (size_t)y * width * components;
+					for (i = 0; i < rowBytes; i++){
+						out[i] = (uint8_t)(row[i] - previousRow[i]);
+					}
+					out += rowBytes;
+				}
+			}
+		}
+	}
+	return out - delta;
+}
+
+// Add the differences of the changed tiles in delta (size bytes) to pixels, returns 0 if delta does not fit the frame
+static int decodeDelta(uint8_t* pixels, const uint8_t* delta, size_t size, int width, int height, int channels){
+	int layers, components;
+	getLayers(channels, &layers, &components);
+	size_t tiles = getTileCount(width, height, channels);
+	if (size < tiles) return 0;
+	const uint8_t* flags = delta;
+	const uint8_t* in = delta + tiles, *end = delta + size;
+	size_t layerSize = (size_t)width * height * components;
+	int layer, tileX, tileY, y, i;
+	for (layer = 0; layer < layers; layer++){
+		for (tileY = 0; tileY < height; tileY += RECORDING_TILE){
+			for (tileX = 0; tileX < width; tileX += RECORDING_TILE){
+				if (!*flags++) continue;
+				int rows = height - tileY < RECORDING_TILE ? height - tileY : RECORDING_TILE;
+				int rowBytes = (width - tileX < RECORDING_TILE ? width - tileX : RECORDING_TILE) * components;
+				if ((size_t)(end - in) < (size_t)rows * rowBytes) return 0;
+				uint8_t* tile = pixels + layer * layerSize + ((size_t)tileY * width + tileX) * components;
+				for (y = 0; y < rows; y++){
+					uint8_t* row = tile + (size_t)y * width * components;
+					for (i = 0; i < rowBytes; i++){
+						row[i] = (uint8_t)(row[i] + in[i]);
+					}
+					in += rowBytes;
+				}
+			}
+		}
+	}
+	return in == end;
+}
+
+/*----------------------------------*/
+
+// Delta (or keyframe), compress and append a frame, runs on the writer thread
+static void writeQueuedFrame(Recorder* recorder, QueuedFrame* queued){
+	size_t size = (size_t)queued->width * queued->height * queued->channels;
+	recorder->rawBytes += size * sizeof(float);
+	if (recorder->failed) return;
+
+	// A reset with more species changes the frame size, the next frame cannot be a delta
+	int keyframe = recorder->frameCount == 0 || recorder->sinceKeyframe >= recorder->header.keyframeInterval
+		|| queued->width != recorder->width || queued->height != recorder->height || queued->channels != recorder->channels;
+	const uint8_t* data = queued->pixels;
+	size_t dataSize = size;
+	if (!keyframe){
+		reserveBuffer(&recorder->delta, &recorder->deltaCapacity, getTileCount(queued->width, queued->height, queued->channels) + size);
+		dataSize = encodeDelta(queued->pixels, recorder->previous, queued->width, queued->height, queued->channels, recorder->delta);
+		data = recorder->delta;
+	}
+	reserveBuffer(&recorder->compressed, &recorder->compressedCapacity, lzCompressBound(dataSize));
+
+	RecordedFrame header = {
+		.magic = RECORDING_FRAME_MAGIC,
+		.kind = keyframe ? RECORDING_KEYFRAME : RECORDING_DELTA,
+		.frame = queued->frame,
+		.width = queued->width,
+		.height = queued->height,
+		.channels = queued->channels,
+		.size = (uint32_t)lzCompress(data, dataSize, recorder->compressed)
+	};
+	if (keyframe){
+		if (recorder->keyframeCount == recorder->keyframeCapacity){
+			recorder->keyframeCapacity = recorder->keyframeCapacity ? recorder->keyframeCapacity * 2 : 64;
+			recorder->keyframes = realloc(recorder->keyframes, recorder->keyframeCapacity * sizeof(RecordingKeyframe));
+		}
+		recorder->keyframes[recorder->keyframeCount++] = (RecordingKeyframe){recorder->frameCount, recorder->offset};
+		recorder->sinceKeyframe = 0;
+	}
+	if (fwrite(&header, sizeof(header), 1, recorder->file) != 1 || fwrite(recorder->compressed, 1, header.size, recorder->file) != header.size){
+		printf("Failed to write the recording, the remaining frames are dropped\n");
+		recorder->failed = 1;
+		return;
+	}
+	recorder->offset += sizeof(header) + header.size;
+	recorder->frameCount++;
+	recorder->sinceKeyframe++;
+
+	// This frame is the base of the next delta, the queue slot takes the old buffer
+	uint8_t* pixels = recorder->previous;
+	size_t capacity = recorder->previousCapacity;
+	recorder->previous = queued->pixels;
+	recorder->previousCapacity = queued->capacity;
+	queued->pixels = pixels;
+	queued->capacity = capacity;
+	recorder->width = queued->width;
+	recorder->height = queued->height;
+	recorder->channels = queued->channels;
+}
+
+static void* writerMain(void* arg){
+	Recorder* recorder = arg;
+	pthread_mutex_lock(&recorder->mutex);
+	while (1){
+		while (recorder->queued == 0 && !recorder->stop){
+			pthread_cond_wait(&recorder->queuedCondition, &recorder->mutex);
+		}
+		if (recorder->queued == 0) break;	// stopped and everything is written
+		QueuedFrame* queued = &recorder->queue[recorder->head];
+		pthread_mutex_unlock(&recorder->mutex);
+
+		writeQueuedFrame(recorder, queued);
+
+		pthread_mutex_lock(&recorder->mutex);
+		recorder->head = (recorder->head + 1) % RECORDING_QUEUE;
+		recorder->queued--;
+		pthread_cond_signal(&recorder->freeCondition);
+	}
+	pthread_mutex_unlock(&recorder->mutex);
+	return NULL;
+}
+
+int createRecorder(Recorder* recorder, const char* path, int keyframeInterval, const Species species[MAX_SPECIES], int speciesCount){
+	memset(recorder, 0, sizeof(Recorder));
+	recorder->file = fopen(path, "wb");
+	if (recorder->file == NULL){
+		return -1;
+	}
+	recorder->header.magic = RECORDING_MAGIC;
+	recorder->header.version = RECORDING_VERSION;
+	recorder->header.keyframeInterval = keyframeInterval > 0 ? keyframeInterval : RECORDING_KEYFRAMES;
+	recorder->header.tileSize = RECORDING_TILE;
+	recorder->header.speciesCount = speciesCount;
+	int s;
+	for (s = 0; s < speciesCount && s < MAX_SPECIES; s++){
+		recorder->header.colors[s][0] = species[s].r;
+		recorder->header.colors[s][1] = species[s].g;
+		recorder->header.colors[s][2] = species[s].b;
+	}
+	if (fwrite(&recorder->header, sizeof(RecordingHeader), 1, recorder->file) != 1){
+		fclose(recorder->file);
+		return -1;
+	}
+	recorder->offset = sizeof(RecordingHeader);
+
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->queuedCondition, NULL);
+	pthread_cond_init(&recorder->freeCondition, NULL);
+	if (pthread_create(&recorder->thread, NULL, writerMain, recorder) != 0){
+		fclose(recorder->file);
+		return -1;
+	}
+	return 0;
+}
+
+void recordFrame(const float* pixels, int width, int height, int channels, long frame, void* userData){
+	Recorder* recorder = (Recorder*)userData;
+	pthread_mutex_lock(&recorder->mutex);
+	if (recorder->queued == RECORDING_QUEUE){
+		double start = getSeconds();
+		while (recorder->queued == RECORDING_QUEUE){
+			pthread_cond_wait(&recorder->freeCondition, &recorder->mutex);
+		}
+		recorder->waitTime += getSeconds() - start;
+	}
+	// The writer only touches the queued slots, this one is ours until it is queued
+	QueuedFrame* queued = &recorder->queue[(recorder->head + recorder->queued) % RECORDING_QUEUE];
+	pthread_mutex_unlock(&recorder->mutex);
+
+	size_t size = (size_t)width * height * channels, i;
+	reserveBuffer(&queued->pixels, &queued->capacity, size);
+	// Rounded, clamped with compares (fminf / fmaxf are library calls without -ffast-math)
+	for (i = 0; i < size; i++){
+		float value = pixels[i] * 255.0f + 0.5f;
+		queued->pixels[i] = value >= 255.0f ? 255 : (value > 0.0f ? (uint8_t)value : 0);
+	}
+	queued->width = width;
+	queued->height = height;
+	queued->channels = channels;
+	queued->frame = frame;
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->queued++;
+	pthread_cond_signal(&recorder->queuedCondition);
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+int closeRecorder(Recorder* recorder){
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->stop = 1;
+	pthread_cond_signal(&recorder->queuedCondition);
+	pthread_mutex_unlock(&recorder->mutex);
+	pthread_join(recorder->thread, NULL);
+
+	// Index, then the header again with its offset
+	int failed = recorder->failed;
+	if (!failed){
+		uint32_t indexHeader[2] = {RECORDING_INDEX_MAGIC, (uint32_t)recorder->keyframeCount};
+		recorder->header.indexOffset = recorder->offset;
+		recorder->header.frameCount = recorder->frameCount;
+		failed = fwrite(indexHeader, sizeof(indexHeader), 1, recorder->file) != 1
+			|| fwrite(recorder->keyframes, sizeof(RecordingKeyframe), recorder->keyframeCount, recorder->file) != (size_t)recorder->keyframeCount
+			|| fseeko(recorder->file, 0, SEEK_SET) != 0
+			|| fwrite(&recorder->header, sizeof(RecordingHeader), 1, recorder->file) != 1;
+	}
+	failed |= fclose(recorder->file) != 0;
+
+	pthread_mutex_destroy(&recorder->mutex);
+	pthread_cond_destroy(&recorder->queuedCondition);
+	pthread_cond_destroy(&recorder->freeCondition);
+	int i;
+	for (i = 0; i < RECORDING_QUEUE; i++){
+		free(recorder->queue[i].pixels);
+	}
+	free(recorder->previous);
+	free(recorder->delta);
+	free(recorder->compressed);
+	free(recorder->keyframes);
+	return failed ? -1 : 0;
+}
+
+/*----------------------------------*/
+
+// Keyframes and frame count of a recording that was not closed: walk the frame headers up to the first incomplete frame
+static void scanRecording(RecordingReader* reader){
+	uint64_t offset = sizeof(RecordingHeader);
+	long capacity = 0;
+	RecordedFrame header;
+	fseeko(reader->file, 0, SEEK_END);
+	uint64_t fileSize = ftello(reader->file);
+	fseeko(reader->file, offset, SEEK_SET);
+	while (fread(&header, sizeof(header), 1, reader->file) == 1 && header.magic == RECORDING_FRAME_MAGIC
+		&& offset + sizeof(header) + header.size <= fileSize){
+		if (header.kind == RECORDING_KEYFRAME){
+			if (reader->keyframeCount == capacity){
+				capacity = capacity ? capacity * 2 : 64;
+				reader->keyframes = realloc(reader->keyframes, capacity * sizeof(RecordingKeyframe));
+			}
+			reader->keyframes[reader->keyframeCount++] = (RecordingKeyframe){reader->frameCount, offset};
+		}
+		reader->frameCount++;
+		offset += sizeof(header) + header.size;
+		fseeko(reader->file, offset, SEEK_SET);
+	}
+	reader->dataEnd = offset;
+}
+
+int openRecording(RecordingReader* reader, const char* path){
+	memset(reader, 0, sizeof(RecordingReader));
+	reader->number = -1;
+	reader->file = fopen(path, "rb");
+	if (reader->file == NULL){
+		return -1;
+	}
+	if (fread(&reader->header, sizeof(RecordingHeader), 1, reader->file) != 1 || reader->header.magic != RECORDING_MAGIC
+		|| reader->header.version != RECORDING_VERSION || reader->header.tileSize != RECORDING_TILE){
+		fclose(reader->file);
+		return -1;
+	}
+
+	uint32_t indexHeader[2];
+	if (reader->header.indexOffset != 0 && fseeko(reader->file, reader->header.indexOffset, SEEK_SET) == 0
+		&& fread(indexHeader, sizeof(indexHeader), 1, reader->file) == 1 && indexHeader[0] == RECORDING_INDEX_MAGIC){
+		reader->keyframeCount = indexHeader[1];
+		reader->keyframes = malloc((reader->keyframeCount > 0 ? reader->keyframeCount : 1) * sizeof(RecordingKeyframe));
+		if (fread(reader->keyframes, sizeof(RecordingKeyframe), reader->keyframeCount, reader->file) == (size_t)reader->keyframeCount){
+			reader->frameCount = (long)reader->header.frameCount;
+			reader->dataEnd = reader->header.indexOffset;
+		}else{
+			reader->keyframeCount = 0;
+			scanRecording(reader);
+		}
+	}else{
+		scanRecording(reader);
+	}
+	fseeko(reader->file, sizeof(RecordingHeader), SEEK_SET);
+	return 0;
+}
+
+int readRecordedFrame(RecordingReader* reader){
+	if (ftello(reader->file) >= (off_t)reader->dataEnd) return 0;
+	RecordedFrame header;
+	if (fread(&header, sizeof(header), 1, reader->file) != 1) return 0;
+	if (header.magic != RECORDING_FRAME_MAGIC) return -1;
+
+	size_t size = (size_t)header.width * header.height * header.channels;
+	int keyframe = header.kind == RECORDING_KEYFRAME;
+	// A delta needs the frame before it in the same size
+	if (!keyframe && (header.kind != RECORDING_DELTA || reader->number < 0 || (int)header.width != reader->width
+		|| (int)header.height != reader->height || (int)header.channels != reader->channels)){
+		return -1;
+	}
+	reserveBuffer(&reader->compressed, &reader->compressedCapacity, header.size);
+	if (fread(reader->compressed, 1, header.size, reader->file) != header.size) return -1;
+
+	if (keyframe){
+		reserveBuffer(&reader->pixels, &reader->pixelCapacity, size);
+		if (lzDecompress(reader->compressed, header.size, reader->pixels, size) != size) return -1;
+	}else{
+		size_t deltaSize = getTileCount(header.width, header.height, header.channels) + size;
+		reserveBuffer(&reader->delta, &reader->deltaCapacity, deltaSize);
+		deltaSize = lzDecompress(reader->compressed, header.size, reader->delta, deltaSize);
+		if (deltaSize == 0 || !decodeDelta(reader->pixels, reader->delta, deltaSize, header.width, header.height, header.channels)) return -1;
+	}
+	reader->width = header.width;
+	reader->height = header.height;
+	reader->channels = header.channels;
+	reader->frame = (long)header.frame;
+	reader->number++;
+	return 1;
+}
+
+int seekRecording(RecordingReader* reader, long number){
+	if (number < 0 || number >= reader->frameCount) return -1;
+	// Last keyframe at or before number
+	long low = 0, high = reader->keyframeCount - 1;
+	if (high < 0 || (long)reader->keyframes[0].number > number) return -1;
+	while (low < high){
+		long middle = (low + high + 1) / 2;
+		if ((long)reader->keyframes[middle].number <= number) low = middle; else high = middle - 1;
+	}
+	// Decoding on from the current frame is cheaper if it is past that keyframe
+	if (reader->number < (long)reader->keyframes[low].number || reader->number > number){
+		if (fseeko(reader->file, reader->keyframes[low].offset, SEEK_SET) != 0) return -1;
+		reader->number = (long)reader->keyframes[low].number - 1;
+	}
+	while (reader->number < number){
+		if (readRecordedFrame(reader) != 1) return -1;
+	}
+	return 0;
+}
+
+void getRecordedPixels(const RecordingReader* reader, float* pixels){
+	size_t size = (size_t)reader->width * reader->height * reader->channels, i;
+	for (i = 0; i < size; i++){
+		pixels[i] = reader->pixels[i] * (1.0f / 255.0f);
+	}
+}
+
+void closeRecording(RecordingReader* reader){
+	if (reader->file){
+		fclose(reader->file);
+	}
+	free(reader->keyframes);
+	free(reader->pixels);
+	free(reader->delta);
+	free(reader->compressed);
+	memset(reader, 0, sizeof(RecordingReader));
+}
@@ -0,0 +1,130 @@
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "settings.h"
+
+#define RECORDING_MAGIC 0x43524850	// "PHRC"
+#define RECORDING_FRAME_MAGIC 0x454d5246	// "FRME"
+#define RECORDING_INDEX_MAGIC 0x58444e49	// "INDX"
+#define RECORDING_VERSION 1
+#define RECORDING_TILE 64	// pixels per side of the tiles of a delta frame
+#define RECORDING_KEYFRAMES 64	// default frames from one keyframe to the next
+#define RECORDING_QUEUE 8	// frames waiting for the writer thread, the simulation only waits if the writer is that far behind
+
+// Kinds of frames
+#define RECORDING_KEYFRAME 1	// the whole frame
+#define RECORDING_DELTA 2	// the tiles that changed since the frame before
+
+/*
+Layout of a recording (little endian): RecordingHeader, frames, keyframe index.
+Every frame is a RecordedFrame and size bytes of LZ4 block (lzblock.h) compressed data.
+Trails are quantized to 8 bit (0..1 -> 0..255) in the layout of the FrameCallback (capture.h): channels values per pixel,
+above 4 channels layers of 4. A keyframe holds these bytes. A delta frame holds one byte per tile (1: changed) and then
+the changed tiles row by row, each byte as the difference to the frame before (mod 256), so repeated trails become
+runs of zeros that compress well. The index after the last frame lists the offsets of the keyframes; a recording that was
+not closed has indexOffset 0 and is indexed by reading the frame headers.
+*/
+typedef struct RecordingHeader{
+	uint32_t magic, version;
+	uint32_t keyframeInterval, tileSize;
+	uint32_t speciesCount, padding;
+	float colors[MAX_SPECIES][3];	// species colors at the start, playback colorizes with them
+	uint64_t indexOffset;	// file offset of the keyframe index, 0 until the recording is closed
+	uint64_t frameCount;	// frames in the recording, written on close
+}RecordingHeader;
+
+typedef struct RecordedFrame{
+	uint32_t magic;	// RECORDING_FRAME_MAGIC
+	uint32_t kind;	// RECORDING_KEYFRAME or RECORDING_DELTA
+	uint64_t frame;	// number of the frame in the capture
+	uint32_t width, height, channels;
+	uint32_t size;	// compressed bytes that follow
+}RecordedFrame;
+
+typedef struct RecordingKeyframe{
+	uint64_t number;	// frames before it in the recording
+	uint64_t offset;	// file offset of its RecordedFrame
+}RecordingKeyframe;
+
+// A quantized frame waiting for the writer thread
+typedef struct QueuedFrame{
+	uint8_t* pixels;
+	size_t capacity;
+	int width, height, channels;
+	long frame;
+}QueuedFrame;
+
+// Writes a recording on a background thread
+typedef struct Recorder{
+	FILE* file;
+	RecordingHeader header;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t queuedCondition, freeCondition;
+	QueuedFrame queue[RECORDING_QUEUE];
+	int head, queued;	// oldest frame, frames in the queue
+	int stop;
+	double waitTime;	// seconds the simulation waited for a free slot
+	// Writer thread
+	uint8_t* previous;	// last frame written, the base of the next delta
+	size_t previousCapacity;
+	int width, height, channels;	// of previous
+	uint8_t* delta;	// tile flags and differences
+	uint8_t* compressed;
+	size_t deltaCapacity, compressedCapacity;
+	uint64_t offset;	// bytes written
+	uint64_t frameCount, sinceKeyframe;
+	RecordingKeyframe* keyframes;
+	long keyframeCount, keyframeCapacity;
+	uint64_t rawBytes;	// the same frames as float32 (--record without compression)
+	int failed;	// a write failed, the rest is dropped
+}Recorder;
+
+// Reads a recording frame by frame or from any keyframe on
+typedef struct RecordingReader{
+	FILE* file;
+	RecordingHeader header;
+	RecordingKeyframe* keyframes;
+	long keyframeCount;
+	long frameCount;
+	uint64_t dataEnd;	// offset after the last complete frame
+	// Current frame
+	long number;	// index of the frame in pixels, -1 before the first
+	long frame;	// its number in the capture
+	int width, height, channels;
+	uint8_t* pixels;	// quantized
+	uint8_t* delta;
+	uint8_t* compressed;
+	size_t pixelCapacity, deltaCapacity, compressedCapacity;
+}RecordingReader;
+
+// Create path and start the writer thread, keyframeInterval: frames from one keyframe to the next, returns 0 on success
+int createRecorder(Recorder* recorder, const char* path, int keyframeInterval, const Species species[MAX_SPECIES], int speciesCount);
+
+// FrameCallback (capture.h) with a Recorder as userData: quantize the frame and queue it for the writer thread
+void recordFrame(const float* pixels, int width, int height, int channels, long frame, void* userData);
+
+// Write the queued frames and the keyframe index, returns 0 if everything was written (the counters stay valid)
+int closeRecorder(Recorder* recorder);
+
+// Open a recording and find its keyframes, returns 0 on success
+int openRecording(RecordingReader* reader, const char* path);
+
+// Decode the next frame, returns 1 on success, 0 at the end, -1 if the recording is corrupt
+int readRecordedFrame(RecordingReader* reader);
+
+// Decode frame number (from the last keyframe at or before it, or on from the current frame), returns 0 on success
+int seekRecording(RecordingReader* reader, long number);
+
+// Current frame as floats in the layout of the FrameCallback (width * height * channels)
+void getRecordedPixels(const RecordingReader* reader, float* pixels);
+
+void closeRecording(RecordingReader* reader);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#define MAX_SPECIES 16	// Shaders are compiled for the number of species in use
+
+typedef enum Mode{
+	CENTER, CIRCLE, RING, RANDOM, ICIRCLE
+}Mode;
+
+typedef struct Agent{
+	float x, y, angle;
+	int speciesIdx; // 0 to MAX_SPECIES - 1
+}Agent;
+
+// 8 byte agent (--compact-agents): x and y as 22 bit fixed point fractions of the world size, 16 bit angle, 4 bit species
+typedef struct CompactAgent{
+	unsigned int xAngle;	// x << 10 | angle >> 6
+	unsigned int yAngleSpecies;	// y << 10 | (angle & 63) << 4 | speciesIdx
+}CompactAgent;
+
+typedef struct SpeciesSettings{
+	Mode spawnMode;
+	float sensorSize, 
+		sensorOffsetDistance, 
+		sensorAngle, 
+		turnSpeed, 
+		moveSpeed,
+		r, g, b,
+		percent;	// species in percent of all agents
+}Species;
+
+typedef struct SimulationSettings{
+	float agents, 
+		species,	// number of species
+		fps, fpsoff,
+		avoid, 
+		blurRadius,
+		trailWeight, 
+		diffuseWeight, 
+		decayRate;
+}Simulation;
+
+#endif
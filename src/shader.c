@@ -48,11 +48,21 @@ char* file2Str(const char* path){	// returns allocated memory pointer, must free
 	return str;	// free str after use;
 }
 
-unsigned int createComputeShader(const char* computeShaderFilePath){
+void shaderSourceWithDefines(unsigned int shader, const char* source, const char* defines){
+	// "#version" has to stay the first line, defines go right after it
+	const char* body = strchr(source, '\n');
+	body = body ? body + 1 : source + strlen(source);
+	
+	const char* sources[] = {source, defines ? defines : "", body};
+	int lengths[] = {(int)(body - source), -1, -1};	// -1: null terminated
+	glShaderSource(shader, 3, sources, lengths);
+}
+
+unsigned int createComputeShader(const char* computeShaderFilePath, const char* defines){
 	char* computeShaderSource = file2Str(computeShaderFilePath);
 	
 	unsigned int computeShader = glCreateShader(GL_COMPUTE_SHADER);
-	glShaderSource(computeShader, 1, (const char* const*)&computeShaderSource, NULL);
+	shaderSourceWithDefines(computeShader, computeShaderSource, defines);
 	glCompileShader(computeShader);
 	
 	checkCompileError(computeShader, "COMPUTE");
@@ -69,19 +79,19 @@ unsigned int createComputeShader(const char* computeShaderFilePath){
 	return computeProgram;
 }
 
-unsigned int createShader(const char* vertexShaderFilePath, const char* fragmentShaderFilePath){
+unsigned int createShader(const char* vertexShaderFilePath, const char* fragmentShaderFilePath, const char* defines){
 	char* vertexShaderSource = file2Str(vertexShaderFilePath);
 	char* fragmentShaderSource = file2Str(fragmentShaderFilePath);
 	
 	unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vertexShader, 1, (const char* const*)&vertexShaderSource, NULL);
+	shaderSourceWithDefines(vertexShader, vertexShaderSource, defines);
 	glCompileShader(vertexShader);
 	
 	// Check for shader compile errors
 	checkCompileError(vertexShader, "VERTEX");
 	
 	unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragmentShader, 1, (const char* const*)&fragmentShaderSource, NULL);
+    shaderSourceWithDefines(fragmentShader, fragmentShaderSource, defines);
     glCompileShader(fragmentShader);
 	
 	// Check for shader compile errors
@@ -14,8 +14,11 @@ void checkLinkingError(unsigned int program);
 
 char* file2Str(const char* path);
 
-unsigned int createComputeShader(const char* computeShaderFilePath);
+// Set the source of shader, defines (e.g. "#define SPECIES_COUNT 3\n") are inserted after the #version line
+void shaderSourceWithDefines(unsigned int shader, const char* source, const char* defines);
 
-unsigned int createShader(const char* vertexShaderFilePath, const char* fragmentShaderFilePath);
+unsigned int createComputeShader(const char* computeShaderFilePath, const char* defines);
+
+unsigned int createShader(const char* vertexShaderFilePath, const char* fragmentShaderFilePath, const char* defines);
 
 #endif
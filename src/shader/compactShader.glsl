@@ -0,0 +1,75 @@
+#version 430 core
+
+// >! For comments see "computeShader.glsl"
+struct Agent{
+	float x, y;
+	float angle;
+	int speciesIdx;
+};
+
+#ifdef COMPACT_AGENTS
+layout(binding = 2, std430) buffer agents{
+	uvec2 dataMap[];
+};
+
+int loadSpecies(int i){
+	return int(dataMap[i].y & 15u);
+}
+#else
+layout(binding = 2, std430) buffer agents{
+	Agent dataMap[];
+};
+
+int loadSpecies(int i){
+	return dataMap[i].speciesIdx;
+}
+#endif
+
+// !<
+
+// Removes agents per species from the agent buffer with swap-compaction in two passes:
+// pass 0 marks removed agents behind newCount in a bit mask and collects the holes in front of newCount,
+// pass 1 moves the remaining agents behind newCount into the holes
+// (compact agents have no spare species value to mark removed agents with)
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+layout(binding = 5, std430) buffer compaction{
+	uint seen[MAX_SPECIES];	// agents of each species visited in pass 0
+	uint holeCount;
+	uint moverCount;
+	uint holes[];	// indices < newCount of removed agents, followed by the bit mask of removed agents >= newCount
+};
+
+uniform int pass;
+uniform int oldCount;
+uniform int newCount;
+// Start of the bit mask in holes (number of removed agents)
+uniform int maskOffset;
+// Number of agents to remove from each species
+uniform uint removeCounts[MAX_SPECIES];
+
+void main(){
+	int i = int(gl_GlobalInvocationID.x);
+	
+	if (pass == 0){
+		if (i >= oldCount) return;
+		
+		int speciesIdx = loadSpecies(i);
+		// The first removeCounts[s] agents of species s that get here are removed
+		if (atomicAdd(seen[speciesIdx], 1) < removeCounts[speciesIdx]){
+			if (i < newCount){
+				holes[atomicAdd(holeCount, 1)] = uint(i);
+			}else{
+				atomicOr(holes[maskOffset + (i - newCount) / 32], 1u << ((i - newCount) % 32));
+			}
+		}
+	}else{
+		// There are exactly as many remaining agents behind newCount as holes in front of it
+		i += newCount;
+		if (i >= oldCount) return;
+		
+		if ((holes[maskOffset + (i - newCount) / 32] & (1u << ((i - newCount) % 32))) == 0){
+			dataMap[holes[atomicAdd(moverCount, 1)]] = dataMap[i];
+		}
+	}
+}
@@ -9,7 +9,7 @@ struct Agent{
 	float x, y;
 	// The angle the agent is facing, in radians
 	float angle;
-	// The index of the species the agent belongs to (3 species are supported)
+	// The index of the species the agent belongs to (0 to SPECIES_COUNT - 1)
 	int speciesIdx;
 };
 
@@ -29,14 +29,16 @@ struct SpeciesSettings{
   float moveSpeed;
   // The red, green, and blue values of this species (used for visualization)
   float r, g, b;
+  // Species in percentage to the total number of agents
+  float percent;
 };
 
 // Define a structure to represent the settings for the simulation
 struct SimulationSettings{
   // The number of agents in the simulation
   float agents;
-  // Species in percentage to the total number of agents
-  float s1inp, s2inp, s3inp;
+  // The number of species in the simulation
+  float species;
   // The number of frames per second the simulation should run at
   float fps;
   // A flag indicating whether the fps limit is on (0) or off (1)
@@ -54,13 +56,12 @@ struct SimulationSettings{
 };
 
 // Declare the layout of the compute shader
-layout(local_size_x = 16, local_size_y = 1, local_size_z = 1) in;
-// Declare the image2D uniform for the trail map, and bind it to binding point 1
-layout(binding = 1, rgba32f) uniform image2D trailMap;
-// Declare the buffer for the agents, and bind it to binding point 2
-layout(binding = 2, std430) buffer agents{
-	Agent dataMap[];
-};
+// AGENT_GROUP agents per workgroup (tuned by physarum.c), the last workgroup is cut off at agentCount
+layout(local_size_x = AGENT_GROUP, local_size_y = 1, local_size_z = 1) in;
+// SPECIES_COUNT, TRAIL_LAYERS and TRAIL_FORMAT are defined by main.c when the shader is compiled:
+// every species has one channel in the trail map, 4 channels are packed into each layer
+// Declare the image2DArray uniform for the trail map, and bind it to binding point 1
+layout(binding = 1, TRAIL_FORMAT) uniform image2DArray trailMap;
 // Declare the buffer for the species settings, and bind it to binding point 3
 layout(binding = 3, std430) buffer speciesSettings{
 	SpeciesSettings settings[];
@@ -72,9 +73,74 @@ layout(binding = 4, std430) buffer simulationSettings{
 
 // Declare a uniform integer for the current time
 uniform int time;
+// Agents in use, the invocations of the last workgroup beyond it do nothing
+uniform int agentCount;
+
+#ifdef GOVERNOR
+// Agents move in blocks of ACTIVE_BLOCK, a block moves if the upper 16 bits of its hash are below activeThreshold (65536: all)
+uniform uint activeThreshold;
+#endif
+
+#ifdef MULTI_RATE
+// Steps between the updates of each species (getStepPeriods in cpusim.c), set by main.c before every step
+uniform int stepPeriods[MAX_SPECIES];
+#endif
+
+#ifdef FAST_TRIG
+// cos / sin of the sensor angle and the turn speed in radians of each species, set by main.c before every step
+uniform vec2 sensorRotation[MAX_SPECIES];
+uniform float turnRadians[MAX_SPECIES];
+
+// Rotate direction by the angle with (cos, sin) = rotation
+vec2 rotate(vec2 direction, vec2 rotation){
+	return vec2(direction.x * rotation.x - direction.y * rotation.y, direction.x * rotation.y + direction.y * rotation.x);
+}
+#endif
 
 // Declare a variable for the size of the trail map image
-ivec2 imgSize = imageSize(trailMap);
+ivec2 imgSize = imageSize(trailMap).xy;
+
+#ifdef COMPACT_AGENTS
+// 8 byte agents: x and y as 22 bit fixed point fractions of the trail map size, 16 bit angle, 4 bit species
+// word 0: x << 10 | angle >> 6, word 1: y << 10 | (angle & 63) << 4 | speciesIdx
+layout(binding = 2, std430) buffer agents{
+	uvec2 dataMap[];
+};
+
+// Number of fixed point steps across the trail map (2^22)
+#define FIXED_SCALE 4194304.0
+
+Agent loadAgent(int i){
+	uvec2 data = dataMap[i];
+	Agent agent;
+	agent.x = float(data.x >> 10) * (float(imgSize.x) / FIXED_SCALE);
+	agent.y = float(data.y >> 10) * (float(imgSize.y) / FIXED_SCALE);
+	agent.angle = float(((data.x & 1023u) << 6) | ((data.y >> 4) & 63u)) * (2 * PI / 65536.0);
+	agent.speciesIdx = int(data.y & 15u);
+	return agent;
+}
+
+void storeAgent(int i, Agent agent){
+	// Round to the nearest step, truncating would drift towards 0 a little every step
+	uint x = min(uint(agent.x * (FIXED_SCALE / float(imgSize.x)) + 0.5), 4194303u);
+	uint y = min(uint(agent.y * (FIXED_SCALE / float(imgSize.y)) + 0.5), 4194303u);
+	uint angle = uint(fract(agent.angle / (2 * PI)) * 65536.0 + 0.5) & 65535u;
+	dataMap[i] = uvec2((x << 10) | (angle >> 6), (y << 10) | ((angle & 63u) << 4) | uint(agent.speciesIdx));
+}
+#else
+// Declare the buffer for the agents, and bind it to binding point 2
+layout(binding = 2, std430) buffer agents{
+	Agent dataMap[];
+};
+
+Agent loadAgent(int i){
+	return dataMap[i];
+}
+
+void storeAgent(int i, Agent agent){
+	dataMap[i] = agent;
+}
+#endif
 
 // Hash function www.cs.ubc.ca/~rbridson/docs/schechter-sca08-turbulence.pdf
 // Define a hash function to generate a random number from a given input
@@ -95,13 +161,29 @@ float scaleToRange01(uint num){
     return float(num) / 4294967295.0;
 }
 
-// Declare a function to sense the environment based on the agent's species, position, and orientation
-float sense(Agent agent, vec3 speciesMask, float sensorAngleOffset){
-	// Calculate the angle of the sensor by adding the angle offset to the agent's current angle
-	float sensorAngle = agent.angle + sensorAngleOffset;
-	// Calculate the direction of the sensor based on the sensor an
-	
-	vec2 sensorDir = vec2(cos(sensorAngle), sin(sensorAngle));
+#ifdef WRAP
+// Coordinate at most one trail map size outside of the trail map wrapped around, selects instead of a modulo or branches
+ivec2 wrapCoord(ivec2 coord){
+	return coord + imgSize * (ivec2(lessThan(coord, ivec2(0))) - ivec2(greaterThanEqual(coord, imgSize)));
+}
+#endif
+
+// Define a function to read the trail of the agent's species and the sum of the trails of all species at a pixel
+vec2 loadTrail(ivec2 coord, int speciesIdx){
+	float own = 0.0, total = 0.0;
+	for (int layer = 0; layer < TRAIL_LAYERS; layer++){
+		vec4 trail = imageLoad(trailMap, ivec3(coord, layer));
+		// Unused channels of the last layer are always 0
+		total += trail.r + trail.g + trail.b + trail.a;
+		if (layer == speciesIdx / 4){
+			own = trail[speciesIdx % 4];
+		}
+	}
+	return vec2(own, total);
+}
+
+// Declare a function to sense the environment based on the agent's species, position, and the direction of the sensor
+float sense(Agent agent, vec2 sensorDir){
 	// Calculate the center position of the sensor based on the agent's position and the sensor offset distance
 	ivec2 sensorCenter = ivec2(vec2(agent.x, agent.y) + sensorDir * settings[agent.speciesIdx].sensorOffsetDistance);
 
@@ -112,76 +194,126 @@ float sense(Agent agent, vec3 speciesMask, float sensorAngleOffset){
 	for (int offsetX = -sensorSize; offsetX <= sensorSize; offsetX ++) {
 		for (int offsetY = -sensorSize; offsetY <= sensorSize; offsetY ++) {
 			// Calculate the x and y positions of the current pixel relative to the center of the sensor
-			int sampleX = int(min(imgSize.x - 1.0, max(0.0, sensorCenter.x + offsetX)));
-			int sampleY = int(min(imgSize.y - 1.0, max(0.0, sensorCenter.y + offsetY)));
+#ifdef WRAP
+			// Wrap around to the opposite edge, sensors reach less than the trail map size
+			ivec2 sampleCoord = wrapCoord(sensorCenter + ivec2(offsetX, offsetY));
+#else
+			ivec2 sampleCoord = ivec2(min(imgSize.x - 1.0, max(0.0, sensorCenter.x + offsetX)), min(imgSize.y - 1.0, max(0.0, sensorCenter.y + offsetY)));
+#endif
 			
-			// If the avoid flag is set, use the dot product to avoid other species
+			vec2 trail = loadTrail(sampleCoord, agent.speciesIdx);
+			// If the avoid flag is set, follow the own species (+1) and avoid all others (-1)
 			if (simSettings.avoid == 1){
-				sum += dot(speciesMask * 2 - 1, imageLoad(trailMap, ivec2(sampleX, sampleY)).rgb);
+				sum += 2.0 * trail.x - trail.y;
 			}
-			// Otherwise, sum the values of the red, green, and blue channels of the current pixel
+			// Otherwise, sum the trails of all species at the current pixel
 			else{
-				sum += imageLoad(trailMap, ivec2(sampleX, sampleY)).r;
-				sum += imageLoad(trailMap, ivec2(sampleX, sampleY)).g;
-				sum += imageLoad(trailMap, ivec2(sampleX, sampleY)).b;
+				sum += trail.y;
 			}
 		}
 	}
 	return sum;
 }
 
+// Leave a trail in the channel of the species
+void deposit(ivec2 coord, int speciesIdx){
+	ivec3 trailCoord = ivec3(coord, speciesIdx / 4);
+	vec4 trail = imageLoad(trailMap, trailCoord);
+#ifdef MULTI_RATE
+	// The trail of all steps since the last update of the species
+	float trailWeight = simSettings.trailWeight * float(stepPeriods[speciesIdx]);
+#else
+	float trailWeight = simSettings.trailWeight;
+#endif
+	trail[speciesIdx % 4] = min(1.0, trail[speciesIdx % 4] + trailWeight);
+	imageStore(trailMap, trailCoord, trail);
+}
+
 void main(){
 	// Get the id of the current agent
 	ivec2 id = ivec2(gl_GlobalInvocationID.xy);
+	if (id.x >= agentCount){
+		return;
+	}
+	
+#ifdef GOVERNOR
+	// Whole blocks are switched off by the governor, so whole subgroups return instead of diverging
+	if ((hash(uint(id.x) / uint(ACTIVE_BLOCK)) >> 16) >= activeThreshold){
+		return;
+	}
+#endif
 	
 	// Update Agents
-	Agent agent = dataMap[id.x];
+	Agent agent = loadAgent(id.x);
 	SpeciesSettings config = settings[agent.speciesIdx];
 	
-	// Create a mask vector representing the agent's species
-	vec3 speciesMask = vec3(
-		(agent.speciesIdx == 0) ? 1.0 : 0.0, 
-		(agent.speciesIdx == 1) ? 1.0 : 0.0, 
-		(agent.speciesIdx == 2) ? 1.0 : 0.0
-	);
-		
+#ifdef MULTI_RATE
+	// A slow species waits and then turns and moves as far as in period steps, the species take turns
+	int period = stepPeriods[agent.speciesIdx];
+	if ((time + agent.speciesIdx) % period != 0){
+		return;
+	}
+#else
+	const int period = 1;
+#endif
+	
+	// The agent moves in the direction before steering
+	float angle = agent.angle;
+#ifdef FAST_TRIG
+	// One cos / sin, the sensors to the left and right are the forward direction rotated by +- the sensor angle
+	vec2 direction = vec2(cos(angle), sin(angle));
+	vec2 rotation = sensorRotation[agent.speciesIdx];
+	vec2 leftDir = rotate(direction, rotation);
+	vec2 rightDir = rotate(direction, vec2(rotation.x, -rotation.y));
+	float turnSpeed = turnRadians[agent.speciesIdx] * float(period);
+#else
 	// Convert the sensor angle from degrees to radians
 	float sensorAngleRad = config.sensorAngle * (PI / 180.0);
+	vec2 direction = vec2(cos(angle), sin(angle));
+	vec2 leftDir = vec2(cos(angle + sensorAngleRad), sin(angle + sensorAngleRad));
+	vec2 rightDir = vec2(cos(angle - sensorAngleRad), sin(angle - sensorAngleRad));
+	float turnSpeed = config.turnSpeed * 2 * PI * float(period);
+#endif
 	// Get sensor readings for the current agent
-	float weightForward = sense(agent, speciesMask, 0.0);
-	float weightLeft = sense(agent, speciesMask, sensorAngleRad);
-	float weightRight = sense(agent, speciesMask, -sensorAngleRad);
+	float weightForward = sense(agent, direction);
+	float weightLeft = sense(agent, leftDir);
+	float weightRight = sense(agent, rightDir);
 	
 	// Generate a random value based on the agent's position and time
 	uint random = hash(int(agent.y) * imgSize.x + int(agent.x) + hash(id.x + time * 100000));
 	// Scale the random value to a range of 0 to 1
 	float randomSteerStrength = scaleToRange01(random);
 	
-	float turnSpeed = config.turnSpeed * 2 * PI;
-	
 	// Stear based on the sensor readings
 	
 	// Do nothing 
 	if (weightForward > weightLeft && weightForward > weightRight) {
-		dataMap[id.x].angle += 0;
+		agent.angle += 0;
 	}
 	// Left or right randomly
 	else if (weightForward < weightLeft && weightForward < weightRight) {
-		dataMap[id.x].angle += (randomSteerStrength - 0.5) * 2.0 * turnSpeed;
+		agent.angle += (randomSteerStrength - 0.5) * 2.0 * turnSpeed;
 	}
 	// Right
 	else if (weightRight > weightLeft) {
-		dataMap[id.x].angle -= randomSteerStrength * turnSpeed;
+		agent.angle -= randomSteerStrength * turnSpeed;
 	}
 	// Left
 	else if (weightLeft > weightRight) {
-		dataMap[id.x].angle += randomSteerStrength * turnSpeed;
+		agent.angle += randomSteerStrength * turnSpeed;
 	}
 	
-	// Calculate the new position of the agent based on its current angle and move speed
-	vec2 direction = vec2(cos(agent.angle), sin(agent.angle));
-	vec2 newPos = vec2(agent.x + direction.x * config.moveSpeed, agent.y + direction.y * config.moveSpeed);
+	// Calculate the new position of the agent based on its angle before steering and move speed
+	float moveSpeed = config.moveSpeed * float(period);
+	vec2 newPos = vec2(agent.x + direction.x * moveSpeed, agent.y + direction.y * moveSpeed);
 
+#ifdef WRAP
+	// Toroidal world: the agent leaves the screen on one side and comes back on the other, no bounce and no divergence at the edges
+	newPos = mod(newPos, vec2(imgSize));
+	// A tiny negative position + imgSize rounds to imgSize
+	newPos -= vec2(imgSize) * vec2(greaterThanEqual(newPos, vec2(imgSize)));
+	deposit(ivec2(newPos), agent.speciesIdx);
+#else
 	// If the new position is outside of the screen bounds, bounce the agent off the wall
 	if (newPos.x < 0.0 || newPos.x >= imgSize.x || newPos.y < 0.0 || newPos.y >= imgSize.y) {
 		// Generate a new random value based on the old random value
@@ -194,16 +326,16 @@ void main(){
 		newPos.y = min(imgSize.y - 1.0, max(0.0, newPos.y));
 		
 		// Set the agent's angle to the new random angle
-		dataMap[id.x].angle = randomAngle;
+		agent.angle = randomAngle;
 	}
 	// If the new position is within the screen bounds, leave a trail
 	else {
-		// Leave a trail
-		vec3 oldTrail = imageLoad(trailMap, ivec2(newPos)).rgb;
-		imageStore(trailMap, ivec2(newPos), vec4(min(vec3(1.0), oldTrail + speciesMask * simSettings.trailWeight), 1.0));
+		deposit(ivec2(newPos), agent.speciesIdx);
 	}
+#endif
 	
 	// Update the agents position
-	dataMap[id.x].x = newPos.x;
-	dataMap[id.x].y = newPos.y;
+	agent.x = newPos.x;
+	agent.y = newPos.y;
+	storeAgent(id.x, agent);
 }
\ No newline at end of file
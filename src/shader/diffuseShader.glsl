@@ -0,0 +1,125 @@
+#version 430 core
+
+// >! For comments see "computeShader.glsl"
+struct SimulationSettings{
+	float agents, 
+		species,
+		fps, fpsoff,
+		avoid, 
+		blurRadius,
+		trailWeight, 
+		diffuseWeight, 
+		decayRate;
+};
+
+layout(binding = 4, std430) buffer simulationSettings{
+	SimulationSettings simSettings;
+};
+
+// !<
+
+// Workgroup size = tile size, DIFFUSE_TILE is tuned by physarum.c (the shared memory of 16 fills most of 32 KB)
+#define TILE DIFFUSE_TILE
+// Largest blur radius the tui allows, the halo around each tile is this wide
+#define MAX_RADIUS 10
+#define SHARED_SIZE (TILE + 2 * MAX_RADIUS)
+
+layout(local_size_x = TILE, local_size_y = TILE, local_size_z = 1) in;
+
+// Read the trailMap of the current step and write the diffused one (ping-pong, swapped on the cpu)
+// Every workgroup diffuses one tile of one layer (gl_WorkGroupID.z)
+layout(binding = 1, TRAIL_FORMAT) uniform readonly image2DArray trailMap;
+layout(binding = 0, TRAIL_FORMAT) uniform writeonly image2DArray diffusedMap;
+
+ivec2 imgSize = imageSize(trailMap).xy;
+
+#ifdef GOVERNOR
+// 1: every tap of the blur, 2: every other tap (half resolution), set by the governor
+uniform int blurStep;
+#else
+const int blurStep = 1;
+#endif
+
+#ifdef LEVEL_BLUR
+// Compiled a second time to blur the level of "levelShader.glsl" (bound as trailMap / diffusedMap): radius of getDiffuseLevel,
+// no blend and decay
+uniform int levelRadius;
+#endif
+
+// Tile plus halo, every texel is fetched from the image only once per workgroup
+shared vec4 tile[SHARED_SIZE][SHARED_SIZE];
+// Horizontal sums of the tile rows (box blur is separable)
+shared vec4 rowSums[SHARED_SIZE][TILE];
+
+void main(){
+	ivec2 local = ivec2(gl_LocalInvocationID.xy);
+	ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy) * TILE;
+	int layer = int(gl_WorkGroupID.z);
+#ifdef LEVEL_BLUR
+	int radius = clamp(levelRadius, 0, MAX_RADIUS);
+#else
+	int radius = clamp(int(simSettings.blurRadius), 0, MAX_RADIUS);
+#endif
+	int size = TILE + 2 * radius;
+	// The taps stay symmetric around the pixel
+	int step = radius >= 2 ? blurStep : 1;
+	
+	// Load tile and halo into shared memory, pixels outside the image are wrapped around (WRAP) or clamped to the edge
+	for (int i = local.y * TILE + local.x; i < size * size; i += TILE * TILE){
+		ivec2 sharedCoord = ivec2(i % size, i / size);
+#ifdef WRAP
+		ivec2 coord = tileOrigin + sharedCoord - radius;
+		// At most one tile outside of the image, selects instead of a modulo or branches
+		coord += imgSize * (ivec2(lessThan(coord, ivec2(0))) - ivec2(greaterThanEqual(coord, imgSize)));
+#else
+		ivec2 coord = clamp(tileOrigin + sharedCoord - radius, ivec2(0), imgSize - 1);
+#endif
+		tile[sharedCoord.y][sharedCoord.x] = imageLoad(trailMap, ivec3(coord, layer));
+	}
+	barrier();
+	
+	// Sum horizontally for every row of the tile and halo
+	for (int y = local.y; y < size; y += TILE){
+		vec4 sum = vec4(0.0);
+		for (int offsetX = 0; offsetX <= 2 * radius; offsetX += step){
+			sum += tile[y][local.x + offsetX];
+		}
+		rowSums[y][local.x] = sum;
+	}
+	barrier();
+	
+	ivec2 coord = tileOrigin + local;
+	// Return if the coordinate is outside of the image bounds (last workgroup row / column)
+	if (coord.x >= imgSize.x || coord.y >= imgSize.y){
+		return;
+	}
+	
+	// Sum vertically over the row sums
+	vec4 sum = vec4(0.0);
+	for (int offsetY = 0; offsetY <= 2 * radius; offsetY += step){
+		sum += rowSums[local.y + offsetY][local.x];
+	}
+	
+	vec4 originalCol = tile[local.y + radius][local.x + radius];
+	// Calculate the average value of the sum
+	int taps = 2 * radius / step + 1;
+	vec4 blurredCol = sum / float(taps * taps);
+#ifdef LEVEL_BLUR
+	imageStore(diffusedMap, ivec3(coord, layer), blurredCol);
+	return;
+#endif
+	// Blend the original color with the blurred color using the diffuse weight from the simulation settings
+#if DIFFUSE_STEPS > 1
+	// One diffuse for DIFFUSE_STEPS steps: the part of the original that is kept and the decay compound
+	float diffuseWeight = 1.0 - pow(1.0 - simSettings.diffuseWeight, float(DIFFUSE_STEPS));
+	float decayRate = simSettings.decayRate * float(DIFFUSE_STEPS);
+#else
+	float diffuseWeight = simSettings.diffuseWeight;
+	float decayRate = simSettings.decayRate;
+#endif
+	blurredCol = originalCol * (1.0 - diffuseWeight) + blurredCol * diffuseWeight;
+	// Decrease the color's intensity by the decay rate from the simulation settings
+	blurredCol = max(vec4(0.0), blurredCol - decayRate);
+	
+	imageStore(diffusedMap, ivec3(coord, layer), blurredCol);
+}
@@ -0,0 +1,96 @@
+#version 430 core
+
+// >! For comments see "computeShader.glsl"
+struct SimulationSettings{
+	float agents,
+		species,
+		fps, fpsoff,
+		avoid,
+		blurRadius,
+		trailWeight,
+		diffuseWeight,
+		decayRate;
+};
+
+layout(binding = 4, std430) buffer simulationSettings{
+	SimulationSettings simSettings;
+};
+
+// !<
+
+// Diffuse at reduced resolution (--diffuse-scale) in three dispatches:
+// pass 0 averages levelScale x levelScale pixels of the trailMap into a pixel of the level,
+// "diffuseShader.glsl" (LEVEL_BLUR) blurs the level,
+// pass 1 upsamples the blurred level bilinearly, blends it with the trailMap and decays into the diffusedMap
+// One invocation per pixel of the level (pass 0) / the trailMap (pass 1) and layer (gl_WorkGroupID.z)
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+
+layout(binding = 1, TRAIL_FORMAT) uniform readonly image2DArray trailMap;
+layout(binding = 0, TRAIL_FORMAT) uniform writeonly image2DArray diffusedMap;
+// Written by pass 0, the blurred level is read by pass 1
+layout(binding = 2, TRAIL_FORMAT) uniform image2DArray levelMap;
+
+uniform int pass;
+uniform int levelScale;
+
+ivec2 imgSize = imageSize(trailMap).xy;
+ivec2 levelSize = imageSize(levelMap).xy;
+
+// Level pixel of a column / row, wrapped around (WRAP) or clamped to the edge like the blur
+ivec2 levelCoord(ivec2 coord){
+#ifdef WRAP
+	return (coord + levelSize) % levelSize;
+#else
+	return clamp(coord, ivec2(0), levelSize - 1);
+#endif
+}
+
+void main(){
+	int layer = int(gl_WorkGroupID.z);
+	ivec2 coord = ivec2(gl_GlobalInvocationID.xy);
+
+	if (pass == 0){
+		if (coord.x >= levelSize.x || coord.y >= levelSize.y){
+			return;
+		}
+		// The last block of a row / column is cut off at the edge of the trailMap
+		ivec2 first = coord * levelScale;
+		ivec2 last = min(first + levelScale, imgSize);
+		vec4 sum = vec4(0.0);
+		for (int y = first.y; y < last.y; y++){
+			for (int x = first.x; x < last.x; x++){
+				sum += imageLoad(trailMap, ivec3(x, y, layer));
+			}
+		}
+		ivec2 count = last - first;
+		imageStore(levelMap, ivec3(coord, layer), sum / float(count.x * count.y));
+		return;
+	}
+
+	if (coord.x >= imgSize.x || coord.y >= imgSize.y){
+		return;
+	}
+	// Level pixel i covers the trailMap pixels [i * levelScale, (i + 1) * levelScale), its center is at (i + 0.5) * levelScale
+	vec2 position = (vec2(coord) + 0.5) / float(levelScale) - 0.5;
+	ivec2 topLeft = ivec2(floor(position));
+	vec2 fraction = position - vec2(topLeft);
+	ivec2 first = levelCoord(topLeft);
+	ivec2 second = levelCoord(topLeft + 1);
+	vec4 upper = mix(imageLoad(levelMap, ivec3(first.x, first.y, layer)), imageLoad(levelMap, ivec3(second.x, first.y, layer)), fraction.x);
+	vec4 lower = mix(imageLoad(levelMap, ivec3(first.x, second.y, layer)), imageLoad(levelMap, ivec3(second.x, second.y, layer)), fraction.x);
+	vec4 blurredCol = mix(upper, lower, fraction.y);
+
+	vec4 originalCol = imageLoad(trailMap, ivec3(coord, layer));
+	// Blend and decay like "diffuseShader.glsl"
+#if DIFFUSE_STEPS > 1
+	float diffuseWeight = 1.0 - pow(1.0 - simSettings.diffuseWeight, float(DIFFUSE_STEPS));
+	float decayRate = simSettings.decayRate * float(DIFFUSE_STEPS);
+#else
+	float diffuseWeight = simSettings.diffuseWeight;
+	float decayRate = simSettings.decayRate;
+#endif
+	blurredCol = originalCol * (1.0 - diffuseWeight) + blurredCol * diffuseWeight;
+	blurredCol = max(vec4(0.0), blurredCol - decayRate);
+
+	imageStore(diffusedMap, ivec3(coord, layer), blurredCol);
+}
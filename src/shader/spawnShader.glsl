@@ -0,0 +1,147 @@
+#version 430 core
+
+// >! For comments see "computeShader.glsl"
+#define PI 3.141592
+
+struct Agent{
+	float x, y;
+	float angle;
+	int speciesIdx;
+};
+
+struct SpeciesSettings{
+	float spawnMode;	// the tui edits every setting as float, so the mode is stored as float as well
+	float sensorSize, 
+		sensorOffsetDistance, 
+		sensorAngle, 
+		turnSpeed, 
+		moveSpeed,
+		r, g, b,
+		percent;
+};
+
+layout(binding = 3, std430) buffer speciesSettings{
+	SpeciesSettings settings[];
+};
+
+uint hash(uint state){
+    state ^= 2747636419;
+    state *= 2654435769;
+    state ^= state >> 16;
+    state *= 2654435769;
+    state ^= state >> 16;
+    state *= 2654435769;
+    return state;
+}
+
+float scaleToRange01(uint num){
+    return float(num) / 4294967295.0;
+}
+
+// !<
+
+// Spawn modes, same order as "Mode" in main.c
+#define CENTER 0
+#define CIRCLE 1
+#define RING 2
+#define RANDOM 3
+#define ICIRCLE 4
+
+layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
+
+// Size of the trailMap (the image is not bound yet when the first agents are spawned)
+uniform ivec2 imgSize;
+
+// >! Same agent layout as "computeShader.glsl"
+#ifdef COMPACT_AGENTS
+layout(binding = 2, std430) buffer agents{
+	uvec2 dataMap[];
+};
+
+#define FIXED_SCALE 4194304.0
+
+void storeAgent(int i, Agent agent){
+	uint x = min(uint(agent.x * (FIXED_SCALE / float(imgSize.x)) + 0.5), 4194303u);
+	uint y = min(uint(agent.y * (FIXED_SCALE / float(imgSize.y)) + 0.5), 4194303u);
+	uint angle = uint(fract(agent.angle / (2 * PI)) * 65536.0 + 0.5) & 65535u;
+	dataMap[i] = uvec2((x << 10) | (angle >> 6), (y << 10) | ((angle & 63u) << 4) | uint(agent.speciesIdx));
+}
+#else
+layout(binding = 2, std430) buffer agents{
+	Agent dataMap[];
+};
+
+void storeAgent(int i, Agent agent){
+	dataMap[i] = agent;
+}
+#endif
+// !<
+// Seed of this spawn, different seeds give different agents
+uniform uint seed;
+// Agents [spawnOffset, spawnOffset + spawnCount) are spawned
+uniform int spawnOffset;
+uniform int spawnCount;
+// Agent i of the spawn belongs to the first species s with i < speciesEnd[s]
+uniform int speciesEnd[MAX_SPECIES];
+
+void main(){
+	int i = int(gl_GlobalInvocationID.x);
+	// The last workgroup can be partially outside of the spawn range
+	if (i >= spawnCount){
+		return;
+	}
+	
+	int speciesIdx = 0;
+	while (speciesIdx < SPECIES_COUNT - 1 && i >= speciesEnd[speciesIdx]){
+		speciesIdx++;
+	}
+	int spawnMode = int(settings[speciesIdx].spawnMode);
+	
+	// Three independent random numbers per agent
+	uint random = hash(seed ^ hash(uint(spawnOffset + i)));
+	float random0 = scaleToRange01(random);
+	random = hash(random);
+	float random1 = scaleToRange01(random);
+	random = hash(random);
+	float random2 = scaleToRange01(random);
+	
+	vec2 center = vec2(imgSize / 2);
+	float radius = float(imgSize.y / 2);
+	Agent agent;
+	agent.speciesIdx = speciesIdx;
+	
+	switch (spawnMode){
+		case CENTER:
+			agent.x = center.x;
+			agent.y = center.y;
+			agent.angle = random0 * 2 * PI;
+		break;
+		case RING:{
+			float alpha = random0 * 2 * PI;
+			agent.x = center.x + cos(alpha) * radius;
+			agent.y = center.y + sin(alpha) * radius;
+			agent.angle = atan(center.y - agent.y, center.x - agent.x);	// Angle pointing to the center
+		}
+		break;
+		case CIRCLE:
+		case ICIRCLE:{
+			// Uniform point in the circle (sqrt keeps the density even), no rejection loop
+			float alpha = random0 * 2 * PI;
+			float distance = sqrt(random1) * radius;
+			agent.x = floor(center.x + cos(alpha) * distance);
+			agent.y = floor(center.y + sin(alpha) * distance);
+			agent.angle = (spawnMode == ICIRCLE) 
+				? atan(center.y - agent.y, center.x - agent.x)	// Angle pointing to the center
+				: random2 * 2 * PI;	// Random angle
+		}
+		break;
+		default:	// RANDOM
+			// A hash near the maximum rounds to 1.0, which would be one pixel outside of the world
+			agent.x = min(floor(random0 * imgSize.x), float(imgSize.x - 1));
+			agent.y = min(floor(random1 * imgSize.y), float(imgSize.y - 1));
+			agent.angle = random2 * 2 * PI;
+		break;
+	}
+	
+	storeAgent(spawnOffset + i, agent);
+}
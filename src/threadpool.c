@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include "threadpool.h"
+
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RANGE(begin, end) (((uint64_t)(begin) << 32) | (uint32_t)(end))
+#define RANGE_BEGIN(range) ((int)((range) >> 32))
+#define RANGE_END(range) ((int)((range) & 0xffffffffu))
+
+int getCpuCount(void){
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return cpus > 0 ? (int)cpus : 1;
+}
+
+static void pinThread(pthread_t thread, int cpu){
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(thread, sizeof(set), &set);
+}
+
+// Take the first chunk of the own queue
+static int popChunk(WorkQueue* queue, int* chunk){
+	uint64_t range = atomic_load(&queue->range);
+	while (RANGE_BEGIN(range) < RANGE_END(range)){
+		if (atomic_compare_exchange_weak(&queue->range, &range, RANGE(RANGE_BEGIN(range) + 1, RANGE_END(range)))){
+			*chunk = RANGE_BEGIN(range);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Move the back half of the fullest other queue into the own (empty) queue
+static int stealChunks(ThreadPool* pool, int thief){
+	while (1){
+		int victim = -1, most = 0, i;
+		for (i = 0; i < pool->threadCount; i++){
+			uint64_t range = atomic_load(&pool->queues[i].range);
+			if (i != thief && RANGE_END(range) - RANGE_BEGIN(range) > most){
+				most = RANGE_END(range) - RANGE_BEGIN(range);
+				victim = i;
+			}
+		}
+		if (victim < 0) return 0;	// nothing left anywhere
+		
+		uint64_t range = atomic_load(&pool->queues[victim].range);
+		int begin = RANGE_BEGIN(range), end = RANGE_END(range);
+		if (begin >= end) continue;
+		int middle = begin + (end - begin) / 2;
+		if (atomic_compare_exchange_strong(&pool->queues[victim].range, &range, RANGE(begin, middle))){
+			atomic_store(&pool->queues[thief].range, RANGE(middle, end));
+			atomic_fetch_add(&pool->steals, 1);
+			return 1;
+		}
+	}
+}
+
+// Work on chunks until no worker has any left
+static void runChunks(ThreadPool* pool, int thread){
+	int chunk;
+	while (1){
+		while (popChunk(&pool->queues[thread], &chunk)){
+			int begin = chunk * pool->chunkSize;
+			int end = begin + pool->chunkSize < pool->count ? begin + pool->chunkSize : pool->count;
+			pool->function(begin, end, thread, pool->userData);
+		}
+		if (!pool->steal || !stealChunks(pool, thread)) break;
+	}
+}
+
+// Take ready tasks of the graph until all are done, a finished task releases the successors that waited only for it
+static void runGraphTasks(ThreadPool* pool, int thread){
+	TaskGraph* graph = pool->graph;
+	pthread_mutex_lock(&pool->mutex);
+	while (graph->done < graph->taskCount){
+		if (graph->readyHead == graph->readyTail){
+			pthread_cond_wait(&pool->readyCondition, &pool->mutex);
+			continue;
+		}
+		int task = graph->ready[graph->readyHead++];
+		pthread_mutex_unlock(&pool->mutex);
+		
+		pool->function(task, task + 1, thread, pool->userData);
+		
+		pthread_mutex_lock(&pool->mutex);
+		int i;
+		for (i = graph->successorStart[task]; i < graph->successorStart[task + 1]; i++){
+			int successor = graph->successors[i];
+			if (--graph->pending[successor] == 0){
+				graph->ready[graph->readyTail++] = successor;
+				pthread_cond_signal(&pool->readyCondition);
+			}
+		}
+		if (++graph->done == graph->taskCount){
+			pthread_cond_broadcast(&pool->readyCondition);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+static void* workerMain(void* arg){
+	Worker* worker = arg;
+	ThreadPool* pool = worker->pool;
+	unsigned long generation = 0;
+	
+	pthread_mutex_lock(&pool->mutex);
+	while (1){
+		while (!pool->stop && pool->generation == generation){
+			pthread_cond_wait(&pool->startCondition, &pool->mutex);
+		}
+		if (pool->stop) break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+		
+		if (pool->graph){
+			runGraphTasks(pool, worker->index);
+		}else{
+			runChunks(pool, worker->index);
+		}
+		
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->busy == 0){
+			pthread_cond_signal(&pool->doneCondition);
+		}
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+int initThreadPool(ThreadPool* pool, int threadCount, const int* cpus){
+	pool->threadCount = threadCount > 0 ? threadCount : 1;
+	pool->cpus = NULL;
+	if (cpus){
+		pool->cpus = malloc(pool->threadCount * sizeof(int));
+		memcpy(pool->cpus, cpus, pool->threadCount * sizeof(int));
+	}
+	pool->threads = malloc(pool->threadCount * sizeof(pthread_t));
+	pool->workers = malloc(pool->threadCount * sizeof(Worker));
+	pool->queues = aligned_alloc(64, pool->threadCount * sizeof(WorkQueue));
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->startCondition, NULL);
+	pthread_cond_init(&pool->doneCondition, NULL);
+	pthread_cond_init(&pool->readyCondition, NULL);
+	pool->graph = NULL;
+	pool->generation = 0;
+	pool->busy = 0;
+	pool->stop = 0;
+	atomic_init(&pool->steals, 0);
+	
+	int i;
+	for (i = 0; i < pool->threadCount; i++){
+		atomic_init(&pool->queues[i].range, 0);
+		pool->workers[i] = (Worker){.pool = pool, .index = i};
+	}
+	
+	pool->threads[0] = pthread_self();
+	pool->callerCpus = NULL;
+	if (pool->cpus){
+		// The caller is the thread of the application, it gets its affinity back with the pool
+		cpu_set_t* callerCpus = malloc(sizeof(cpu_set_t));
+		if (pthread_getaffinity_np(pool->threads[0], sizeof(cpu_set_t), callerCpus) == 0){
+			pool->callerCpus = callerCpus;
+		}else{
+			free(callerCpus);
+		}
+		pinThread(pool->threads[0], pool->cpus[0]);
+	}
+	for (i = 1; i < pool->threadCount; i++){
+		if (pthread_create(&pool->threads[i], NULL, workerMain, &pool->workers[i]) != 0){
+			printf("Failed to start worker thread %d\n", i);
+			pool->threadCount = i;
+			break;
+		}
+		if (pool->cpus){
+			pinThread(pool->threads[i], pool->cpus[i]);
+		}
+	}
+	return 0;
+}
+
+void destroyThreadPool(ThreadPool* pool){
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = 1;
+	pthread_cond_broadcast(&pool->startCondition);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	int i;
+	for (i = 1; i < pool->threadCount; i++){
+		pthread_join(pool->threads[i], NULL);
+	}
+	if (pool->callerCpus){
+		pthread_setaffinity_np(pool->threads[0], sizeof(cpu_set_t), pool->callerCpus);
+		free(pool->callerCpus);
+	}
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->startCondition);
+	pthread_cond_destroy(&pool->doneCondition);
+	pthread_cond_destroy(&pool->readyCondition);
+	free(pool->threads);
+	free(pool->workers);
+	free(pool->queues);
+	free(pool->cpus);
+}
+
+int getChunkOwner(ThreadPool* pool, int chunks, int chunk){
+	// Inverse of the initial shares [chunks * i / threads, chunks * (i + 1) / threads)
+	int worker = (int)(((long)chunk * pool->threadCount + pool->threadCount - 1) / chunks);
+	while (worker > 0 && (long)chunks * worker / pool->threadCount > chunk) worker--;
+	while (worker < pool->threadCount - 1 && (long)chunks * (worker + 1) / pool->threadCount <= chunk) worker++;
+	return worker;
+}
+
+static void runLoop(ThreadPool* pool, int count, int chunkSize, TaskFunction function, void* userData, int steal){
+	if (count <= 0) return;
+	int chunks = (count + chunkSize - 1) / chunkSize;
+	
+	// Not worth waking anyone up (a static loop has to run the chunk on its owner)
+	if (pool->threadCount == 1 || (chunks == 1 && steal)){
+		function(0, count, 0, userData);
+		return;
+	}
+	
+	int i;
+	for (i = 0; i < pool->threadCount; i++){
+		atomic_store(&pool->queues[i].range, RANGE((long)chunks * i / pool->threadCount, (long)chunks * (i + 1) / pool->threadCount));
+	}
+	
+	pthread_mutex_lock(&pool->mutex);
+	pool->function = function;
+	pool->userData = userData;
+	pool->count = count;
+	pool->chunkSize = chunkSize;
+	pool->steal = steal;
+	pool->busy = pool->threadCount - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->startCondition);
+	pthread_mutex_unlock(&pool->mutex);
+	
+	runChunks(pool, 0);
+	
+	// Barrier: the next phase may depend on every chunk of this one
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->busy > 0){
+		pthread_cond_wait(&pool->doneCondition, &pool->mutex);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void parallelFor(ThreadPool* pool, int count, int chunkSize, TaskFunction function, void* userData){
+	runLoop(pool, count, chunkSize, function, userData, 1);
+}
+
+void parallelForStatic(ThreadPool* pool, int count, int chunkSize, TaskFunction function, void* userData){
+	runLoop(pool, count, chunkSize, function, userData, 0);
+}
+
+/*----------------------------------*/
+
+void initTaskGraph(TaskGraph* graph, int taskCount){
+	memset(graph, 0, sizeof(TaskGraph));
+	graph->taskCount = taskCount;
+	graph->successorStart = malloc((taskCount + 1) * sizeof(int));
+	graph->predecessors = malloc(taskCount * sizeof(int));
+	graph->pending = malloc(taskCount * sizeof(int));
+	graph->ready = malloc(taskCount * sizeof(int));
+}
+
+void freeTaskGraph(TaskGraph* graph){
+	free(graph->edges);
+	free(graph->successorStart);
+	free(graph->successors);
+	free(graph->predecessors);
+	free(graph->pending);
+	free(graph->ready);
+	memset(graph, 0, sizeof(TaskGraph));
+}
+
+void addTaskEdge(TaskGraph* graph, int before, int after){
+	if (graph->edgeCount == graph->edgeCapacity){
+		graph->edgeCapacity = graph->edgeCapacity ? graph->edgeCapacity * 2 : 1024;
+		graph->edges = realloc(graph->edges, graph->edgeCapacity * 2 * sizeof(int));
+	}
+	graph->edges[graph->edgeCount * 2] = before;
+	graph->edges[graph->edgeCount * 2 + 1] = after;
+	graph->edgeCount++;
+	graph->built = 0;
+}
+
+// Successor lists sorted by task (counting sort of the edges)
+static void buildTaskGraph(TaskGraph* graph){
+	if (graph->built) return;
+	int* start = graph->successorStart;
+	memset(start, 0, (graph->taskCount + 1) * sizeof(int));
+	memset(graph->predecessors, 0, graph->taskCount * sizeof(int));
+	int i;
+	for (i = 0; i < graph->edgeCount; i++){
+		start[graph->edges[i * 2] + 1]++;
+		graph->predecessors[graph->edges[i * 2 + 1]]++;
+	}
+	for (i = 0; i < graph->taskCount; i++){
+		start[i + 1] += start[i];
+	}
+	graph->successors = realloc(graph->successors, (graph->edgeCount > 0 ? graph->edgeCount : 1) * sizeof(int));
+	// pending is free until the graph runs
+	memcpy(graph->pending, start, graph->taskCount * sizeof(int));
+	for (i = 0; i < graph->edgeCount; i++){
+		graph->successors[graph->pending[graph->edges[i * 2]]++] = graph->edges[i * 2 + 1];
+	}
+	graph->built = 1;
+}
+
+void runTaskGraph(ThreadPool* pool, TaskGraph* graph, TaskFunction function, void* userData){
+	if (graph->taskCount <= 0) return;
+	buildTaskGraph(graph);
+	
+	graph->readyHead = 0;
+	graph->readyTail = 0;
+	graph->done = 0;
+	int i;
+	for (i = 0; i < graph->taskCount; i++){
+		graph->pending[i] = graph->predecessors[i];
+		if (graph->pending[i] == 0) graph->ready[graph->readyTail++] = i;
+	}
+	
+	pthread_mutex_lock(&pool->mutex);
+	pool->function = function;
+	pool->userData = userData;
+	pool->graph = graph;
+	if (pool->threadCount > 1){
+		pool->busy = pool->threadCount - 1;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->startCondition);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	
+	runGraphTasks(pool, 0);
+	
+	// The workers leave as soon as the last task is done
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->busy > 0){
+		pthread_cond_wait(&pool->doneCondition, &pool->mutex);
+	}
+	pool->graph = NULL;
+	pthread_mutex_unlock(&pool->mutex);
+}
@@ -0,0 +1,94 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Body of a parallel loop: iterations [begin, end) on worker thread (0 = the thread that called parallelFor)
+typedef void (*TaskFunction)(int begin, int end, int thread, void* userData);
+
+// Chunks a worker still has to do, begin << 32 | end, so the owner (front) and thieves (back) take chunks with one compare and swap
+typedef struct WorkQueue{
+	_Atomic uint64_t range;
+	char padding[64 - sizeof(uint64_t)];	// one cache line per worker
+}WorkQueue;
+
+// Tasks [0, taskCount) with dependencies, run by runTaskGraph
+typedef struct TaskGraph{
+	int taskCount;
+	int* edges;	// before, after pairs as they were added
+	int edgeCount, edgeCapacity;
+	int built;	// the successor lists below are up to date with the edges
+	int* successorStart;	// successors of task t: successors[successorStart[t], successorStart[t + 1])
+	int* successors;
+	int* predecessors;	// number of tasks every task waits for
+	// Current run, guarded by the mutex of the pool
+	int* pending;	// predecessors that are not done yet
+	int* ready;	// tasks whose predecessors are done, in the order they became ready
+	int readyHead, readyTail, done;
+}TaskGraph;
+
+typedef struct Worker{
+	struct ThreadPool* pool;
+	int index;
+}Worker;
+
+// Workers that stay alive between parallel loops, every parallelFor is one phase that ends with a barrier
+typedef struct ThreadPool{
+	int threadCount;	// workers including the calling thread
+	int* cpus;	// worker i is pinned to cpus[i], NULL: not pinned
+	void* callerCpus;	// cpu_set_t of the calling thread before it was pinned, restored by destroyThreadPool (NULL: not pinned)
+	pthread_t* threads;
+	Worker* workers;
+	WorkQueue* queues;
+	pthread_mutex_t mutex;
+	pthread_cond_t startCondition, doneCondition;
+	unsigned long generation;	// number of the current loop, workers wait for it to change
+	int busy;	// pool threads that did not finish the current loop
+	int stop;
+	// Current loop
+	TaskFunction function;
+	void* userData;
+	int count, chunkSize;
+	int steal;	// idle workers take chunks of others
+	TaskGraph* graph;	// the current phase is a task graph instead of a loop if not NULL
+	pthread_cond_t readyCondition;	// a task of graph became ready or the last one is done
+	_Atomic long steals;	// chunk ranges taken from other workers since init
+}ThreadPool;
+
+// Start threadCount - 1 threads (the caller is worker 0), worker i is pinned to cpus[i] (cpus = NULL: no pinning)
+// The caller keeps its pinning until destroyThreadPool gives it its own affinity back
+int initThreadPool(ThreadPool* pool, int threadCount, const int* cpus);
+
+void destroyThreadPool(ThreadPool* pool);
+
+// Run function over [0, count) in chunks of chunkSize on all workers, returns when every chunk is done
+// Every worker starts with an equal share of chunks, workers that run out steal half of the largest remaining share
+void parallelFor(ThreadPool* pool, int count, int chunkSize, TaskFunction function, void* userData);
+
+// parallelFor without stealing: chunk c always runs on the worker whose initial share contains it
+// Used to first touch memory with the workers that will mostly use it
+void parallelForStatic(ThreadPool* pool, int count, int chunkSize, TaskFunction function, void* userData);
+
+// Empty graph of taskCount tasks
+void initTaskGraph(TaskGraph* graph, int taskCount);
+
+void freeTaskGraph(TaskGraph* graph);
+
+// Task after starts only when task before is done
+void addTaskEdge(TaskGraph* graph, int before, int after);
+
+// Run every task t of graph as function(t, t + 1, thread, userData) as soon as the tasks it depends on are done,
+// returns when all are done. Workers only wait if no task is ready, not at the end of a phase
+void runTaskGraph(ThreadPool* pool, TaskGraph* graph, TaskFunction function, void* userData);
+
+// Worker whose initial share of chunks contains chunk (runs it in parallelForStatic)
+int getChunkOwner(ThreadPool* pool, int chunks, int chunk);
+
+// Number of cpus that are online
+int getCpuCount(void);
+
+#endif
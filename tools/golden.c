@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <glob.h>
+#include <sys/stat.h>
+
+#include "physarum.h"
+#include "cpusim.h"
+#include "numa.h"
+#include "headless.h"
+#include "recording.h"
+
+/*
+Golden image check: runs presets for a fixed seed and number of steps on the cpu and the gpu simulation and compares
+the trailMaps with references of an earlier run (--update), so changes to the kernels that should not change the patterns
+are caught. Trails are compared 8 bit quantized like --record-delta (what the window shows), the references are
+recordings with one keyframe: ./playback REFERENCE --raw FILE gives the frame back.
+The cpu simulation needs no OpenGL, the gpu simulation runs in a headless context (llvmpipe without a gpu) and is
+skipped if there is none.
+*/
+
+#define GOLDEN_STEPS 50
+#define GOLDEN_SEED 1
+#define GOLDEN_DIRECTORY "Presets/golden"
+#define GOLDEN_COVERAGE_LEVEL 0.05f	// trail above which a pixel counts as covered by a species
+
+// Default tolerances: runs of the same kernels on the same machine match exactly
+#define GOLDEN_MIN_PSNR 40.0	// dB
+#define GOLDEN_MAX_ERROR 0.25	// of any value
+#define GOLDEN_MAX_COVERAGE 0.01	// covered part of the trailMap of any species
+
+// Engines with their own references: the cpu simulation deposits while the agents move with one thread,
+// after they moved with workers (the same for any number of workers, with or without --pipeline)
+#define ENGINE_CPU 0
+#define ENGINE_WORKERS 1
+#define ENGINE_GPU 2
+#define ENGINES 3
+
+typedef struct GoldenOptions{
+	int update;	// write the references instead of comparing
+	int steps;
+	unsigned int seed;
+	const char* directory;
+	int engines[ENGINES];	// engines in use
+	int threads;	// of ENGINE_WORKERS
+	int pipeline, compactAgents, fastTrig, wrap, multiRate, diffusePeriod, diffuseScale;	// kernels under test (the references do not know them)
+	double minPsnr, maxError, maxCoverage;
+}GoldenOptions;
+
+typedef struct GoldenMetrics{
+	double psnr;	// dB, INFINITY if equal
+	double maxError;
+	double coverage[MAX_SPECIES][2];	// reference / run
+	double coverageDifference;	// largest of all species
+}GoldenMetrics;
+
+static const char* engineNames[ENGINES] = {"cpu", "cpu-workers", "gpu"};
+
+static double getSeconds(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*----------------------------------*/
+
+static float readSetting(FILE* file){
+	char line[32];
+	if (fgets(line, sizeof(line), file) == NULL){
+		return 0;
+	}
+	return atof(line);
+}
+
+// The spawn mode is stored as the bits of a float like the other settings (the tui edits it through a float*)
+static void setSpawnMode(Species* species, float mode){
+	memcpy(&species->spawnMode, &mode, sizeof(float));
+}
+
+// Settings file of the tui (saveSettingsFile in main.c): with header the simulation settings and then 10 values
+// per species, old files 9 values of 3 species, agents, 3 percentages and the simulation settings from fps on
+static int loadPreset(const char* path, Species species[MAX_SPECIES], Simulation* simulation){
+	FILE* file = fopen(path, "r");
+	if (file == NULL){
+		return -1;
+	}
+	memset(species, 0, MAX_SPECIES * sizeof(Species));
+	memset(simulation, 0, sizeof(Simulation));
+	float* simulationValues = (float*)simulation;
+	char line[32];
+	int s, i;
+	if (fgets(line, sizeof(line), file) && strncmp(line, "# physarum settings", 19) == 0){
+		for (i = 0; i < 9; i++){
+			simulationValues[i] = readSetting(file);
+		}
+		simulation->species = fminf(MAX_SPECIES, fmaxf(1, simulation->species));
+		for (s = 0; s < simulation->species; s++){
+			setSpawnMode(&species[s], readSetting(file));
+			float* values = &species[s].sensorSize;
+			for (i = 0; i < 9; i++){
+				values[i] = readSetting(file);
+			}
+		}
+	}else{
+		rewind(file);
+		for (s = 0; s < 3; s++){
+			setSpawnMode(&species[s], readSetting(file));
+			float* values = &species[s].sensorSize;
+			for (i = 0; i < 8; i++){
+				values[i] = readSetting(file);
+			}
+		}
+		simulation->agents = readSetting(file);
+		for (s = 0; s < 3; s++){
+			species[s].percent = readSetting(file);
+		}
+		simulation->species = 3;
+		for (i = 2; i < 9; i++){
+			simulationValues[i] = readSetting(file);
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+/*----------------------------------*/
+
+// Values per pixel of a frame in the layout of a FrameCallback (capture.h): one per species, above 4 species layers of 4
+static int getFrameChannels(int speciesCount){
+	return speciesCount <= 4 ? speciesCount : (speciesCount + 3) / 4 * 4;
+}
+
+// Index of species at pixel i of such a frame
+static size_t getFrameIndex(int speciesCount, size_t pixels, size_t i, int species){
+	if (speciesCount <= 4){
+		return i * speciesCount + species;
+	}
+	return (size_t)(species / 4) * pixels * 4 + i * 4 + species % 4;
+}
+
+// Quantize a mapped trailMap into frame (layout of a FrameCallback) like recordFrame does
+static void quantizeTrailMap(const float* trailMap, const PhysarumTrailLayout* layout, int speciesCount, uint8_t* frame){
+	size_t pixels = (size_t)layout->width * layout->height, i;
+	int species;
+	memset(frame, 0, pixels * getFrameChannels(speciesCount));
+	for (species = 0; species < speciesCount; species++){
+		// Layer species / layout channels, channel species % layout channels
+		const float* layer = trailMap + (size_t)(species / layout->channels) * pixels * layout->channels;
+		for (i = 0; i < pixels; i++){
+			float value = layer[i * layout->channels + species % layout->channels] * 255.0f + 0.5f;
+			frame[getFrameIndex(speciesCount, pixels, i, species)] = value >= 255.0f ? 255 : (value > 0.0f ? (uint8_t)value : 0);
+		}
+	}
+}
+
+static void compareFrames(const uint8_t* reference, const uint8_t* frame, size_t pixels, int speciesCount, GoldenMetrics* metrics){
+	uint8_t level = (uint8_t)(GOLDEN_COVERAGE_LEVEL * 255.0f + 0.5f);
+	double squares = 0;
+	int maxDifference = 0, species;
+	size_t i;
+	metrics->coverageDifference = 0;
+	for (species = 0; species < speciesCount; species++){
+		long covered[2] = {0, 0};
+		for (i = 0; i < pixels; i++){
+			size_t index = getFrameIndex(speciesCount, pixels, i, species);
+			int difference = abs((int)frame[index] - (int)reference[index]);
+			squares += (double)difference * difference;
+			if (difference > maxDifference) maxDifference = difference;
+			covered[0] += reference[index] >= level;
+			covered[1] += frame[index] >= level;
+		}
+		metrics->coverage[species][0] = (double)covered[0] / pixels;
+		metrics->coverage[species][1] = (double)covered[1] / pixels;
+		metrics->coverageDifference = fmax(metrics->coverageDifference, fabs(metrics->coverage[species][1] - metrics->coverage[species][0]));
+	}
+	double meanSquare = squares / ((double)pixels * speciesCount * 255. * 255.);
+	metrics->psnr = meanSquare > 0 ? 10. * log10(1. / meanSquare) : INFINITY;
+	metrics->maxError = maxDifference / 255.;
+}
+
+/*----------------------------------*/
+
+// Run the cpu simulation of the whole world without OpenGL (like physarum.c), quantize its trailMap into frame
+static int runCpu(const GoldenOptions* options, int threads, const Species species[MAX_SPECIES], const Simulation* simulation, uint8_t* frame){
+	int count = (int)simulation->agents, speciesCount = (int)simulation->species;
+	int speciesCounts[MAX_SPECIES];
+	physarumGetSpeciesCounts(count, speciesCount, species, speciesCounts);
+
+	Arena arena;
+	initArena(&arena);
+	size_t size = getCpuSimSize(0, 0, PHYSARUM_COLUMNS, PHYSARUM_ROWS, 0, speciesCount, count, options->compactAgents);
+	if (reserveArena(&arena, size + (options->diffuseScale > 1 ? getCpuLevelSize(PHYSARUM_COLUMNS, PHYSARUM_ROWS, speciesCount) : 0)) < 0){
+		printf("Failed to reserve the memory of %d agents\n", count);
+		return -1;
+	}
+	ThreadPool pool;
+	if (threads > 1){
+		int* cpus = malloc(threads * sizeof(int));
+		getWorkerCpus(0, threads, threads, cpus);
+		initThreadPool(&pool, threads, cpus);
+		free(cpus);
+	}
+
+	CpuSim sim;
+	memset(&sim, 0, sizeof(CpuSim));
+	int status = initCpuSim(&sim, PHYSARUM_COLUMNS, PHYSARUM_ROWS, 0, 0, PHYSARUM_COLUMNS, PHYSARUM_ROWS, 0, &arena, count, options->compactAgents, species, simulation);
+	sim.pool = threads > 1 ? &pool : NULL;
+	sim.fastTrig = options->fastTrig;
+	sim.wrap = options->wrap;
+	sim.multiRate = options->multiRate;
+	sim.diffusePeriod = options->diffusePeriod;
+	if (status == 0){
+		status = initCpuLevel(&sim, options->diffuseScale, &arena);
+	}
+	if (status != 0){
+		freeCpuSim(&sim);
+		if (threads > 1){
+			destroyThreadPool(&pool);
+		}
+		destroyArena(&arena);
+		return -1;
+	}
+	cpuClearSim(&sim, count);
+	cpuSpawnAgents(&sim, count, speciesCounts, options->seed);
+
+	if (options->pipeline){
+		cpuStepPipelined(&sim, options->steps);
+	}else{
+		int s;
+		for (s = 0; s < options->steps; s++){
+			cpuUpdate(&sim);
+			cpuDiffuseRegion(&sim);
+			cpuSwapTrailMaps(&sim);
+		}
+	}
+
+	PhysarumTrailLayout layout = {PHYSARUM_COLUMNS, PHYSARUM_ROWS, 1, speciesCount};
+	quantizeTrailMap(sim.trailMap, &layout, speciesCount, frame);
+	freeCpuSim(&sim);
+	if (threads > 1){
+		destroyThreadPool(&pool);
+	}
+	destroyArena(&arena);
+	return 0;
+}
+
+// Run the gpu simulation in the current context through libphysarum, quantize its trailMap into frame
+static int runGpu(const GoldenOptions* options, const Species species[MAX_SPECIES], const Simulation* simulation, uint8_t* frame){
+	PhysarumConfig config;
+	physarumDefaultConfig(&config);
+	config.compactAgents = options->compactAgents;
+	config.fastTrig = options->fastTrig;
+	config.wrap = options->wrap;
+	config.multiRate = options->multiRate;
+	config.diffusePeriod = options->diffusePeriod;
+	config.diffuseScale = options->diffuseScale;
+	config.seed = options->seed;
+	Physarum* physarum = physarumCreate(&config, species, simulation);
+	if (physarum == NULL){
+		return -1;
+	}
+	physarumStep(physarum, options->steps);
+
+	PhysarumTrailLayout layout;
+	const float* trailMap = physarumMapTrailMap(physarum, &layout);
+	if (trailMap){
+		quantizeTrailMap(trailMap, &layout, (int)simulation->species, frame);
+	}
+	physarumUnmapTrailMap(physarum);
+	physarumDestroy(physarum);
+	return trailMap ? 0 : -1;
+}
+
+/*----------------------------------*/
+
+// Reference of a preset and engine: DIRECTORY/NAME.ENGINE.phr, NAME is the file name of the preset without .txt
+static void getReferencePath(const GoldenOptions* options, const char* preset, int engine, char* path, size_t size){
+	const char* name = strrchr(preset, '/');
+	name = name ? name + 1 : preset;
+	int length = (int)strlen(name);
+	if (length > 4 && strcmp(name + length - 4, ".txt") == 0) length -= 4;
+	snprintf(path, size, "%s/%.*s.%s.phr", options->directory, length, name, engineNames[engine]);
+}
+
+static int writeReference(const char* path, const uint8_t* frame, size_t pixels, int steps, const Species species[MAX_SPECIES], int speciesCount){
+	int channels = getFrameChannels(speciesCount), status = -1;
+	float* values = malloc(pixels * channels * sizeof(float));
+	size_t i;
+	for (i = 0; i < pixels * channels; i++){
+		values[i] = frame[i] * (1.0f / 255.0f);
+	}
+	// A recording of one keyframe, its frame number is the number of steps
+	Recorder recorder;
+	if (createRecorder(&recorder, path, 1, species, speciesCount) == 0){
+		recordFrame(values, PHYSARUM_COLUMNS, PHYSARUM_ROWS, channels, steps, &recorder);
+		status = closeRecorder(&recorder);
+	}
+	free(values);
+	return status;
+}
+
+// Compare frame with the reference at path, returns 1 if it is within the tolerances, 0 if not, -1 if it can't be read, -2 without reference
+static int checkReference(const GoldenOptions* options, const char* path, const uint8_t* frame, size_t pixels, int speciesCount, GoldenMetrics* metrics){
+	RecordingReader reader;
+	if (openRecording(&reader, path) != 0){
+		return -2;
+	}
+	int channels = getFrameChannels(speciesCount), status = -1;
+	if (readRecordedFrame(&reader) != 1){
+		printf("failed to read %s\n", path);
+	}else if (reader.width != PHYSARUM_COLUMNS || reader.height != PHYSARUM_ROWS || reader.channels != channels){
+		printf("reference %s is %dx%d with %d channels\n", path, reader.width, reader.height, reader.channels);
+	}else if (reader.frame != options->steps){
+		printf("reference %s is of step %ld, not %d\n", path, reader.frame, options->steps);
+	}else{
+		compareFrames(reader.pixels, frame, pixels, speciesCount, metrics);
+		status = metrics->psnr >= options->minPsnr && metrics->maxError <= options->maxError && metrics->coverageDifference <= options->maxCoverage;
+	}
+	closeRecording(&reader);
+	return status;
+}
+
+// Run preset on engine and write or check its reference, returns 0 if it passed, 1 if there is no gpu reference to check
+static int runPreset(const GoldenOptions* options, const char* preset, int engine){
+	Species species[MAX_SPECIES];
+	Simulation simulation;
+	if (loadPreset(preset, species, &simulation) != 0){
+		printf("Failed to load preset: %s\n", preset);
+		return -1;
+	}
+	int speciesCount = (int)simulation.species;
+	size_t pixels = (size_t)PHYSARUM_COLUMNS * PHYSARUM_ROWS;
+	uint8_t* frame = malloc(pixels * getFrameChannels(speciesCount));
+
+	printf("%-26s %-11s  ", preset, engineNames[engine]);
+	fflush(stdout);
+	double start = getSeconds();
+	int status;
+	if (engine == ENGINE_GPU){
+		status = runGpu(options, species, &simulation, frame);
+	}else{
+		status = runCpu(options, engine == ENGINE_WORKERS ? options->threads : 1, species, &simulation, frame);
+	}
+	double elapsed = getSeconds() - start;
+	if (status != 0){
+		printf("failed to run\n");
+		free(frame);
+		return -1;
+	}
+
+	char path[512];
+	getReferencePath(options, preset, engine, path, sizeof(path));
+	if (options->update){
+		status = writeReference(path, frame, pixels, options->steps, species, speciesCount);
+		printf("%.1f ms / step, %s %s\n", elapsed * 1000. / options->steps, status == 0 ? "wrote" : "failed to write", path);
+	}else{
+		GoldenMetrics metrics;
+		int result = checkReference(options, path, frame, pixels, speciesCount, &metrics);
+		if (result >= 0){
+			printf("%.1f ms / step, PSNR %5.1f dB, max error %.3f, coverage", elapsed * 1000. / options->steps, metrics.psnr, metrics.maxError);
+			int s;
+			for (s = 0; s < speciesCount; s++){
+				printf(" %.3f/%.3f", metrics.coverage[s][0], metrics.coverage[s][1]);
+			}
+			printf("  %s\n", result ? "ok" : "DRIFT");
+		}else if (result == -2 && engine == ENGINE_GPU){
+			// The cpu references are committed, gpu references depend on the driver and are kept locally
+			printf("no reference %s, skipped (write it with --update)\n", path);
+		}else if (result == -2){
+			printf("no reference %s (write it with --update)\n", path);
+		}
+		status = result == 1 ? 0 : (result == -2 && engine == ENGINE_GPU) ? 1 : -1;
+	}
+	free(frame);
+	return status;
+}
+
+/*----------------------------------*/
+
+int main(int argc, char** argv){
+	GoldenOptions options = {0, GOLDEN_STEPS, GOLDEN_SEED, GOLDEN_DIRECTORY, {1, 1, 1}, 2, 0, 0, 0, 0, 0, 1, 1, GOLDEN_MIN_PSNR, GOLDEN_MAX_ERROR, GOLDEN_MAX_COVERAGE};
+	const char** presets = malloc(argc * sizeof(char*));
+	int presetCount = 0, threadsGiven = 0, i;
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--update") == 0){
+			options.update = 1;
+		}else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc){
+			options.steps = atoi(argv[++i]);
+		}else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+			options.seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+		}else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc){
+			options.directory = argv[++i];
+		}else if (strcmp(argv[i], "--cpu") == 0){
+			options.engines[ENGINE_GPU] = 0;
+		}else if (strcmp(argv[i], "--gpu") == 0){
+			options.engines[ENGINE_CPU] = options.engines[ENGINE_WORKERS] = 0;
+		}else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+			options.threads = atoi(argv[++i]);
+			threadsGiven = 1;
+		}else if (strcmp(argv[i], "--pipeline") == 0){
+			options.pipeline = 1;
+		}else if (strcmp(argv[i], "--compact-agents") == 0){
+			options.compactAgents = 1;
+		}else if (strcmp(argv[i], "--fast-trig") == 0){
+			options.fastTrig = 1;
+		}else if (strcmp(argv[i], "--wrap") == 0){
+			options.wrap = 1;
+		}else if (strcmp(argv[i], "--multi-rate") == 0){
+			options.multiRate = 1;
+		}else if (strcmp(argv[i], "--diffuse-every") == 0 && i + 1 < argc){
+			options.diffusePeriod = atoi(argv[++i]) > 1 ? atoi(argv[i]) : 1;
+		}else if (strcmp(argv[i], "--diffuse-scale") == 0 && i + 1 < argc){
+			options.diffuseScale = atoi(argv[++i]) > 1 ? atoi(argv[i]) : 1;
+		}else if (strcmp(argv[i], "--min-psnr") == 0 && i + 1 < argc){
+			options.minPsnr = atof(argv[++i]);
+		}else if (strcmp(argv[i], "--max-error") == 0 && i + 1 < argc){
+			options.maxError = atof(argv[++i]);
+		}else if (strcmp(argv[i], "--max-coverage") == 0 && i + 1 < argc){
+			options.maxCoverage = atof(argv[++i]);
+		}else if (argv[i][0] != '-'){
+			presets[presetCount++] = argv[i];
+		}else{
+			printf("Usage: %s [PRESET...] [--update] [--steps N] [--seed N] [--dir DIR] [--cpu | --gpu] [--threads N] [--pipeline] [--compact-agents] [--fast-trig] [--wrap] [--multi-rate] [--diffuse-every N] [--diffuse-scale N] [--min-psnr DB] [--max-error E] [--max-coverage F]\n", argv[0]);
+			printf("  PRESET         settings files to run (default: Presets/*.txt)\n");
+			printf("  --update       write the references instead of comparing with them\n");
+			printf("  --steps N      steps of every run (default %d), the references are of one number of steps\n", GOLDEN_STEPS);
+			printf("  --seed N       seed of every run (default %d), has to be the seed of the references\n", GOLDEN_SEED);
+			printf("  --dir DIR      directory of the references (default %s)\n", GOLDEN_DIRECTORY);
+			printf("  --cpu, --gpu   only run the cpu / gpu simulation (default both, the gpu if there is an OpenGL 4.3 context)\n");
+			printf("  --threads N    only run the cpu simulation with one thread (N = 1) or N workers (default: both, 2 workers)\n");
+			printf("  --pipeline, --compact-agents, --fast-trig, --wrap, --multi-rate, --diffuse-every N, --diffuse-scale N  kernels to check, like ./compile\n");
+			printf("  --min-psnr DB  drift if the PSNR of the 8 bit trails is below DB (default %.0f)\n", GOLDEN_MIN_PSNR);
+			printf("  --max-error E  drift if any trail differs by more than E (default %.2f)\n", GOLDEN_MAX_ERROR);
+			printf("  --max-coverage F  drift if the part of the trailMap above %.2f of any species differs by more than F (default %.2f)\n", GOLDEN_COVERAGE_LEVEL, GOLDEN_MAX_COVERAGE);
+			free(presets);
+			return -1;
+		}
+	}
+
+	// A number of threads picks one of the cpu engines
+	if (threadsGiven){
+		options.engines[ENGINE_CPU] &= options.threads <= 1;
+		options.engines[ENGINE_WORKERS] &= options.threads > 1;
+	}
+
+	glob_t found;
+	memset(&found, 0, sizeof(found));
+	if (presetCount == 0){
+		glob("Presets/*.txt", 0, NULL, &found);
+		presets = realloc(presets, (found.gl_pathc + 1) * sizeof(char*));
+		for (i = 0; i < (int)found.gl_pathc; i++){
+			presets[presetCount++] = found.gl_pathv[i];
+		}
+	}
+	if (options.update){
+		mkdir(options.directory, 0755);
+	}
+
+	// The gpu simulation is optional: machines without OpenGL 4.3 only check the cpu
+	if (options.engines[ENGINE_GPU] && createHeadlessContext() != 0){
+		printf("No OpenGL 4.3 context, skipping the gpu simulation\n");
+		options.engines[ENGINE_GPU] = 0;
+	}
+
+	// Gpu runs without reference are skipped: a fresh checkout only has the cpu references
+	int failed = 0, skipped = 0, runs = 0, engine, p;
+	for (engine = 0; engine < ENGINES; engine++){
+		for (p = 0; p < presetCount && options.engines[engine]; p++){
+			int status = runPreset(&options, presets[p], engine);
+			failed += status < 0;
+			skipped += status > 0;
+			runs++;
+		}
+	}
+	if (options.engines[ENGINE_GPU]){
+		destroyHeadlessContext();
+	}
+	printf("%d of %d runs %s", runs - failed - skipped, runs, options.update ? "written" : "passed");
+	if (skipped){
+		printf(", %d gpu runs without reference skipped (./golden --gpu --update on a tree that is known to be good writes them)", skipped);
+	}
+	printf("\n");
+
+	globfree(&found);
+	free(presets);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "recording.h"
+#include "framering.h"
+
+/*
+Plays back a recording of --record FILE --record-delta: decodes it frame by frame from any frame on,
+as fast as possible or at a frame rate, into a raw float32 file (like --record) or a shared memory ring (like --publish)
+*/
+
+static double getSeconds(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void sleepUntil(double time){
+	double wait = time - getSeconds();
+	if (wait <= 0) return;
+	struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+	nanosleep(&ts, NULL);
+}
+
+static void printInfo(const char* path, const RecordingReader* reader){
+	FILE* file = fopen(path, "rb");
+	fseeko(file, 0, SEEK_END);
+	double fileSize = (double)ftello(file);
+	fclose(file);
+	printf("%s: %ld frames, %ld keyframes (every %u frames), %u species%s\n", path, reader->frameCount, reader->keyframeCount,
+		reader->header.keyframeInterval, reader->header.speciesCount, reader->header.indexOffset ? "" : ", not closed (indexed by scanning)");
+	if (reader->frameCount > 0){
+		double rawSize = (double)reader->frameCount * reader->width * reader->height * reader->channels * sizeof(float);
+		printf("%dx%d, %d channels, %.1f MB, %.1f KB per frame, %.1f x smaller than float32\n", reader->width, reader->height, reader->channels,
+			fileSize / 1e6, fileSize / reader->frameCount / 1e3, rawSize / fileSize);
+	}
+}
+
+int main(int argc, char** argv){
+	const char* path = NULL, *rawPath = NULL, *publishName = NULL;
+	int info = 0, publishFormat = FRAME_RING_RGBA8;
+	long seek = 0, count = -1;
+	double fps = 0;
+	int i;
+	for (i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--info") == 0){
+			info = 1;
+		}else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc){
+			seek = atol(argv[++i]);
+		}else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc){
+			count = atol(argv[++i]);
+		}else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc){
+			fps = atof(argv[++i]);
+		}else if (strcmp(argv[i], "--raw") == 0 && i + 1 < argc){
+			rawPath = argv[++i];
+		}else if (strcmp(argv[i], "--publish") == 0 && i + 1 < argc){
+			publishName = argv[++i];
+		}else if (strcmp(argv[i], "--publish-raw") == 0){
+			publishFormat = FRAME_RING_FLOAT;
+		}else if (path == NULL && argv[i][0] != '-'){
+			path = argv[i];
+		}else{
+			path = NULL;
+			break;
+		}
+	}
+	if (path == NULL){
+		printf("Usage: %s FILE [--info] [--seek N] [--count N] [--fps F] [--raw FILE] [--publish NAME [--publish-raw]]\n", argv[0]);
+		printf("  --info         print the size and compression of the recording\n");
+		printf("  --seek N       start at frame N (decoded from the keyframe before it)\n");
+		printf("  --count N      play N frames (default: to the end)\n");
+		printf("  --fps F        play F frames per second (default: as fast as possible, reports the speed against 60 fps)\n");
+		printf("  --raw FILE     write the frames as raw float32 like --record\n");
+		printf("  --publish NAME  write the frames into the POSIX shared memory ring NAME like --publish\n");
+		printf("  --publish-raw  publish one float per species and pixel instead of colors\n");
+		return -1;
+	}
+
+	RecordingReader reader;
+	if (openRecording(&reader, path) != 0){
+		printf("Failed to open recording %s\n", path);
+		return -1;
+	}
+	// The first frame tells the size
+	double start = getSeconds();
+	if (reader.frameCount == 0 || seekRecording(&reader, seek < reader.frameCount ? seek : reader.frameCount - 1) != 0){
+		printf("Failed to read frame %ld of %ld\n", seek, reader.frameCount);
+		closeRecording(&reader);
+		return -1;
+	}
+	double seekTime = getSeconds() - start;
+	if (info){
+		printInfo(path, &reader);
+		printf("Seek to frame %ld: %.2f ms\n", reader.number, seekTime * 1000.);
+		if (count < 0 && rawPath == NULL && publishName == NULL){
+			closeRecording(&reader);
+			return 0;
+		}
+	}
+
+	FILE* raw = NULL;
+	if (rawPath && (raw = fopen(rawPath, "wb")) == NULL){
+		printf("Failed to open %s\n", rawPath);
+	}
+	FrameRing ring;
+	int publishing = 0;
+	Species species[MAX_SPECIES];
+	memset(species, 0, sizeof(species));
+	for (i = 0; i < MAX_SPECIES; i++){
+		species[i].r = reader.header.colors[i][0];
+		species[i].g = reader.header.colors[i][1];
+		species[i].b = reader.header.colors[i][2];
+	}
+	if (publishName){
+		if (createFrameRing(&ring, publishName, publishFormat, FRAME_RING_SLOTS, reader.width, reader.height, reader.channels, species) != 0){
+			printf("Failed to create the shared memory ring %s\n", publishName);
+		}else{
+			publishing = 1;
+		}
+	}
+
+	float* pixels = NULL;
+	size_t pixelCapacity = 0;
+	long frames = 0;
+	int status = 1;
+	start = getSeconds();
+	while (status == 1 && (count < 0 || frames < count)){
+		if (raw || publishing){
+			size_t size = (size_t)reader.width * reader.height * reader.channels;
+			if (size > pixelCapacity){
+				pixels = realloc(pixels, size * sizeof(float));
+				pixelCapacity = size;
+			}
+			getRecordedPixels(&reader, pixels);
+			if (raw) fwrite(pixels, sizeof(float), size, raw);
+			if (publishing) publishFrame(pixels, reader.width, reader.height, reader.channels, reader.frame, &ring);
+		}
+		frames++;
+		if (fps > 0) sleepUntil(start + frames / fps);
+		if (count < 0 || frames < count) status = readRecordedFrame(&reader);
+	}
+	double elapsed = getSeconds() - start;
+	if (status < 0){
+		printf("Recording is corrupt after frame %ld\n", reader.number);
+	}
+	printf("Played %ld frames in %.3f s: %.1f frames / s (%.1f x realtime at %.0f fps)\n", frames, elapsed, frames / elapsed,
+		frames / elapsed / (fps > 0 ? fps : 60.), fps > 0 ? fps : 60.);
+
+	free(pixels);
+	if (raw) fclose(raw);
+	if (publishing) destroyFrameRing(&ring);
+	closeRecording(&reader);
+	return status < 0 ? -1 : 0;
+}